@@ -48,6 +48,7 @@ void PrintTagMap(const TagMap &tagMap)
 OsmDecoder::OsmDecoder()
 {
 	output = nullptr;
+	decodeMask = DecodeAll;
 }
 
 OsmDecoder::~OsmDecoder()
@@ -364,6 +365,149 @@ std::set<int64_t> OsmData::GetRelationIds() const
 	return out;
 }
 
+// ****** ordered event buffer ******
+
+OsmEventBuffer::OsmEventBuffer()
+{
+
+}
+
+OsmEventBuffer::~OsmEventBuffer()
+{
+
+}
+
+bool OsmEventBuffer::Replay(class IDataStreamHandler &out) const
+{
+	size_t nodec = 0, wayc = 0, relationc = 0, boundsc = 0, isDiffc = 0;
+	bool stop = false;
+	for(size_t i=0; i < this->events.size() && !stop; i++)
+	{
+		switch(this->events[i])
+		{
+		case EventSync:
+			stop = out.Sync();
+			break;
+		case EventReset:
+			stop = out.Reset();
+			break;
+		case EventIsDiff:
+			stop = out.StoreIsDiff(this->isDiffs[isDiffc++]);
+			break;
+		case EventBounds:
+		{
+			const std::vector<double> &bbox = this->bounds[boundsc++];
+			stop = out.StoreBounds(bbox[0], bbox[1], bbox[2], bbox[3]);
+			break;
+		}
+		case EventNode:
+		{
+			const class OsmNode &node = this->nodes[nodec++];
+			stop = out.StoreNode(node.objId, node.metaData, node.tags, node.lat, node.lon);
+			break;
+		}
+		case EventWay:
+		{
+			const class OsmWay &way = this->ways[wayc++];
+			stop = out.StoreWay(way.objId, way.metaData, way.tags, way.refs);
+			break;
+		}
+		case EventRelation:
+		{
+			const class OsmRelation &relation = this->relations[relationc++];
+			stop = out.StoreRelation(relation.objId, relation.metaData, relation.tags, 
+				relation.refTypeStrs, relation.refIds, relation.refRoles);
+			break;
+		}
+		}
+	}
+	return stop;
+}
+
+void OsmEventBuffer::Clear()
+{
+	events.clear();
+	nodes.clear();
+	ways.clear();
+	relations.clear();
+	bounds.clear();
+	isDiffs.clear();
+}
+
+bool OsmEventBuffer::Sync()
+{
+	this->events.push_back(EventSync);
+	return false;
+}
+
+bool OsmEventBuffer::Reset()
+{
+	this->events.push_back(EventReset);
+	return false;
+}
+
+bool OsmEventBuffer::StoreIsDiff(bool d)
+{
+	this->events.push_back(EventIsDiff);
+	this->isDiffs.push_back(d);
+	return false;
+}
+
+bool OsmEventBuffer::StoreBounds(double x1, double y1, double x2, double y2)
+{
+	this->events.push_back(EventBounds);
+	std::vector<double> b(4);
+	b[0] = x1;
+	b[1] = y1;
+	b[2] = x2;
+	b[3] = y2;
+	this->bounds.push_back(b);
+	return false;
+}
+
+bool OsmEventBuffer::StoreNode(int64_t objId, const class MetaData &metaData, 
+	const TagMap &tags, double lat, double lon)
+{
+	this->events.push_back(EventNode);
+	this->nodes.resize(this->nodes.size()+1);
+	class OsmNode &osmNode = this->nodes.back();
+	osmNode.objId = objId;
+	osmNode.metaData = metaData;
+	osmNode.tags = tags; 
+	osmNode.lat = lat;
+	osmNode.lon = lon;
+	return false;
+}
+
+bool OsmEventBuffer::StoreWay(int64_t objId, const class MetaData &metaData, 
+		const TagMap &tags, const std::vector<int64_t> &refs)
+{
+	this->events.push_back(EventWay);
+	this->ways.resize(this->ways.size()+1);
+	class OsmWay &osmWay = this->ways.back();
+	osmWay.objId = objId;
+	osmWay.metaData = metaData;
+	osmWay.tags = tags; 
+	osmWay.refs = refs;
+	return false;
+}
+
+bool OsmEventBuffer::StoreRelation(int64_t objId, const class MetaData &metaData, const TagMap &tags, 
+		const std::vector<std::string> &refTypeStrs, const std::vector<int64_t> &refIds, 
+		const std::vector<std::string> &refRoles)
+{
+	this->events.push_back(EventRelation);
+	this->relations.resize(this->relations.size()+1);
+	class OsmRelation &osmRelation = this->relations.back();
+	osmRelation.objId = objId;
+	osmRelation.metaData = metaData;
+	osmRelation.tags = tags; 
+	osmRelation.refTypeStrs = refTypeStrs;
+	osmRelation.refIds = refIds;
+	osmRelation.refRoles = refRoles;
+	return false;
+}
+
 // *********************************
 
 OsmChange::OsmChange() : IOsmChangeBlock()
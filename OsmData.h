@@ -48,6 +48,14 @@ public:
 
 	virtual bool StoreNode(int64_t objId, const class MetaData &metaData, 
 		const TagMap &tags, double lat, double lon) {return false;};
+	///Store a node with its position in units of 1e-7 degrees, as o5m and pbf at its default
+	///granularity use. Decoders call this when the position is exact at that precision, so
+	///encoders can skip converting through double. By default it is passed on to StoreNode.
+	virtual bool StoreNodeFixed(int64_t objId, const class MetaData &metaData, 
+		const TagMap &tags, int64_t lat, int64_t lon)
+	{
+		return this->StoreNode(objId, metaData, tags, lat / 1e7, lon / 1e7);
+	};
 	virtual bool StoreWay(int64_t objId, const class MetaData &metaData, 
 		const TagMap &tags, const std::vector<int64_t> &refs) {return false;};
 	virtual bool StoreRelation(int64_t objId, const class MetaData &metaData, const TagMap &tags, 
@@ -76,6 +84,10 @@ public:
 
 	class IDataStreamHandler *output;
 	std::string errString;
+
+	///Types of content to pass to the output. Set before decoding starts. Honoured by the o5m and pbf decoders.
+	enum DecodeMaskBits {DecodeNodes = 0x1, DecodeWays = 0x2, DecodeRelations = 0x4, DecodeBounds = 0x8, DecodeAll = 0xf};
+	unsigned decodeMask;
 };
 
 class OsmObject
@@ -167,6 +179,39 @@ public:
 	std::set<int64_t> GetRelationIds() const;
 };
 
+///Records a stream of events in order, so they can be replayed to another handler later.
+///Used to pass objects decoded on worker threads back to the calling thread.
+class OsmEventBuffer : public IDataStreamHandler
+{
+public:
+	enum EventType {EventSync, EventReset, EventIsDiff, EventBounds, EventNode, EventWay, EventRelation};
+
+	std::vector<EventType> events;
+	std::vector<class OsmNode> nodes;
+	std::vector<class OsmWay> ways;
+	std::vector<class OsmRelation> relations;
+	std::vector<std::vector<double> > bounds;
+	std::vector<bool> isDiffs;
+
+	OsmEventBuffer();
+	virtual ~OsmEventBuffer();
+	///Send the recorded events to out. Returns true if out requested to halt processing.
+	bool Replay(class IDataStreamHandler &out) const;
+	void Clear();
+
+	bool Sync();
+	bool Reset();
+	bool StoreIsDiff(bool);
+	bool StoreBounds(double x1, double y1, double x2, double y2);
+	bool StoreNode(int64_t objId, const class MetaData &metaData, 
+		const TagMap &tags, double lat, double lon);
+	bool StoreWay(int64_t objId, const class MetaData &metaData, 
+		const TagMap &tags, const std::vector<int64_t> &refs);
+	bool StoreRelation(int64_t objId, const class MetaData &metaData, const TagMap &tags, 
+		const std::vector<std::string> &refTypeStrs, const std::vector<int64_t> &refIds, 
+		const std::vector<std::string> &refRoles);
+};
+
 class OsmChange : public IOsmChangeBlock
 {
 public:
@@ -0,0 +1,122 @@
+//Microbenchmark of delta coded zigzag varint decoding, as used for way node refs
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <stdexcept>
+#include "varint.h"
+using namespace std;
+
+//The per value stream loop that o5m way decoding originally used
+int64_t DecodeRefsStream(const std::string &refData, int64_t lastRef, std::vector<int64_t> &out)
+{
+	std::istringstream refDataStream(refData);
+	out.clear();
+	while(!refDataStream.eof())
+	{
+		try {
+			lastRef += DecodeZigzag(refDataStream);
+		}
+		catch (std::runtime_error &err)
+		{
+			if(refDataStream.eof())
+				continue;
+			throw err;
+		}
+		out.push_back(lastRef);
+	}
+	return lastRef;
+}
+
+//Scalar cursor loop
+int64_t DecodeRefsCursor(const std::string &refData, int64_t lastRef, std::vector<int64_t> &out)
+{
+	const uint8_t *cursor = (const uint8_t *)refData.data();
+	const uint8_t *end = cursor + refData.size();
+	out.clear();
+	while(cursor < end)
+	{
+		int64_t delta = 0;
+		cursor = DecodeZigzag(cursor, end, delta);
+		if(cursor == NULL)
+			throw runtime_error("Malformed input");
+		lastRef += delta;
+		out.push_back(lastRef);
+	}
+	return lastRef;
+}
+
+//Batch decoder
+int64_t DecodeRefsBatch(const std::string &refData, int64_t lastRef, std::vector<int64_t> &out)
+{
+	const uint8_t *cursor = (const uint8_t *)refData.data();
+	out.clear();
+	if(DecodeZigzagDeltas(cursor, cursor + refData.size(), lastRef, out) == NULL)
+		throw runtime_error("Malformed input");
+	return lastRef;
+}
+
+double TimeDecoder(int64_t (*decoder)(const std::string &, int64_t, std::vector<int64_t> &),
+	const std::vector<std::string> &ways, int reps, int64_t &checksum)
+{
+	std::vector<int64_t> refs;
+	auto start = std::chrono::steady_clock::now();
+	for(int r=0; r<reps; r++)
+	{
+		int64_t lastRef = 0;
+		for(size_t i=0; i<ways.size(); i++)
+		{
+			lastRef = decoder(ways[i], lastRef, refs);
+			checksum += refs.size();
+		}
+		checksum += lastRef;
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+int main(int argc, char **argv)
+{
+	//Ways of various lengths with mostly short node ID deltas, as in typical extracts
+	std::mt19937_64 rng(1);
+	std::vector<std::string> ways;
+	size_t totalRefs = 0;
+	int64_t lastRef = 0;
+	for(int i=0; i<20000; i++)
+	{
+		size_t len = 2 + rng() % 400;
+		std::string refData;
+		for(size_t j=0; j<len; j++)
+		{
+			int64_t ref = lastRef;
+			if(rng() % 8 == 0)
+				ref += (int64_t)(rng() % 100000000) - 50000000;
+			else
+				ref += (int64_t)(rng() % 120) - 60;
+			refData.append(EncodeZigzag(ref - lastRef));
+			lastRef = ref;
+		}
+		totalRefs += len;
+		ways.push_back(refData);
+	}
+	int reps = 5;
+
+	int64_t checkStream = 0, checkCursor = 0, checkBatch = 0;
+	double tStream = TimeDecoder(DecodeRefsStream, ways, reps, checkStream);
+	double tCursor = TimeDecoder(DecodeRefsCursor, ways, reps, checkCursor);
+	double tBatch = TimeDecoder(DecodeRefsBatch, ways, reps, checkBatch);
+	if(checkStream != checkCursor or checkStream != checkBatch)
+	{
+		cerr << "Decoders disagree" << endl;
+		return -1;
+	}
+
+	double refsDecoded = (double)totalRefs * reps;
+	cout << "refs decoded: " << refsDecoded << endl;
+	cout << "istream loop: " << refsDecoded / tStream / 1e6 << " Mrefs/s" << endl;
+	cout << "cursor loop: " << refsDecoded / tCursor / 1e6 << " Mrefs/s" << endl;
+	cout << "batch: " << refsDecoded / tBatch / 1e6 << " Mrefs/s" << endl;
+	return 0;
+}
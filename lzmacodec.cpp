@@ -0,0 +1,67 @@
+#include <stdexcept>
+#include "lzmacodec.h"
+using namespace std;
+
+LzmaCodec::LzmaCodec()
+{
+	lzma_stream init = LZMA_STREAM_INIT;
+	encodeStream = init;
+	decodeStream = init;
+}
+
+LzmaCodec::~LzmaCodec()
+{
+	lzma_end(&encodeStream);
+	lzma_end(&decodeStream);
+}
+
+void LzmaCodec::Compress(const char *data, size_t len, std::string &out, int preset)
+{
+	uint32_t lzmaPreset = preset < 0 ? LZMA_PRESET_DEFAULT : (uint32_t)preset;
+	if(lzma_easy_encoder(&encodeStream, lzmaPreset, LZMA_CHECK_CRC32) != LZMA_OK)
+		throw runtime_error("lzma_easy_encoder failed");
+
+	//lzma_stream_buffer_bound gives enough space to compress in a single call
+	out.resize(lzma_stream_buffer_bound(len));
+	encodeStream.next_in = (const uint8_t *)data;
+	encodeStream.avail_in = len;
+	encodeStream.next_out = (uint8_t *)&out[0];
+	encodeStream.avail_out = out.size();
+
+	lzma_ret ret = lzma_code(&encodeStream, LZMA_FINISH);
+	if(ret != LZMA_STREAM_END)
+		throw runtime_error("lzma compression failed");
+	out.resize(out.size() - encodeStream.avail_out);
+}
+
+void LzmaCodec::Decompress(const char *data, size_t len, std::string &out, size_t rawSize)
+{
+	//Accepts both xz and legacy .lzma streams
+	if(lzma_auto_decoder(&decodeStream, UINT64_MAX, 0) != LZMA_OK)
+		throw runtime_error("lzma_auto_decoder failed");
+
+	if(rawSize == 0)
+		rawSize = len * 4 + 64;
+	out.resize(rawSize);
+	decodeStream.next_in = (const uint8_t *)data;
+	decodeStream.avail_in = len;
+
+	size_t written = 0;
+	while(true)
+	{
+		decodeStream.next_out = (uint8_t *)&out[written];
+		decodeStream.avail_out = out.size() - written;
+		lzma_ret ret = lzma_code(&decodeStream, LZMA_FINISH);
+		written = out.size() - decodeStream.avail_out;
+		if(ret == LZMA_STREAM_END)
+			break;
+		if(ret == LZMA_OK and decodeStream.avail_out == 0)
+		{
+			//Size hint was too small
+			out.resize(out.size() * 2);
+			continue;
+		}
+		throw runtime_error("lzma decompression failed, data is truncated or corrupt");
+	}
+	out.resize(written);
+}
@@ -0,0 +1,28 @@
+#ifndef _LZMACODEC_H
+#define _LZMACODEC_H
+
+#include <string>
+#include <lzma.h>
+
+///Compresses and decompresses LZMA data for PBF blobs. Compressed data is written as an xz
+///stream. Both xz and legacy .lzma streams are decompressed. The lzma_stream is reinitialised
+///for each call, which reuses its memory, so use one codec per thread.
+class LzmaCodec
+{
+protected:
+	lzma_stream encodeStream, decodeStream;
+
+public:
+	LzmaCodec();
+	virtual ~LzmaCodec();
+
+	///Compress len bytes into out, replacing its content. preset is 0-9, or negative for the
+	///liblzma default.
+	void Compress(const char *data, size_t len, std::string &out, int preset = -1);
+
+	///Decompress len bytes into out, replacing its content. rawSize is the expected size of the
+	///result, or zero if unknown. The buffer grows if the hint is too small.
+	void Decompress(const char *data, size_t len, std::string &out, size_t rawSize = 0);
+};
+
+#endif //_LZMACODEC_H
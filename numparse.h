@@ -0,0 +1,93 @@
+#ifndef _NUMPARSE_H
+#define _NUMPARSE_H
+
+#include <stdint.h>
+
+// Number parsing for text formats such as OSM XML. Unlike atol and atof, these do not
+// depend on the locale, detect overflow and reject trailing characters. They return
+// false if the whole string is not a number, leaving out unchanged.
+
+///Parse an optionally signed decimal integer
+inline bool ParseInt64(const char *str, int64_t &out)
+{
+	const char *p = str;
+	bool negative = *p == '-';
+	if(*p == '-' || *p == '+')
+		p++;
+	if(*p < '0' || *p > '9')
+		return false;
+
+	const uint64_t maxMagnitude = negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+	uint64_t val = 0;
+	for(; *p >= '0' && *p <= '9'; p++)
+	{
+		unsigned digit = *p - '0';
+		if(val > (maxMagnitude - digit) / 10)
+			return false;
+		val = val * 10 + digit;
+	}
+	if(*p != '\0')
+		return false;
+
+	out = negative ? (int64_t)(0 - val) : (int64_t)val;
+	return true;
+}
+
+///Parse a decimal number such as "-51.5074812" into an integer in units of 10^-decimals, so
+///"1.5" with 7 decimals gives 15000000. Further digits are rounded half away from zero.
+///Exponents are not accepted.
+inline bool ParseFixedPoint(const char *str, unsigned decimals, int64_t &out)
+{
+	const char *p = str;
+	bool negative = *p == '-';
+	if(*p == '-' || *p == '+')
+		p++;
+
+	uint64_t val = 0;
+	bool anyDigits = false, overflow = false;
+	for(; *p >= '0' && *p <= '9'; p++)
+	{
+		overflow |= val > ((uint64_t)INT64_MAX - (*p - '0')) / 10;
+		val = val * 10 + (*p - '0');
+		anyDigits = true;
+	}
+
+	unsigned fractionDigits = 0;
+	bool roundUp = false;
+	if(*p == '.')
+	{
+		for(p++; *p >= '0' && *p <= '9'; p++)
+		{
+			anyDigits = true;
+			if(fractionDigits < decimals)
+			{
+				overflow |= val > ((uint64_t)INT64_MAX - (*p - '0')) / 10;
+				val = val * 10 + (*p - '0');
+			}
+			else if(fractionDigits == decimals)
+				roundUp = *p >= '5'; //Only the first discarded digit decides the rounding
+			if(fractionDigits <= decimals)
+				fractionDigits++;
+		}
+	}
+	if(!anyDigits || *p != '\0')
+		return false;
+
+	for(; fractionDigits < decimals; fractionDigits++)
+	{
+		overflow |= val > (uint64_t)INT64_MAX / 10;
+		val *= 10;
+	}
+	if(roundUp)
+	{
+		overflow |= val == (uint64_t)INT64_MAX;
+		val++;
+	}
+	if(overflow)
+		return false;
+
+	out = negative ? -(int64_t)val : (int64_t)val;
+	return true;
+}
+
+#endif //_NUMPARSE_H
@@ -4,6 +4,11 @@
 #include <iostream>
 #include <stdlib.h>
 #include <cmath>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "varint.h"
 #include "o5m.h"
 #include <iostream>
@@ -22,6 +27,21 @@ void TestDecodeNumber()
 	assert (DecodeZigzag("\x03") == -2);
 	assert (DecodeZigzag("\x05") == -3);
 	assert (DecodeZigzag("\x81\x01") == -65);
+
+	const uint8_t buff[] = {0xc3, 0x02, 0x81, 0x01, 0x80};
+	uint64_t val = 0;
+	int64_t zz = 0;
+	assert (DecodeVarint(buff, buff+2, val) == buff+2 && val == 323);
+	assert (DecodeZigzag(buff+2, buff+4, zz) == buff+4 && zz == -65);
+	assert (DecodeVarint(buff, buff+1, val) == NULL); //Truncated
+	assert (DecodeVarint(buff+4, buff+5, val) == NULL);
+	assert (DecodeZigzag(buff, buff, zz) == NULL);
+
+	std::vector<int64_t> refs;
+	int64_t lastRef = 100;
+	assert (DecodeZigzagDeltas(buff, buff+4, lastRef, refs) == buff+4);
+	assert (refs.size() == 2 && refs[0] == -62 && refs[1] == -127 && lastRef == -127);
+	assert (DecodeZigzagDeltas(buff, buff+5, lastRef, refs) == NULL);
 }
 
 void TestEncodeNumber()
@@ -37,6 +57,26 @@ void TestEncodeNumber()
 	assert (EncodeZigzag(-65) == "\x81\x01");
 }
 
+// Cursor helpers that treat truncated input as a malformed object
+
+static inline uint64_t ReadVarint(const uint8_t *&cursor, const uint8_t *end)
+{
+	uint64_t val = 0;
+	cursor = DecodeVarint(cursor, end, val);
+	if(cursor == NULL)
+		throw std::runtime_error("Truncated varint in o5m object");
+	return val;
+}
+
+static inline int64_t ReadZigzag(const uint8_t *&cursor, const uint8_t *end)
+{
+	int64_t val = 0;
+	cursor = DecodeZigzag(cursor, end, val);
+	if(cursor == NULL)
+		throw std::runtime_error("Truncated zigzag varint in o5m object");
+	return val;
+}
+
 void ReadExactLength(std::istream &str, char *out, size_t len)
 {
 	size_t total = 0;
@@ -50,45 +90,112 @@ void ReadExactLength(std::istream &str, char *out, size_t len)
 	}
 }
 
+// ****** o5m segment index ******
+
+O5mIndexEntry::O5mIndexEntry()
+{
+	offset = 0;
+	objType = 0;
+	firstId = 0;
+	lastId = 0;
+	objCount = 0;
+}
+
+void SaveO5mIndex(const std::vector<class O5mIndexEntry> &index, uint64_t dataSize, std::streambuf &out)
+{
+	std::string buff = "o5mi";
+	buff.append(EncodeVarint(1)); //Format version
+	buff.append(EncodeVarint(dataSize));
+	buff.append(EncodeVarint(index.size()));
+	for(size_t i=0; i<index.size(); i++)
+	{
+		const class O5mIndexEntry &entry = index[i];
+		buff.append(EncodeVarint(entry.offset));
+		buff.append(1, (char)entry.objType);
+		buff.append(EncodeZigzag(entry.firstId));
+		buff.append(EncodeZigzag(entry.lastId));
+		buff.append(EncodeVarint(entry.objCount));
+	}
+	if(out.sputn(buff.data(), buff.size()) != (std::streamsize)buff.size())
+		throw std::runtime_error("Failed to write o5m index");
+}
+
+uint64_t LoadO5mIndex(std::streambuf &in, std::vector<class O5mIndexEntry> &index)
+{
+	std::istream handle(&in);
+	char magic[4];
+	handle.read(magic, 4);
+	if(handle.fail() || std::string(magic, 4) != "o5mi")
+		throw std::runtime_error("Not an o5m index");
+	if(DecodeVarint(handle) != 1)
+		throw std::runtime_error("Unsupported o5m index version");
+	uint64_t dataSize = DecodeVarint(handle);
+	uint64_t count = DecodeVarint(handle);
+
+	index.clear();
+	for(uint64_t i=0; i<count; i++)
+	{
+		class O5mIndexEntry entry;
+		entry.offset = DecodeVarint(handle);
+		int objType = handle.get();
+		if(handle.fail())
+			throw std::runtime_error("Truncated o5m index");
+		entry.objType = objType;
+		entry.firstId = DecodeZigzag(handle);
+		entry.lastId = DecodeZigzag(handle);
+		entry.objCount = DecodeVarint(handle);
+		index.push_back(entry);
+	}
+	return dataSize;
+}
+
+int64_t FindO5mSegment(const std::vector<class O5mIndexEntry> &index, unsigned char objType, int64_t objId)
+{
+	//Objects are expected in ID order, so take the last segment starting at or before objId
+	int64_t found = -1;
+	for(size_t i=0; i<index.size(); i++)
+	{
+		const class O5mIndexEntry &entry = index[i];
+		if(entry.objType != objType)
+			continue;
+		if(found < 0 || entry.firstId <= objId)
+			found = i;
+		if(entry.lastId >= objId)
+			break;
+	}
+	return found;
+}
+
+int64_t FindO5mSegment(const std::vector<class O5mIndexEntry> &index, unsigned char objType)
+{
+	for(size_t i=0; i<index.size(); i++)
+		if(index[i].objType == objType)
+			return i;
+	return -1;
+}
+
 // ****** o5m decoder ******
 
-O5mDecode::O5mDecode(std::streambuf &handleIn) : 
+O5mDecodeBase::O5mDecodeBase() : 
 	OsmDecoder(),
-	handle(&handleIn),
 	refTableLengthThreshold(250),
 	refTableMaxSize(15000)
 {
 	finished = false;
 	stopProcessing = false;
-
-	if(handle.fail())
-		throw std::runtime_error("Stream handle indicating failure in o5m decode");
-
-	this->stringPairs.SetBufferSize(this->refTableMaxSize);
-	char tmp = handle.get();
-	if(handle.fail())
-		throw std::runtime_error("Error reading buffer to get o5m magic number");
-	std::string tmp2(&tmp, 1);
-	if(tmp2 != "\xff")
-		throw std::runtime_error("First byte has wrong value");
-
-	tmp = handle.get();
-	if(handle.fail())
-		throw std::runtime_error("Error reading buffer to get o5m header");
-	std::string tmp3(&tmp, 1);
-	if(tmp3 != "\xe0")
-		throw std::runtime_error("Missing o5m header");
-
+	datasetStart = nullptr;
+	skippedStart = nullptr;
+	this->stringPairs.SetBufferSize(this->refTableMaxSize, this->refTableLengthThreshold);
 	this->ResetDeltaCoding();
 }
 
-O5mDecode::~O5mDecode()
+O5mDecodeBase::~O5mDecodeBase()
 {
 	if(!this->finished)
 		this->DecodeFinish();
 }
 
-void O5mDecode::ResetDeltaCoding()
+void O5mDecodeBase::ResetDeltaCoding()
 {
 	this->lastObjId = 0; //Used in delta encoding
 	this->lastTimeStamp = 0;
@@ -99,40 +206,208 @@ void O5mDecode::ResetDeltaCoding()
 	this->lastRefNode = 0;
 	this->lastRefWay = 0;
 	this->lastRefRelation = 0;
+	this->skippedStart = nullptr;
+	this->skippedBuff.clear();
 }
 
-bool O5mDecode::DecodeNext()
+bool O5mDecodeBase::WantDataset(unsigned char code) const
 {
-	if(finished)
-		throw runtime_error("Decode already finished");
+	switch(code)
+	{
+	case 0x10:
+		return (this->decodeMask & DecodeNodes) != 0;
+	case 0x11:
+		return (this->decodeMask & DecodeWays) != 0;
+	case 0x12:
+		return (this->decodeMask & DecodeRelations) != 0;
+	case 0xdb:
+		return (this->decodeMask & DecodeBounds) != 0;
+	}
+	return true;
+}
 
-	unsigned char code = this->handle.get();
-	if(this->handle.fail())
-		throw std::runtime_error("Error reading type code");
+void O5mDecodeBase::CatchUpSkipped()
+{
+	if(this->skippedStart != nullptr)
+	{
+		const uint8_t *start = this->skippedStart;
+		this->skippedStart = nullptr;
+		this->ApplySkipped(start, this->datasetStart);
+	}
+	if(!this->skippedBuff.empty())
+	{
+		const uint8_t *start = (const uint8_t *)this->skippedBuff.data();
+		this->ApplySkipped(start, start + this->skippedBuff.size());
+		this->skippedBuff.clear();
+	}
+}
 
+void O5mDecodeBase::ApplySkipped(const uint8_t *cursor, const uint8_t *end)
+{
+	while(cursor < end)
+	{
+		unsigned char code = *cursor;
+		cursor ++;
+		if(code >= 0xF0)
+			continue;
+		uint64_t length = ReadVarint(cursor, end);
+		if(length > (uint64_t)(end - cursor))
+			throw std::runtime_error("Input underflow");
+		this->SkipObject(code, cursor, cursor + length);
+		cursor += length;
+	}
+}
+
+const uint8_t *O5mDecodeBase::SkipString(const uint8_t *cursor, const uint8_t *end)
+{
+	const uint8_t *term = (const uint8_t *)memchr(cursor, 0x00, end - cursor);
+	if(term == NULL)
+		throw std::runtime_error("End of data while reading string");
+	return term + 1;
+}
+
+const uint8_t *O5mDecodeBase::SkipStringPair(const uint8_t *cursor, const uint8_t *end)
+{
+	uint64_t ref = ReadVarint(cursor, end);
+	if(ref != 0x00)
+	{
+		this->CheckStringRef(ref);
+		return cursor;
+	}
+	const uint8_t *second = this->SkipString(cursor, end);
+	const uint8_t *next = this->SkipString(second, end);
+	size_t firstLen = second - 1 - cursor, secondLen = next - 1 - second;
+	if(firstLen + secondLen <= this->refTableLengthThreshold)
+		this->stringPairs.PushBack((const char *)cursor, firstLen, (const char *)second, secondLen);
+	return next;
+}
+
+const uint8_t *O5mDecodeBase::SkipMetaData(const uint8_t *cursor, const uint8_t *end)
+{
+	if(cursor == end)
+		return cursor;
+	if(ReadVarint(cursor, end) == 0) //Version
+		return cursor;
+	this->lastTimeStamp += ReadZigzag(cursor, end);
+	if(this->lastTimeStamp == 0)
+		return cursor;
+	this->lastChangeSet += ReadZigzag(cursor, end);
+	return this->SkipStringPair(cursor, end); //Uid and username
+}
+
+void O5mDecodeBase::SkipObject(unsigned char code, const uint8_t *cursor, const uint8_t *end)
+{
+	//Follow the delta coding and string table of an unwanted object, without building
+	//its tags, metadata or references
+	if(code < 0x10 || code > 0x12)
+		return;
+	this->lastObjId += ReadZigzag(cursor, end);
+	cursor = this->SkipMetaData(cursor, end);
+	if(cursor < end && code == 0x10)
+	{
+		this->lastLon += ReadZigzag(cursor, end);
+		this->lastLat += ReadZigzag(cursor, end);
+	}
+	else if(cursor < end)
+	{
+		uint64_t refLen = ReadVarint(cursor, end);
+		if(refLen > (uint64_t)(end - cursor))
+			throw std::runtime_error("o5m reference section exceeds object length");
+		const uint8_t *refEnd = cursor + refLen;
+		while(code == 0x11 && cursor < refEnd)
+			this->lastRefNode += ReadZigzag(cursor, refEnd);
+		while(code == 0x12 && cursor < refEnd)
+		{
+			int64_t deltaRef = ReadZigzag(cursor, refEnd);
+			uint64_t refIndex = ReadVarint(cursor, refEnd);
+			char typeCode = 0;
+			if(refIndex == 0)
+			{
+				const uint8_t *typeAndRole = cursor;
+				cursor = this->SkipString(cursor, refEnd);
+				size_t len = cursor - 1 - typeAndRole;
+				if(len <= this->refTableLengthThreshold)
+					this->stringPairs.PushBack((const char *)typeAndRole, len, "", 0);
+				typeCode = len > 0 ? typeAndRole[0] : 0;
+			}
+			else
+			{
+				this->CheckStringRef(refIndex);
+				this->stringPairs.GetFirst(refIndex, this->tmpTypeAndRole);
+				typeCode = this->tmpTypeAndRole.size() > 0 ? this->tmpTypeAndRole[0] : 0;
+			}
+
+			//As in DecodeRelation, where atoi gives 0 for an unknown type
+			if(typeCode == 0)
+				throw std::runtime_error("o5m relation member type/role string too short");
+			if(typeCode == '1')
+				this->lastRefWay += deltaRef;
+			else if(typeCode == '2')
+				this->lastRefRelation += deltaRef;
+			else if(typeCode < '3' || typeCode > '9')
+				this->lastRefNode += deltaRef;
+		}
+		cursor = refEnd;
+	}
+
+	//Tags only add to the string table
+	while(cursor < end)
+		cursor = this->SkipStringPair(cursor, end);
+}
+
+void O5mDecodeBase::CheckStart(const uint8_t *cursor, const uint8_t *end)
+{
+	if(end - cursor < 1)
+		throw std::runtime_error("Error reading buffer to get o5m magic number");
+	if(cursor[0] != 0xff)
+		throw std::runtime_error("First byte has wrong value");
+	if(end - cursor < 2)
+		throw std::runtime_error("Error reading buffer to get o5m header");
+	if(cursor[1] != 0xe0)
+		throw std::runtime_error("Missing o5m header");
+}
+
+bool O5mDecodeBase::DecodeDataset(unsigned char code, const uint8_t *cursor, const uint8_t *end)
+{
 	//std::cout << "found code " << (unsigned int)code << std::endl;
+	if(!this->WantDataset(code))
+	{
+		//Bounding boxes carry no delta state
+		if(code != 0xdb && this->skippedStart == nullptr)
+			this->skippedStart = this->datasetStart;
+		return !stopProcessing;
+	}
+	if(code >= 0x10 && code <= 0x12)
+		this->CatchUpSkipped();
+
 	switch(code)
 	{
 	case 0x10:
-		this->DecodeNode();
-		return !stopProcessing;
+		this->DecodeNode(cursor, end);
 		break;
 	case 0x11:
-		this->DecodeWay();
-		return !stopProcessing;
+		this->DecodeWay(cursor, end);
 		break;
 	case 0x12:
-		this->DecodeRelation();
-		return !stopProcessing;
+		this->DecodeRelation(cursor, end);
 		break;
 	case 0xdb:
-		this->DecodeBoundingBox();
-		return !stopProcessing;
+		this->DecodeBoundingBox(cursor, end);
 		break;
 	case 0xee: //Sync code
 		if (this->output != NULL)
 			stopProcessing |= this->output->Sync();
 		break;
+	}
+
+	//Unknown datasets are skipped
+	return !stopProcessing;
+}
+
+bool O5mDecodeBase::DecodeSingleByteCode(unsigned char code)
+{
+	switch(code)
+	{
 	case 0xff: //Reset code
 		//Used in delta encoding information
 		this->ResetDeltaCoding();
@@ -144,367 +419,834 @@ bool O5mDecode::DecodeNext()
 		return !stopProcessing; //End of file
 		break;
 	}
-	if(code >= 0xF0 && code <= 0xFF)
-		return false;
-
-	//Default behavior to skip unknown data
-	uint64_t length = DecodeVarint(this->handle);
-	tmpBuff.resize(length);
-	ReadExactLength(this->handle, &tmpBuff[0], length);
-	return !stopProcessing;
+	return false;
 }
 
-void O5mDecode::DecodeHeader()
+const uint8_t *O5mDecodeBase::DecodeBuffered(const uint8_t *cursor, const uint8_t *end, bool &ok)
 {
-	if(finished)
-		throw runtime_error("Decode already finished");
+	//Decode one single byte code or dataset from the buffer and return the position after it
+	this->datasetStart = cursor;
+	unsigned char code = *cursor;
+	cursor ++;
+	if(code >= 0xF0)
+	{
+		ok = this->DecodeSingleByteCode(code);
+		return cursor;
+	}
 
-	uint64_t length = DecodeVarint(this->handle);
-	std::string fileType;
-	fileType.resize(length);
-	ReadExactLength(this->handle, &fileType[0], length);
+	uint64_t length = ReadVarint(cursor, end);
+	if(length > (uint64_t)(end - cursor))
+		throw std::runtime_error("Input underflow");
+	ok = this->DecodeDataset(code, cursor, cursor + length);
+	return cursor + length;
+}
+
+void O5mDecodeBase::DecodeHeaderDataset(const uint8_t *cursor, const uint8_t *end)
+{
+	std::string fileType((const char *)cursor, end - cursor);
 	if(this->output != NULL)
 		stopProcessing |= this->output->StoreIsDiff("o5c2"==fileType);
 }
 
-void O5mDecode::DecodeBoundingBox()
+void O5mDecodeBase::DecodeBoundingBox(const uint8_t *cursor, const uint8_t *end)
 {
-	DecodeVarint(this->handle); //Value discarded
-
 	//south-western corner 
-	double x1 = DecodeZigzag(this->handle) / 1e7; //lon
-	double y1 = DecodeZigzag(this->handle) / 1e7; //lat
+	double x1 = ReadZigzag(cursor, end) / 1e7; //lon
+	double y1 = ReadZigzag(cursor, end) / 1e7; //lat
 
 	//north-eastern corner
-	double x2 = DecodeZigzag(this->handle) / 1e7; //lon
-	double y2 = DecodeZigzag(this->handle) / 1e7; //lat
+	double x2 = ReadZigzag(cursor, end) / 1e7; //lon
+	double y2 = ReadZigzag(cursor, end) / 1e7; //lat
 
 	if(this->output != NULL)
 		stopProcessing |= this->output->StoreBounds(x1, y1, x2, y2);
 }
 
-void O5mDecode::DecodeSingleString(std::istream &stream, std::string &out)
+const uint8_t *O5mDecodeBase::DecodeSingleString(const uint8_t *cursor, const uint8_t *end, std::string &out)
 {
-	char tmp[] = "a";
-	out = "";
-	int code = 0x01;
-	while((char)code != 0x00)
-	{
-		code = stream.get();
-		if(code == std::char_traits<char>::eof())
-			throw std::runtime_error("End of file while reading string");
-		if(stream.fail())
-		{
-			throw std::runtime_error("Error reading string");
-		}
-		if ((char)code != 0x00)
-		{
-			tmp[0] = (char)code;
-			out.append(tmp, 1);
-		}
-	}
+	const uint8_t *term = (const uint8_t *)memchr(cursor, 0x00, end - cursor);
+	if(term == NULL)
+		throw std::runtime_error("End of data while reading string");
+	out.assign((const char *)cursor, term - cursor);
+	return term + 1;
 }
 
-void O5mDecode::ConsiderAddToStringRefTable(const std::string &firstStr, const std::string &secondStr)
+void O5mDecodeBase::ConsiderAddToStringRefTable(const std::string &firstStr, const std::string &secondStr)
 {
-	//Consider adding pair to string reference table
+	//Consider adding pair to string reference table. The oldest entry is dropped when full.
 	if(firstStr.size() + secondStr.size() <= this->refTableLengthThreshold)
-	{
-		this->combinedRawTmpBuff = "";
-		this->combinedRawTmpBuff.append(firstStr);
-		this->combinedRawTmpBuff.append("\x00", 1);
-		this->combinedRawTmpBuff.append(secondStr);
-		this->combinedRawTmpBuff.append("\x00", 1);
-		this->AddBuffToStringRefTable(this->combinedRawTmpBuff);
-	}
+		this->stringPairs.PushBack(firstStr.data(), firstStr.size(), secondStr.data(), secondStr.size());
 }
 
-void O5mDecode::AddBuffToStringRefTable(const std::string &buff)
+void O5mDecodeBase::CheckStringRef(uint64_t ref)
 {
-	//Make sure it does not grow forever
-	if(this->stringPairs.AvailableSpace() == 0)
-	{
-		this->stringPairs.PopFront();
-	}
-
-	this->stringPairs.PushBack(buff);
+	if(this->stringPairs.ValidRef(ref))
+		return;
+	int64_t offset = (int64_t)this->stringPairs.Size()-(int64_t)ref;
+	stringstream ss;
+	ss << "o5m reference " << offset << " out of range (should be in range 0-"<< ((int64_t)this->stringPairs.Size()-1) << ")";
+	throw std::runtime_error(ss.str());
 }
 
-bool O5mDecode::ReadStringPair(std::istream &stream, std::string &firstStr, std::string &secondStr)
+const uint8_t *O5mDecodeBase::ReadStringPair(const uint8_t *cursor, const uint8_t *end, std::string &firstStr, std::string &secondStr)
 {
-	uint64_t ref = 0;
-	try {
-		ref = DecodeVarint(stream);
-	}
-	catch (std::runtime_error &err)
-	{
-		if(stream.eof()) {
-			firstStr = "";
-			secondStr = "";
-			return false;
-		}
-		throw err;
-	}
+	uint64_t ref = ReadVarint(cursor, end);
 	if(ref == 0x00)
 	{
 		//Found new pair of strings
-		this->DecodeSingleString(stream, firstStr);
-		this->DecodeSingleString(stream, secondStr);
+		cursor = this->DecodeSingleString(cursor, end, firstStr);
+		cursor = this->DecodeSingleString(cursor, end, secondStr);
 		this->ConsiderAddToStringRefTable(firstStr, secondStr);
 	}
 	else
 	{
-		int64_t offset = this->stringPairs.Size()-ref;
-		if(offset < 0 || offset >= (int64_t)this->stringPairs.Size())
-		{
-			stringstream ss;
-			ss << "o5m reference " << offset << " out of range (should be in range 0-"<< (this->stringPairs.Size()-1) << ")";
-			throw std::runtime_error(ss.str());
-		}
-		const std::string &prevPair = this->stringPairs[offset];
-		std::istringstream ss(prevPair);
-		this->DecodeSingleString(ss, firstStr);
-		this->DecodeSingleString(ss, secondStr);
+		this->CheckStringRef(ref);
+		this->stringPairs.GetPair(ref, firstStr, secondStr);
 	}
-	return true;
+	return cursor;
 }
 
-void O5mDecode::DecodeMetaData(std::istream &nodeDataStream, class MetaData &out)
+const uint8_t *O5mDecodeBase::DecodeMetaData(const uint8_t *cursor, const uint8_t *end, class MetaData &out)
 {
 	//Decode author and time stamp
-	out.version = DecodeVarint(nodeDataStream);
+	out.version = 0;
 	out.timestamp = 0;
 	out.changeset = 0;
 	out.uid = 0;
-	std::string uidStr;
 	out.username="";
+	if(cursor == end)
+		return cursor; //Deleted objects in o5c may have only an ID
+
+	out.version = ReadVarint(cursor, end);
 	if(out.version != 0)
 	{
-		int64_t deltaTime = DecodeZigzag(nodeDataStream);
+		int64_t deltaTime = ReadZigzag(cursor, end);
 		this->lastTimeStamp += deltaTime;
 		out.timestamp = this->lastTimeStamp;
 		//print "timestamp", self.lastTimeStamp, deltaTime
 		if(out.timestamp != 0)
 		{
-			int64_t deltaChangeSet = DecodeZigzag(nodeDataStream);
+			int64_t deltaChangeSet = ReadZigzag(cursor, end);
 			this->lastChangeSet += deltaChangeSet;
 			out.changeset = this->lastChangeSet;
 			//print "changeset", self.lastChangeSet, deltaChangeSet
 
-			this->ReadStringPair(nodeDataStream, uidStr, out.username);
-			if (uidStr.size() > 0)
-				out.uid = DecodeVarint(uidStr.c_str());
+			cursor = this->ReadStringPair(cursor, end, this->tmpUidStr, out.username);
+			if (this->tmpUidStr.size() > 0)
+			{
+				const uint8_t *uidCursor = (const uint8_t *)this->tmpUidStr.data();
+				out.uid = ReadVarint(uidCursor, uidCursor + this->tmpUidStr.size());
+			}
 		}
 	}
+	return cursor;
 }
 
-void O5mDecode::DecodeNode()
+void O5mDecodeBase::DecodeTags(const uint8_t *cursor, const uint8_t *end)
 {
-	uint64_t length = DecodeVarint(this->handle);
-	std::string &nodeData = tmpBuff;
-	nodeData.resize(length);
-	ReadExactLength(this->handle, &nodeData[0], length);
+	this->tmpTagsBuff.clear();
+	while(cursor < end)
+	{
+		cursor = this->ReadStringPair(cursor, end, this->tmpFirstStr, this->tmpSecondStr);
+		this->tmpTagsBuff[this->tmpFirstStr] = this->tmpSecondStr;
+	}
+}
 
+void O5mDecodeBase::DecodeNode(const uint8_t *cursor, const uint8_t *end)
+{
 	//Decode object ID
-	std::istringstream nodeDataStream(nodeData);
-	int64_t deltaId = DecodeZigzag(nodeDataStream);
+	int64_t deltaId = ReadZigzag(cursor, end);
 	this->lastObjId += deltaId;
 	int64_t objectId = this->lastObjId; 
 
-	this->DecodeMetaData(nodeDataStream, this->tmpMetaData);
+	cursor = this->DecodeMetaData(cursor, end, this->tmpMetaData);
 
-	this->lastLon += DecodeZigzag(nodeDataStream);
-	this->lastLat += DecodeZigzag(nodeDataStream);
-	double lon = this->lastLon / 1e7;
-	double lat = this->lastLat / 1e7;
-
-	//Extract tags
-	std::string firstString, secondString;
-	this->tmpTagsBuff.clear();
-	while(!nodeDataStream.eof())
+	//Deleted objects in o5c stop after the author information
+	this->tmpMetaData.visible = cursor < end;
+	double lon = 0.0, lat = 0.0;
+	if(this->tmpMetaData.visible)
 	{
-		bool ok = this->ReadStringPair(nodeDataStream, firstString, secondString);
-		if(ok) this->tmpTagsBuff[firstString] = secondString;
+		this->lastLon += ReadZigzag(cursor, end);
+		this->lastLat += ReadZigzag(cursor, end);
+		lon = this->lastLon / 1e7;
+		lat = this->lastLat / 1e7;
 	}
 
+	//Extract tags
+	this->DecodeTags(cursor, end);
+
 	if(this->output != NULL)
 		stopProcessing |= this->output->StoreNode(objectId, this->tmpMetaData, this->tmpTagsBuff, lat, lon);
 }
 
-void O5mDecode::DecodeWay()
+void O5mDecodeBase::DecodeWay(const uint8_t *cursor, const uint8_t *end)
 {
-	uint64_t length = DecodeVarint(this->handle);
-	std::string &objData = tmpBuff;
-	objData.resize(length);
-	ReadExactLength(this->handle, &objData[0], length);
+	//Decode object ID
+	int64_t deltaId = ReadZigzag(cursor, end);
+	this->lastObjId += deltaId;
+	int64_t objectId = this->lastObjId;
+	//print "objectId", objectId
+
+	cursor = this->DecodeMetaData(cursor, end, this->tmpMetaData);
+
+	//Deleted objects in o5c stop after the author information
+	this->tmpMetaData.visible = cursor < end;
+	uint64_t refLen = 0;
+	if(this->tmpMetaData.visible)
+		refLen = ReadVarint(cursor, end);
+	//print "len ref", refLen
+	if(refLen > (uint64_t)(end - cursor))
+		throw std::runtime_error("o5m way reference section exceeds object length");
+
+	const uint8_t *refEnd = cursor + refLen;
+	this->tmpRefsBuff.clear();
+	cursor = DecodeZigzagDeltas(cursor, refEnd, this->lastRefNode, this->tmpRefsBuff);
+	if(cursor == NULL)
+		throw std::runtime_error("Malformed way reference section in o5m object");
+
+	//Extract tags
+	this->DecodeTags(cursor, end);
 
+	if (this->output != NULL)
+		stopProcessing |= this->output->StoreWay(objectId, this->tmpMetaData, this->tmpTagsBuff, this->tmpRefsBuff);
+}
+
+void O5mDecodeBase::DecodeRelation(const uint8_t *cursor, const uint8_t *end)
+{
 	//Decode object ID
-	std::istringstream objDataStream(objData);
-	int64_t deltaId = DecodeZigzag(objDataStream);
+	int64_t deltaId = ReadZigzag(cursor, end);
 	this->lastObjId += deltaId;
 	int64_t objectId = this->lastObjId;
 	//print "objectId", objectId
 
-	this->DecodeMetaData(objDataStream, this->tmpMetaData);
+	cursor = this->DecodeMetaData(cursor, end, this->tmpMetaData);
 
-	uint64_t refLen = DecodeVarint(objDataStream);
+	//Deleted objects in o5c stop after the author information
+	this->tmpMetaData.visible = cursor < end;
+	uint64_t refLen = 0;
+	if(this->tmpMetaData.visible)
+		refLen = ReadVarint(cursor, end);
 	//print "len ref", refLen
+	if(refLen > (uint64_t)(end - cursor))
+		throw std::runtime_error("o5m relation reference section exceeds object length");
+
+	const uint8_t *refEnd = cursor + refLen;
+	this->tmpRefsBuff.clear();
+	this->tmpRefRolesBuff.clear();
+	this->tmpRefTypeStrBuff.clear();
+
+	std::string &typeAndRole = this->tmpTypeAndRole;
+	while (cursor < refEnd)
+	{
+		int64_t deltaRef = ReadZigzag(cursor, refEnd);
+
+		uint64_t refIndex = ReadVarint(cursor, refEnd); //Index into reference table
+		if(refIndex == 0)
+		{
+			cursor = this->DecodeSingleString(cursor, refEnd, typeAndRole);
+			//Stored as a pair with an empty second string
+			this->ConsiderAddToStringRefTable(typeAndRole, std::string());
+		}
+		else
+		{
+			this->CheckStringRef(refIndex);
+			this->stringPairs.GetFirst(refIndex, typeAndRole);
+		}
+
+		//Role may be empty but the type code is always present
+		if(typeAndRole.size() < 1)
+			throw std::runtime_error("o5m relation member type/role string too short");
+		char typeCodeStr[] = "a";
+		typeCodeStr[0] = typeAndRole[0];
+		int typeCode = atoi(typeCodeStr);
+		int64_t refId = 0;
+		const char *typeStr = "";
+		switch(typeCode)
+		{
+		case 0:
+			this->lastRefNode += deltaRef;
+			refId = this->lastRefNode;
+			typeStr = "node";
+			break;
+		case 1:
+			this->lastRefWay += deltaRef;
+			refId = this->lastRefWay;
+			typeStr = "way";
+			break;
+		case 2:
+			this->lastRefRelation += deltaRef;
+			refId = this->lastRefRelation;
+			typeStr = "relation";
+			break;
+		}
+
+		this->tmpRefsBuff.push_back(refId);
+		this->tmpRefRolesBuff.push_back(std::string());
+		this->tmpRefRolesBuff.back().assign(typeAndRole, 1, std::string::npos);
+		this->tmpRefTypeStrBuff.push_back(typeStr);
+	}
+
+	//Extract tags
+	this->DecodeTags(cursor, end);
+
+	if(this->output != NULL)
+		stopProcessing |= this->output->StoreRelation(objectId, this->tmpMetaData, this->tmpTagsBuff, 
+			this->tmpRefTypeStrBuff, this->tmpRefsBuff, this->tmpRefRolesBuff);
+
+}
+
+void O5mDecodeBase::DecodeFinish()
+{
+	if(finished)
+		throw runtime_error("Decode already finished");
+	if(this->output != nullptr)
+		this->output->Finish();
+	finished = true;
+}
+
+// ****** o5m stream decoder ******
+
+O5mDecode::O5mDecode(std::streambuf &handleIn) : 
+	O5mDecodeBase(),
+	handle(&handleIn),
+	skippedOffset(-1),
+	skippedCode(0),
+	skippedLength(0),
+	skippedItems(0)
+{
+	if(handle.fail())
+		throw std::runtime_error("Stream handle indicating failure in o5m decode");
+
+	uint8_t start[2];
+	int tmp = handle.get();
+	if(handle.fail())
+		throw std::runtime_error("Error reading buffer to get o5m magic number");
+	start[0] = tmp;
+	if(start[0] != 0xff)
+		throw std::runtime_error("First byte has wrong value");
+
+	tmp = handle.get();
+	if(handle.fail())
+		throw std::runtime_error("Error reading buffer to get o5m header");
+	start[1] = tmp;
+	this->CheckStart(start, start+2);
+}
+
+O5mDecode::~O5mDecode()
+{
+
+}
+
+void O5mDecode::ResetDeltaCoding()
+{
+	O5mDecodeBase::ResetDeltaCoding();
+	this->skippedOffset = -1;
+}
+
+bool O5mDecode::DecodeNext()
+{
+	if(finished)
+		throw runtime_error("Decode already finished");
+
+	int rawCode = this->handle.get();
+	if(rawCode == std::char_traits<char>::eof())
+		return false; //End of stream between datasets
+	if(this->handle.fail())
+		throw std::runtime_error("Error reading type code");
+	unsigned char code = (unsigned char)rawCode;
+	if(this->skippedOffset >= 0)
+		this->skippedItems ++;
+	if(code >= 0xF0)
+		return this->DecodeSingleByteCode(code);
+
+	uint64_t length = DecodeVarint(this->handle);
+	if(!this->WantDataset(code))
+	{
+		if(code != 0xdb && this->skippedOffset < 0 && this->skippedBuff.empty())
+		{
+			//Start of a run of skipped objects, which is found again by seeking if needed
+			std::streamoff pos = this->handle.tellg();
+			if(pos >= 0)
+			{
+				this->skippedOffset = pos;
+				this->skippedCode = code;
+				this->skippedLength = length;
+				this->skippedItems = 0;
+			}
+		}
+
+		if(code == 0xdb || this->skippedOffset >= 0)
+		{
+			this->handle.ignore(length);
+			if((uint64_t)this->handle.gcount() != length)
+				throw std::runtime_error("Input underflow");
+			return !stopProcessing;
+		}
+
+		//The stream is not seekable, so keep a copy of the object in case a wanted object
+		//follows before the next reset
+		this->skippedBuff.append(1, (char)code);
+		this->skippedBuff.append(EncodeVarint(length));
+		size_t payloadStart = this->skippedBuff.size();
+		this->skippedBuff.resize(payloadStart + length);
+		ReadExactLength(this->handle, &this->skippedBuff[payloadStart], length);
+
+		//Bound memory use when a stream has few resets
+		if(this->skippedBuff.size() > 16*1024*1024)
+			this->CatchUpSkipped();
+		return !stopProcessing;
+	}
+	if(code >= 0x10 && code <= 0x12 && this->skippedOffset >= 0)
+		this->CatchUpSeekable();
+
+	tmpBuff.resize(length);
+	ReadExactLength(this->handle, &tmpBuff[0], length);
+	const uint8_t *cursor = (const uint8_t *)tmpBuff.data();
+	return this->DecodeDataset(code, cursor, cursor + length);
+}
+
+void O5mDecode::CatchUpSeekable()
+{
+	//Read the skipped objects again, one at a time, then return to the wanted object
+	std::streampos resume = this->handle.tellg();
+	uint64_t items = this->skippedItems - 1;
+	std::streamoff offset = this->skippedOffset;
+	this->skippedOffset = -1;
+	this->handle.seekg(offset);
+	if(this->handle.fail())
+		throw std::runtime_error("Failed to seek to skipped o5m objects");
+
+	unsigned char code = this->skippedCode;
+	uint64_t length = this->skippedLength;
+	for(uint64_t i=0; i<=items; i++)
+	{
+		if(i > 0)
+		{
+			code = (unsigned char)this->handle.get();
+			if(this->handle.fail())
+				throw std::runtime_error("Error reading type code");
+			if(code >= 0xF0)
+				continue;
+			length = DecodeVarint(this->handle);
+		}
+		tmpBuff.resize(length);
+		ReadExactLength(this->handle, &tmpBuff[0], length);
+		const uint8_t *cursor = (const uint8_t *)tmpBuff.data();
+		this->SkipObject(code, cursor, cursor + length);
+	}
+
+	this->handle.seekg(resume);
+	if(this->handle.fail())
+		throw std::runtime_error("Failed to seek to o5m object");
+}
+
+void O5mDecode::SeekToSegment(uint64_t offset)
+{
+	this->handle.clear();
+	this->handle.seekg(offset);
+	if(this->handle.fail())
+		throw std::runtime_error("Failed to seek to o5m segment");
+	this->ResetDeltaCoding();
+}
+
+void O5mDecode::DecodeHeader()
+{
+	if(finished)
+		throw runtime_error("Decode already finished");
+
+	uint64_t length = DecodeVarint(this->handle);
+	tmpBuff.resize(length);
+	ReadExactLength(this->handle, &tmpBuff[0], length);
+	const uint8_t *cursor = (const uint8_t *)tmpBuff.data();
+	this->DecodeHeaderDataset(cursor, cursor + length);
+}
+
+// ****** o5m memory mapped decoder ******
+
+O5mDecodeMapped::O5mDecodeMapped(const std::string &filename) : 
+	O5mDecodeBase(),
+	mapping(nullptr),
+	mappingSize(0)
+{
+	int fd = open(filename.c_str(), O_RDONLY);
+	if(fd < 0)
+		throw std::runtime_error("Could not open o5m file " + filename);
+	struct stat st;
+	if(fstat(fd, &st) != 0)
+	{
+		close(fd);
+		throw std::runtime_error("Could not get size of o5m file " + filename);
+	}
+	if(st.st_size == 0)
+	{
+		close(fd);
+		throw std::runtime_error("Error reading buffer to get o5m magic number");
+	}
+
+	void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); //The mapping keeps its own reference to the file
+	if(addr == MAP_FAILED)
+		throw std::runtime_error("Could not memory map o5m file " + filename);
+	mapping = addr;
+	mappingSize = st.st_size;
+
+	data = (const uint8_t *)addr;
+	end = data + mappingSize;
+	madvise(mapping, mappingSize, MADV_SEQUENTIAL); //Hint only, so failure is ignored
+	this->CheckStart(data, end);
+	cursor = data + 2;
+}
+
+O5mDecodeMapped::O5mDecodeMapped(const uint8_t *buff, size_t len) : 
+	O5mDecodeBase(),
+	data(buff),
+	cursor(buff),
+	end(buff + len),
+	mapping(nullptr),
+	mappingSize(0)
+{
+	this->CheckStart(data, end);
+	cursor = data + 2;
+}
+
+O5mDecodeMapped::~O5mDecodeMapped()
+{
+	if(mapping != nullptr)
+		munmap(mapping, mappingSize);
+}
+
+bool O5mDecodeMapped::DecodeNext()
+{
+	if(finished)
+		throw runtime_error("Decode already finished");
+	if(cursor >= end)
+		return false; //End of buffer between datasets
+
+	bool ok = false;
+	cursor = this->DecodeBuffered(cursor, end, ok);
+	return ok;
+}
+
+void O5mDecodeMapped::DecodeHeader()
+{
+	if(finished)
+		throw runtime_error("Decode already finished");
+
+	uint64_t length = ReadVarint(cursor, end);
+	if(length > (uint64_t)(end - cursor))
+		throw std::runtime_error("Input underflow");
+	const uint8_t *datasetStart = cursor;
+	cursor += length;
+	this->DecodeHeaderDataset(datasetStart, cursor);
+}
+
+void O5mDecodeMapped::SeekToSegment(uint64_t offset)
+{
+	if(offset > this->DataSize())
+		throw std::runtime_error("o5m segment offset beyond end of data");
+	cursor = data + offset;
+	this->ResetDeltaCoding();
+}
 
-	std::string refData;
-	refData.resize(refLen);
-	objDataStream.read(&refData[0], refLen);
-	std::istringstream refDataStream(refData);
-	this->tmpRefsBuff.clear();
-	while(!refDataStream.eof())
+void O5mDecodeMapped::BuildIndex(std::vector<class O5mIndexEntry> &out) const
+{
+	out.clear();
+	class O5mIndexEntry entry;
+	entry.offset = cursor - data;
+	int64_t lastId = 0;
+	const uint8_t *pos = cursor;
+	while(pos < end)
 	{
-		try {
-			this->lastRefNode += DecodeZigzag(refDataStream);
+		unsigned char code = *pos;
+		pos ++;
+		if(code >= 0xF0)
+		{
+			if(code == 0xff)
+			{
+				if(entry.objCount > 0)
+					out.push_back(entry);
+				entry = O5mIndexEntry();
+				entry.offset = pos - data;
+				lastId = 0;
+			}
+			continue;
 		}
-		catch (std::runtime_error &err)
+
+		uint64_t length = ReadVarint(pos, end);
+		if(length > (uint64_t)(end - pos))
+			throw std::runtime_error("Input underflow");
+		const uint8_t *datasetEnd = pos + length;
+		if(code >= 0x10 && code <= 0x12)
 		{
-			if(refDataStream.eof())
-				continue;
-			throw err;
+			//Only the object ID is read
+			lastId += ReadZigzag(pos, datasetEnd);
+			if(entry.objCount == 0)
+			{
+				entry.objType = code;
+				entry.firstId = lastId;
+			}
+			else if(entry.objType != code)
+				entry.objType = 0;
+			entry.lastId = lastId;
+			entry.objCount ++;
 		}
-		this->tmpRefsBuff.push_back(this->lastRefNode);
+		pos = datasetEnd;
 	}
+	if(entry.objCount > 0)
+		out.push_back(entry);
+}
 
-	//Extract tags
-	std::string firstString, secondString;
-	this->tmpTagsBuff.clear();
-	while(!objDataStream.eof())
+// ****** o5m parallel decoder ******
+
+///A run of o5m data starting with fresh delta state, decoded by a worker thread
+class O5mSegmentJob
+{
+public:
+	const uint8_t *start, *end;
+	class OsmEventBuffer events;
+	bool done, halted;
+	std::string error;
+	bool inPlace; //Too large to buffer, so decoded by the thread calling DecodeNext
+	bool started;
+
+	O5mSegmentJob(const uint8_t *start, const uint8_t *end) : start(start), end(end), done(false), halted(false),
+		inPlace(false), started(false) {};
+};
+
+///Decoder state owned by a single worker thread
+class O5mSegmentDecode : public O5mDecodeBase
+{
+public:
+	O5mSegmentDecode() : O5mDecodeBase() {};
+	virtual ~O5mSegmentDecode()
+	{
+		this->output = nullptr;
+	};
+
+	bool DecodeNext() {return false;};
+
+	void DecodeSegment(class O5mSegmentJob &job)
 	{
-		bool ok = this->ReadStringPair(objDataStream, firstString, secondString);
-		if(ok) this->tmpTagsBuff[firstString] = secondString;
+		this->ResetDeltaCoding();
+		this->output = &job.events;
+		const uint8_t *cursor = job.start;
+		bool ok = true;
+		while(cursor < job.end && ok)
+			cursor = this->DecodeBuffered(cursor, job.end, ok);
+		job.halted = !ok;
+		this->output = nullptr;
 	}
+};
+
+O5mDecodeParallel::O5mDecodeParallel(const std::string &filename, unsigned numThreads) : 
+	O5mDecodeMapped(filename),
+	stopWorkers(false),
+	workersStarted(false),
+	numThreads(numThreads),
+	reorderWindow(0),
+	minSegmentSize(1024*1024),
+	maxSegmentSize(32*1024*1024)
+{
 
-	if (this->output != NULL)
-		stopProcessing |= this->output->StoreWay(objectId, this->tmpMetaData, this->tmpTagsBuff, this->tmpRefsBuff);
 }
 
-void O5mDecode::DecodeRelation()
+O5mDecodeParallel::O5mDecodeParallel(const uint8_t *buff, size_t len, unsigned numThreads) : 
+	O5mDecodeMapped(buff, len),
+	stopWorkers(false),
+	workersStarted(false),
+	numThreads(numThreads),
+	reorderWindow(0),
+	minSegmentSize(1024*1024),
+	maxSegmentSize(32*1024*1024)
 {
-	uint64_t length = DecodeVarint(this->handle);
-	std::string &objData = tmpBuff;
-	objData.resize(length);
-	ReadExactLength(this->handle, &objData[0], length);
 
-	//Decode object ID
-	std::istringstream objDataStream(objData);
-	int64_t deltaId = DecodeZigzag(objDataStream);
-	this->lastObjId += deltaId;
-	int64_t objectId = this->lastObjId;
-	//print "objectId", objectId
+}
 
-	this->DecodeMetaData(objDataStream, this->tmpMetaData);
+O5mDecodeParallel::~O5mDecodeParallel()
+{
+	this->StopWorkers();
+}
 
-	uint64_t refLen = DecodeVarint(objDataStream);
-	//print "len ref", refLen
+void O5mDecodeParallel::StartWorkers()
+{
+	this->workersStarted = true;
+	unsigned threadCount = this->numThreads;
+	if(threadCount == 0)
+		threadCount = std::thread::hardware_concurrency();
+	if(threadCount == 0)
+		threadCount = 2;
+	if(this->reorderWindow == 0)
+		this->reorderWindow = threadCount * 2;
+	if(threadCount < 2)
+		return;
 
-	std::string refData;
-	refData.resize(refLen);
-	objDataStream.read(&refData[0], refLen);
-	std::istringstream refDataStream(refData);
+	for(unsigned i=0; i<threadCount; i++)
+		this->workers.push_back(std::thread(&O5mDecodeParallel::WorkerLoop, this));
+}
 
-	this->tmpRefsBuff.clear();
-	this->tmpRefRolesBuff.clear();
-	this->tmpRefTypeStrBuff.clear();
+void O5mDecodeParallel::StopWorkers()
+{
+	{
+		std::lock_guard<std::mutex> lock(this->jobLock);
+		this->stopWorkers = true;
+	}
+	this->workAvailable.notify_all();
+	for(size_t i=0; i<this->workers.size(); i++)
+		this->workers[i].join();
+	this->workers.clear();
+	this->pending.clear();
+	this->inFlight.clear();
+}
 
-	while (!refDataStream.eof())
+void O5mDecodeParallel::WorkerLoop()
+{
+	class O5mSegmentDecode dec;
+	while(true)
 	{
-		int64_t deltaRef = 0;
-		try {
-			deltaRef += DecodeZigzag(refDataStream);
-		}
-		catch (std::runtime_error &err)
+		std::shared_ptr<class O5mSegmentJob> job;
 		{
-			if(refDataStream.eof())
-				continue;
-			throw err;
+			std::unique_lock<std::mutex> lock(this->jobLock);
+			this->workAvailable.wait(lock, [this]{return this->stopWorkers || !this->pending.empty();});
+			if(this->stopWorkers)
+				return;
+			job = this->pending.front();
+			this->pending.pop_front();
 		}
+		dec.decodeMask = this->decodeMask;
 
-		uint64_t refIndex = DecodeVarint(refDataStream); //Index into reference table
-		std::string typeAndRole;
-		if(refIndex == 0)
+		try
 		{
-			this->DecodeSingleString(refDataStream, typeAndRole);
-			if(typeAndRole.size() <= this->refTableLengthThreshold)
-				this->AddBuffToStringRefTable(typeAndRole);
+			dec.DecodeSegment(*job);
 		}
-		else
+		catch(std::exception &err)
 		{
-			int64_t offset = this->stringPairs.Size()-refIndex;
-			if(offset < 0 || offset >= (int64_t)this->stringPairs.Size())
-			{
-				stringstream ss;
-				ss << "o5m reference " << offset << " out of range (should be in range 0-"<< (this->stringPairs.Size()-1) << ")";
-				throw std::runtime_error(ss.str());
-			}
-			typeAndRole = this->stringPairs[offset];
+			job->error = err.what();
 		}
 
-		if(typeAndRole.size() < 2)
-			throw std::runtime_error("o5m relation member type/role string too short");
-		char typeCodeStr[] = "a";
-		typeCodeStr[0] = typeAndRole[0];
-		int typeCode = atoi(typeCodeStr);
-		std::string role(&typeAndRole[1], typeAndRole.size()-1);
-		int64_t refId = 0;
-		std::string typeStr;
-		switch(typeCode)
 		{
-		case 0:
-			this->lastRefNode += deltaRef;
-			refId = this->lastRefNode;
-			typeStr = "node";
-			break;
-		case 1:
-			this->lastRefWay += deltaRef;
-			refId = this->lastRefWay;
-			typeStr = "way";
-			break;
-		case 2:
-			this->lastRefRelation += deltaRef;
-			refId = this->lastRefRelation;
-			typeStr = "relation";
-			break;
+			std::lock_guard<std::mutex> lock(this->jobLock);
+			job->done = true;
 		}
+		this->workDone.notify_all();
+	}
+}
 
-		this->tmpRefsBuff.push_back(refId);
-		this->tmpRefRolesBuff.push_back(role);
-		this->tmpRefTypeStrBuff.push_back(typeStr);
+const uint8_t *O5mDecodeParallel::ScanSegment(const uint8_t *start)
+{
+	//Step over datasets by their lengths until a reset code ends the segment
+	const uint8_t *pos = start;
+	while(pos < end)
+	{
+		unsigned char code = *pos;
+		pos ++;
+		if(code >= 0xF0)
+		{
+			if(code == 0xff && (size_t)(pos - start) >= this->minSegmentSize)
+				break;
+			continue;
+		}
+		uint64_t length = ReadVarint(pos, end);
+		if(length > (uint64_t)(end - pos))
+			throw std::runtime_error("Input underflow");
+		pos += length;
 	}
+	return pos;
+}
 
-	//Extract tags
-	std::string firstString, secondString;
-	this->tmpTagsBuff.clear();
-	while(!objDataStream.eof())
+void O5mDecodeParallel::QueueSegments()
+{
+	while(this->cursor < this->end && this->inFlight.size() < this->reorderWindow)
+	{
+		const uint8_t *segEnd = this->ScanSegment(this->cursor);
+		std::shared_ptr<class O5mSegmentJob> job = make_shared<class O5mSegmentJob>(this->cursor, segEnd);
+		this->cursor = segEnd;
+		this->inFlight.push_back(job);
+		if((size_t)(segEnd - job->start) > this->maxSegmentSize)
+		{
+			//Keeps its place in the delivery order, but workers carry on with the following segments
+			job->inPlace = true;
+			continue;
+		}
+		{
+			std::lock_guard<std::mutex> lock(this->jobLock);
+			this->pending.push_back(job);
+		}
+		this->workAvailable.notify_one();
+	}
+}
+
+bool O5mDecodeParallel::DecodeNext()
+{
+	if(finished)
+		throw runtime_error("Decode already finished");
+	if(!this->workersStarted)
+		this->StartWorkers();
+	if(this->workers.empty())
+		return O5mDecodeMapped::DecodeNext(); //Single thread, so decode in place without buffering
+
+	this->QueueSegments();
+	if(this->inFlight.empty())
+		return false;
+
+	std::shared_ptr<class O5mSegmentJob> job = this->inFlight.front();
+	if(job->inPlace)
+	{
+		//Decode one dataset at a time with this decoder's own state
+		if(!job->started)
+		{
+			this->ResetDeltaCoding();
+			job->started = true;
+		}
+		bool ok = false;
+		job->start = this->DecodeBuffered(job->start, job->end, ok);
+		if(job->start >= job->end)
+			this->inFlight.pop_front();
+		return ok;
+	}
 	{
-		bool ok = this->ReadStringPair(objDataStream, firstString, secondString);
-		if(ok) this->tmpTagsBuff[firstString] = secondString;
+		std::unique_lock<std::mutex> lock(this->jobLock);
+		this->workDone.wait(lock, [&job]{return job->done;});
 	}
+	this->inFlight.pop_front();
 
+	//Keep the workers busy while this segment is delivered
+	this->QueueSegments();
+
+	if(!job->error.empty())
+		throw std::runtime_error(job->error);
 	if(this->output != NULL)
-		stopProcessing |= this->output->StoreRelation(objectId, this->tmpMetaData, this->tmpTagsBuff, 
-			this->tmpRefTypeStrBuff, this->tmpRefsBuff, this->tmpRefRolesBuff);
+		stopProcessing |= job->events.Replay(*this->output);
+	return !stopProcessing && !job->halted;
+}
 
+void O5mDecodeParallel::DecodeFinish()
+{
+	this->StopWorkers();
+	O5mDecodeMapped::DecodeFinish();
 }
 
-void O5mDecode::DecodeFinish()
+void O5mDecodeParallel::SeekToSegment(uint64_t offset)
 {
-	if(finished)
-		throw runtime_error("Decode already finished");
-	if(this->output != nullptr)
-		this->output->Finish();
-	finished = true;
+	//Abandon segments queued from the old position. Workers still running hold their own reference.
+	{
+		std::lock_guard<std::mutex> lock(this->jobLock);
+		this->pending.clear();
+	}
+	this->inFlight.clear();
+	O5mDecodeMapped::SeekToSegment(offset);
+}
+
+bool O5mDecodeParallel::AtEnd() const
+{
+	return this->cursor >= this->end && this->inFlight.empty();
 }
 
 // ************** o5m encoder ****************
 O5mEncodeBase::O5mEncodeBase():	refTableLengthThreshold(250),
-	refTableMaxSize(15000),
-	runningRefOffset(0)
+	refTableMaxSize(15000)
 {
 	writtenHeader = false;
+	this->stringPairs.SetBufferSize(this->refTableMaxSize, this->refTableLengthThreshold);
 }
 
 O5mEncodeBase::~O5mEncodeBase()
@@ -514,31 +1256,52 @@ O5mEncodeBase::~O5mEncodeBase()
 
 void O5mEncodeBase::WriteStart(bool isDiff)
 {
-	this->stringPairs.SetBufferSize(this->refTableMaxSize);
 	this->write("\xff", 1);
 
-	this->write("\xe0", 1);
-	std::string headerData;
+	this->StartDataset();
 	if(isDiff)
-		headerData = "o5c2";
+		this->objBuff.append("o5c2");
 	else
-		headerData = "o5m2";
-	std::string len = EncodeVarint(headerData.size());
-	*this << len;
-	*this << headerData;
+		this->objBuff.append("o5m2");
+	this->FinishDataset(0xe0);
 
 	writtenHeader = true;
 	this->ResetDeltaCoding();
 }
 
+//Space reserved at the start of objBuff for a dataset code and length varint
+static const size_t O5M_DATASET_HEADER_SPACE = 11;
+
+void O5mEncodeBase::StartDataset()
+{
+	this->objBuff.resize(O5M_DATASET_HEADER_SPACE);
+}
+
+void O5mEncodeBase::FinishDataset(unsigned char code)
+{
+	//Place the code and length immediately before the content and write it all at once
+	uint64_t length = this->objBuff.size() - O5M_DATASET_HEADER_SPACE;
+	char header[O5M_DATASET_HEADER_SPACE];
+	size_t headerLen = 0;
+	header[headerLen++] = code;
+	while(length >= 0x80)
+	{
+		header[headerLen++] = (char)((length & 0x7f) | 0x80);
+		length >>= 7;
+	}
+	header[headerLen++] = (char)length;
+
+	size_t start = O5M_DATASET_HEADER_SPACE - headerLen;
+	memcpy(&this->objBuff[start], header, headerLen);
+	this->write(&this->objBuff[start], this->objBuff.size() - start);
+}
+
 void O5mEncodeBase::ResetDeltaCoding()
 {
 	this->lastObjId = 0;
 	this->lastTimeStamp = 0;
 	this->lastChangeSet = 0;
 	this->stringPairs.Clear();
-	this->stringPairsDict.clear();
-	this->runningRefOffset = 0;
 	this->lastLat = 0.0;
 	this->lastLon = 0.0;
 	this->lastRefNode = 0;
@@ -558,142 +1321,104 @@ bool O5mEncodeBase::StoreBounds(double x1, double y1, double x2, double y2)
 	if(!writtenHeader)
 		this->WriteStart(false);
 
+	this->StartDataset();
 	//south-western corner 
-	std::string bboxData;
-	bboxData.append(EncodeZigzag(round(x1 * 1e7))); //lon
-	bboxData.append(EncodeZigzag(round(y1 * 1e7))); //lat
+	AppendZigzag(round(x1 * 1e7), this->objBuff); //lon
+	AppendZigzag(round(y1 * 1e7), this->objBuff); //lat
 
 	//north-eastern corner
-	bboxData.append(EncodeZigzag(round(x2 * 1e7))); //lon
-	bboxData.append(EncodeZigzag(round(y2 * 1e7))); //lat
-	
-	this->write("\xdb", 1);
-	std::string len = EncodeVarint(bboxData.size());
-	*this << len;
-	*this << bboxData;
+	AppendZigzag(round(x2 * 1e7), this->objBuff); //lon
+	AppendZigzag(round(y2 * 1e7), this->objBuff); //lat
+	this->FinishDataset(0xdb);
 	return false;
 }
 
-void O5mEncodeBase::EncodeMetaData(const class MetaData &metaData, std::ostream &outStream)
+void O5mEncodeBase::EncodeMetaData(const class MetaData &metaData, std::string &out)
 {
 	//Decode author and time stamp
 	if(metaData.version != 0)
 	{
-		std::string verStr = EncodeVarint(metaData.version);
-		outStream << verStr;
+		AppendVarint(metaData.version, out);
 		int64_t deltaTime = metaData.timestamp - this->lastTimeStamp;
-		outStream << EncodeZigzag(deltaTime);
+		AppendZigzag(deltaTime, out);
 		this->lastTimeStamp = metaData.timestamp;
 		//print "timestamp", self.lastTimeStamp, deltaTime
 		if(metaData.timestamp != 0)
 		{
 			//print changeset
 			int64_t deltaChangeSet = metaData.changeset - this->lastChangeSet;
-			outStream << EncodeZigzag(deltaChangeSet);
+			AppendZigzag(deltaChangeSet, out);
 			this->lastChangeSet = metaData.changeset;
+			this->uidBuff.clear();
 			if (metaData.uid != 0)
-			{
-				std::string encUid = EncodeVarint(metaData.uid);
-				this->WriteStringPair(encUid, metaData.username, outStream);
-			}
-			else
-			{
-				this->WriteStringPair("", metaData.username, outStream);
-			}
+				AppendVarint(metaData.uid, this->uidBuff);
+			this->WriteStringPair(this->uidBuff, metaData.username, out);
 		}
 	}
 	else
 	{
-		outStream << EncodeVarint(0);
+		AppendVarint(0, out);
 	}
 }
 
-size_t O5mEncodeBase::FindStringPairsIndex(std::string needle, bool &indexFound)
+void O5mEncodeBase::WriteStringPair(const std::string &firstString, const std::string &secondString, 
+	std::string &out)
 {
-	map<std::string, int>::iterator it = this->stringPairsDict.find(needle);
-	if (it == this->stringPairsDict.end())
+	bool useTable = firstString.size() + secondString.size() <= this->refTableLengthThreshold;
+	if(useTable)
 	{
-		indexFound = false;
-		return 0;
-	}
-	indexFound = true;
-	return this->runningRefOffset - it->second;
-}
-
-void O5mEncodeBase::WriteStringPair(const std::string &firstString, const std::string &secondString, 
-	std::ostream &tmpStream)
-{
-	std::string encodedStrings = firstString;
-	encodedStrings.append("\x00",1);
-	encodedStrings.append(secondString);
-	encodedStrings.append("\x00",1);
-	if(firstString.size() + secondString.size() <= this->refTableLengthThreshold)
-	{
-		bool indexFound = false;
-		size_t existIndex = FindStringPairsIndex(encodedStrings, indexFound);
-		if(indexFound) {
-			tmpStream << EncodeVarint(existIndex);
+		uint64_t existIndex = this->stringPairs.Find(firstString.data(), firstString.size(), 
+			secondString.data(), secondString.size(), false);
+		if(existIndex != 0) {
+			AppendVarint(existIndex, out);
 			return;
 		}
 	}
 
-	tmpStream.write("\x00", 1);
-	tmpStream << encodedStrings;
-	if(firstString.size() + secondString.size() <= this->refTableLengthThreshold)
-		this->AddToRefTable(encodedStrings);
+	out.append("\x00", 1);
+	out.append(firstString);
+	out.append("\x00", 1);
+	out.append(secondString);
+	out.append("\x00", 1);
+	if(useTable)
+		this->stringPairs.Add(firstString.data(), firstString.size(), 
+			secondString.data(), secondString.size(), false);
 }
 
-void O5mEncodeBase::AddToRefTable(const std::string &encodedStrings)
+bool O5mEncodeBase::StoreNode(int64_t objId, const class MetaData &metaData, 
+		const TagMap &tags, double latIn, double lonIn)
 {
-	size_t refTableSize = this->stringPairs.Size();
-	assert(refTableSize == this->stringPairsDict.size());
-	size_t availableSpace = refTableMaxSize - refTableSize;
-
-	//Make sure it does not grow forever
-	if(availableSpace == 0)
-	{
-		const string &st = this->stringPairs.PopFront();
-		this->stringPairsDict.erase(st);
-	}
-
-	this->stringPairs.PushBack(encodedStrings);
-	this->stringPairsDict[encodedStrings] = this->runningRefOffset;
-	this->runningRefOffset ++;
+	return O5mEncodeBase::StoreNodeFixed(objId, metaData, tags, round(latIn * 1e7), round(lonIn * 1e7));
 }
 
-bool O5mEncodeBase::StoreNode(int64_t objId, const class MetaData &metaData, 
-		const TagMap &tags, double latIn, double lonIn)
+bool O5mEncodeBase::StoreNodeFixed(int64_t objId, const class MetaData &metaData, 
+		const TagMap &tags, int64_t lat, int64_t lon)
 {
 	if(!writtenHeader)
 		this->WriteStart(false);
 
-	this->write("\x10",1);
+	this->StartDataset();
+	std::string &out = this->objBuff;
 
 	//Object ID
-	std::stringstream tmpStream;
 	int64_t deltaId = objId - this->lastObjId;
-	tmpStream << EncodeZigzag(deltaId);
+	AppendZigzag(deltaId, out);
 	this->lastObjId = objId;
 
-	this->EncodeMetaData(metaData, tmpStream);
+	this->EncodeMetaData(metaData, out);
 
 	//Position
-	int64_t lon = round(lonIn * 1e7);
 	int64_t deltaLon = lon - this->lastLon;
-	tmpStream << EncodeZigzag(deltaLon);
+	AppendZigzag(deltaLon, out);
 	this->lastLon = lon;
-	int64_t lat = round(latIn * 1e7);
 	int64_t deltaLat = lat - this->lastLat;
-	tmpStream << EncodeZigzag(deltaLat);
+	AppendZigzag(deltaLat, out);
 	this->lastLat = lat;
 
 	for (TagMap::const_iterator it=tags.begin(); it != tags.end(); it++)
-		this->WriteStringPair(it->first, it->second, tmpStream);
+		this->WriteStringPair(it->first, it->second, out);
 
-	std::string binData = tmpStream.str();
-	std::string len = EncodeVarint(binData.size());
-	*this << len;
-	*this << binData;
+	this->FinishDataset(0x10);
 	return false;
 }
 
@@ -703,38 +1428,35 @@ bool O5mEncodeBase::StoreWay(int64_t objId, const class MetaData &metaData,
 	if(!writtenHeader)
 		this->WriteStart(false);
 
-	this->write("\x11", 1);
+	this->StartDataset();
+	std::string &out = this->objBuff;
 
 	//Object ID
-	std::stringstream tmpStream;
 	int64_t deltaId = objId - this->lastObjId;
-	tmpStream << EncodeZigzag(deltaId);
+	AppendZigzag(deltaId, out);
 	this->lastObjId = objId;
 
 	//Store meta data
-	this->EncodeMetaData(metaData, tmpStream);
+	this->EncodeMetaData(metaData, out);
 
 	//Store nodes
-	std::stringstream refStream;
+	this->refBuff.clear();
 	for(size_t i=0; i< refs.size(); i++)
 	{
 		int64_t ref = refs[i]; 
 		int64_t deltaRef = ref - this->lastRefNode;
-		refStream << EncodeZigzag(deltaRef);
+		AppendZigzag(deltaRef, this->refBuff);
 		this->lastRefNode = ref;
 	}
 
-	std::string encRefs = refStream.str();
-	tmpStream << EncodeVarint(encRefs.size());
-	tmpStream << encRefs;
+	AppendVarint(this->refBuff.size(), out);
+	out.append(this->refBuff);
 
 	//Write tags
 	for (TagMap::const_iterator it=tags.begin(); it != tags.end(); it++)
-		this->WriteStringPair(it->first, it->second, tmpStream);
+		this->WriteStringPair(it->first, it->second, out);
 
-	std::string binData = tmpStream.str();
-	*this << EncodeVarint(binData.size());
-	*this << binData;
+	this->FinishDataset(0x11);
 	return false;
 }
 	
@@ -747,77 +1469,75 @@ bool O5mEncodeBase::StoreRelation(int64_t objId, const class MetaData &metaData,
 	if(!writtenHeader)
 		this->WriteStart(false);
 
-	this->write("\x12", 1);
+	this->StartDataset();
+	std::string &out = this->objBuff;
 
 	//Object ID
-	std::stringstream tmpStream;
 	int64_t deltaId = objId - this->lastObjId;
-	tmpStream << EncodeZigzag(deltaId);
+	AppendZigzag(deltaId, out);
 	this->lastObjId = objId;
 
 	//Store meta data
-	this->EncodeMetaData(metaData, tmpStream);
+	this->EncodeMetaData(metaData, out);
 
 	//Store referenced children
-	std::stringstream refStream;
+	this->refBuff.clear();
 	for(size_t i=0; i<refTypeStrs.size(); i++)
 	{
 		const std::string &typeStr = refTypeStrs[i];
 		int64_t refId = refIds[i];
 		const std::string &role = refRoles[i];
-		char typeCode[2] = "0";
+		char typeCode = '0';
 		int64_t deltaRef = 0;
 		if(typeStr == "node")
 		{
-			typeCode[0] = '0';
+			typeCode = '0';
 			deltaRef = refId - this->lastRefNode;
 			this->lastRefNode = refId;
 		}
 		if(typeStr == "way")
 		{
-			typeCode[0] = '1';
+			typeCode = '1';
 			deltaRef = refId - this->lastRefWay;
 			this->lastRefWay = refId;
 		}
 		if(typeStr == "relation")
 		{
-			typeCode[0] = '2';
+			typeCode = '2';
 			deltaRef = refId - this->lastRefRelation;
 			this->lastRefRelation = refId;
 		}
 
-		refStream << EncodeZigzag(deltaRef);
-
-		std::string typeCodeAndRole(typeCode);
-		typeCodeAndRole.append(role);
+		AppendZigzag(deltaRef, this->refBuff);
 
-		bool indexFound = false;
-		size_t refIndex = this->FindStringPairsIndex(typeCodeAndRole, indexFound);
-		if(indexFound)
+		//Type code and role are a single string in the reference table
+		bool useTable = 1 + role.size() <= this->refTableLengthThreshold;
+		uint64_t refIndex = 0;
+		if(useTable)
+			refIndex = this->stringPairs.Find(&typeCode, 1, role.data(), role.size(), true);
+		if(refIndex != 0)
 		{
-			refStream << EncodeVarint(refIndex);
+			AppendVarint(refIndex, this->refBuff);
 		}
 		else
 		{
-			refStream.write("\x00", 1); //String start byte
-			refStream << typeCodeAndRole;
-			refStream.write("\x00", 1); //String end byte
-			if(typeCodeAndRole.size() <= this->refTableLengthThreshold)
-				this->AddToRefTable(typeCodeAndRole);
+			this->refBuff.append("\x00", 1); //String start byte
+			this->refBuff.append(1, typeCode);
+			this->refBuff.append(role);
+			this->refBuff.append("\x00", 1); //String end byte
+			if(useTable)
+				this->stringPairs.Add(&typeCode, 1, role.data(), role.size(), true);
 		}
 	}
 	
-	std::string encRefs = refStream.str();
-	tmpStream << EncodeVarint(encRefs.size());
-	tmpStream << encRefs;
+	AppendVarint(this->refBuff.size(), out);
+	out.append(this->refBuff);
 
 	//Write tags
 	for (TagMap::const_iterator it=tags.begin(); it != tags.end(); it++)
-		this->WriteStringPair(it->first, it->second, tmpStream);
+		this->WriteStringPair(it->first, it->second, out);
 
-	std::string binData = tmpStream.str();
-	*this << EncodeVarint(binData.size());
-	*this << binData;
+	this->FinishDataset(0x12);
 	return false;
 }
 
@@ -868,6 +1588,283 @@ O5mEncode::~O5mEncode()
 
 }
 
+// **** Parallel o5m encoder
+
+///A chunk of objects, encoded to o5m by a worker thread
+class O5mEncodeJob
+{
+public:
+	class OsmEventBuffer events;
+	std::string encoded;
+	bool done;
+	std::string error;
+
+	O5mEncodeJob() : done(false) {};
+};
+
+///Encoder state owned by a single worker thread, which writes to a string
+class O5mStringEncode : public O5mEncodeBase
+{
+protected:
+	virtual void write (const char* s, std::streamsize n)
+	{
+		this->out->append(s, n);
+	}
+
+	virtual void operator<< (const std::string &val)
+	{
+		this->out->append(val);
+	}
+
+public:
+	std::string *out;
+
+	O5mStringEncode() : O5mEncodeBase()
+	{
+		writtenHeader = true; //The header is written by O5mEncodeParallel
+		out = nullptr;
+	};
+	virtual ~O5mStringEncode() {};
+
+	void EncodeChunk(class O5mEncodeJob &job)
+	{
+		this->out = &job.encoded;
+		this->Reset();
+		job.events.Replay(*this);
+		this->out = nullptr;
+	}
+};
+
+O5mEncodeParallel::O5mEncodeParallel(std::streambuf &handle, unsigned numThreads) : 
+	O5mEncode(handle),
+	fillingObjects(0),
+	stopWorkers(false),
+	workersStarted(false),
+	numThreads(numThreads),
+	chunkObjects(32768),
+	reorderWindow(0)
+{
+
+}
+
+O5mEncodeParallel::~O5mEncodeParallel()
+{
+	//Write out anything buffered, but the caller is responsible for calling Finish
+	try
+	{
+		if(this->filling)
+			this->SubmitChunk();
+		while(!this->inFlight.empty())
+			this->WriteOldestChunk();
+	}
+	catch(std::exception &err)
+	{
+		cerr << err.what() << endl;
+	}
+	this->StopWorkers();
+}
+
+void O5mEncodeParallel::StartWorkers()
+{
+	this->workersStarted = true;
+	unsigned threadCount = this->numThreads;
+	if(threadCount == 0)
+		threadCount = std::thread::hardware_concurrency();
+	if(threadCount == 0)
+		threadCount = 2;
+	if(this->reorderWindow == 0)
+		this->reorderWindow = threadCount * 2;
+	if(threadCount < 2)
+		return;
+
+	for(unsigned i=0; i<threadCount; i++)
+		this->workers.push_back(std::thread(&O5mEncodeParallel::WorkerLoop, this));
+}
+
+void O5mEncodeParallel::StopWorkers()
+{
+	{
+		std::lock_guard<std::mutex> lock(this->jobLock);
+		this->stopWorkers = true;
+	}
+	this->workAvailable.notify_all();
+	for(size_t i=0; i<this->workers.size(); i++)
+		this->workers[i].join();
+	this->workers.clear();
+}
+
+void O5mEncodeParallel::WorkerLoop()
+{
+	class O5mStringEncode enc;
+	while(true)
+	{
+		std::shared_ptr<class O5mEncodeJob> job;
+		{
+			std::unique_lock<std::mutex> lock(this->jobLock);
+			this->workAvailable.wait(lock, [this]{return this->stopWorkers || !this->pending.empty();});
+			if(this->stopWorkers)
+				return;
+			job = this->pending.front();
+			this->pending.pop_front();
+		}
+
+		try
+		{
+			enc.EncodeChunk(*job);
+		}
+		catch(std::exception &err)
+		{
+			job->error = err.what();
+		}
+		job->events.Clear();
+
+		{
+			std::lock_guard<std::mutex> lock(this->jobLock);
+			job->done = true;
+		}
+		this->workDone.notify_all();
+	}
+}
+
+class IDataStreamHandler &O5mEncodeParallel::Target()
+{
+	//Objects go to the chunk being filled, or straight to the output with a single thread
+	if(!this->workersStarted)
+		this->StartWorkers();
+	if(!writtenHeader)
+		this->WriteStart(false);
+	if(this->workers.empty())
+		return *static_cast<O5mEncode *>(this);
+	if(!this->filling)
+	{
+		this->filling = make_shared<class O5mEncodeJob>();
+		this->fillingObjects = 0;
+	}
+	return this->filling->events;
+}
+
+void O5mEncodeParallel::ObjectAdded()
+{
+	if(!this->filling)
+		return;
+	this->fillingObjects ++;
+	if(this->fillingObjects >= this->chunkObjects)
+		this->SubmitChunk();
+}
+
+void O5mEncodeParallel::SubmitChunk()
+{
+	while(this->inFlight.size() >= this->reorderWindow)
+		this->WriteOldestChunk();
+
+	std::shared_ptr<class O5mEncodeJob> job = this->filling;
+	this->filling.reset();
+	this->inFlight.push_back(job);
+	{
+		std::lock_guard<std::mutex> lock(this->jobLock);
+		this->pending.push_back(job);
+	}
+	this->workAvailable.notify_one();
+}
+
+void O5mEncodeParallel::WriteOldestChunk()
+{
+	std::shared_ptr<class O5mEncodeJob> job = this->inFlight.front();
+	{
+		std::unique_lock<std::mutex> lock(this->jobLock);
+		this->workDone.wait(lock, [&job]{return job->done;});
+	}
+	this->inFlight.pop_front();
+
+	if(!job->error.empty())
+		throw std::runtime_error(job->error);
+	this->write(job->encoded.data(), job->encoded.size());
+}
+
+bool O5mEncodeParallel::Sync()
+{
+	class IDataStreamHandler &target = this->Target();
+	if(&target == this)
+		return O5mEncode::Sync();
+	return target.Sync();
+}
+
+bool O5mEncodeParallel::Reset()
+{
+	//Every chunk already starts with a reset, so end the current chunk instead
+	class IDataStreamHandler &target = this->Target();
+	if(&target == this)
+		return O5mEncode::Reset();
+	this->SubmitChunk();
+	return false;
+}
+
+bool O5mEncodeParallel::Finish()
+{
+	if(!this->workersStarted)
+		this->StartWorkers();
+	if(this->filling)
+		this->SubmitChunk();
+	while(!this->inFlight.empty())
+		this->WriteOldestChunk();
+	return O5mEncode::Finish();
+}
+
+bool O5mEncodeParallel::StoreBounds(double x1, double y1, double x2, double y2)
+{
+	class IDataStreamHandler &target = this->Target();
+	if(&target == this)
+		return O5mEncode::StoreBounds(x1, y1, x2, y2);
+	return target.StoreBounds(x1, y1, x2, y2);
+}
+
+bool O5mEncodeParallel::StoreNode(int64_t objId, const class MetaData &metaData, 
+	const TagMap &tags, double lat, double lon)
+{
+	class IDataStreamHandler &target = this->Target();
+	if(&target == this)
+		return O5mEncode::StoreNode(objId, metaData, tags, lat, lon);
+	target.StoreNode(objId, metaData, tags, lat, lon);
+	this->ObjectAdded();
+	return false;
+}
+
+bool O5mEncodeParallel::StoreNodeFixed(int64_t objId, const class MetaData &metaData, 
+	const TagMap &tags, int64_t lat, int64_t lon)
+{
+	class IDataStreamHandler &target = this->Target();
+	if(&target == this)
+		return O5mEncode::StoreNodeFixed(objId, metaData, tags, lat, lon);
+	target.StoreNodeFixed(objId, metaData, tags, lat, lon);
+	this->ObjectAdded();
+	return false;
+}
+
+bool O5mEncodeParallel::StoreWay(int64_t objId, const class MetaData &metaData, 
+	const TagMap &tags, const std::vector<int64_t> &refs)
+{
+	class IDataStreamHandler &target = this->Target();
+	if(&target == this)
+		return O5mEncode::StoreWay(objId, metaData, tags, refs);
+	target.StoreWay(objId, metaData, tags, refs);
+	this->ObjectAdded();
+	return false;
+}
+
+bool O5mEncodeParallel::StoreRelation(int64_t objId, const class MetaData &metaData, const TagMap &tags, 
+	const std::vector<std::string> &refTypeStrs, const std::vector<int64_t> &refIds, 
+	const std::vector<std::string> &refRoles)
+{
+	if(refTypeStrs.size() != refIds.size() || refTypeStrs.size() != refRoles.size())
+		throw std::invalid_argument("Length of ref vectors must be equal");
+	class IDataStreamHandler &target = this->Target();
+	if(&target == this)
+		return O5mEncode::StoreRelation(objId, metaData, tags, refTypeStrs, refIds, refRoles);
+	target.StoreRelation(objId, metaData, tags, refTypeStrs, refIds, refRoles);
+	this->ObjectAdded();
+	return false;
+}
+
 #ifdef PYTHON_AWARE
 PyO5mEncode::PyO5mEncode(PyObject* obj): O5mEncodeBase()
 {
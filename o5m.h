@@ -5,10 +5,14 @@
 #include <string>
 #include <stdint.h>
 #include <vector>
-#include "fixeddeque.h"
+#include "stringring.h"
 #include <map>
 #include <iostream>
 #include <memory>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #ifdef PYTHON_AWARE
 #include <Python.h>
 #endif
@@ -17,17 +21,35 @@
 void TestDecodeNumber();
 void TestEncodeNumber();
 
-///Decodes a binary o5m stream and fires a series of events to the output object derived from IDataStreamHandler
-class O5mDecode : public OsmDecoder
+///Location of an o5m reset segment, where decoding can start with fresh delta state
+class O5mIndexEntry
 {
-protected:
-	std::istream handle;
+public:
+	uint64_t offset; //Byte offset of the first dataset after the reset
+	unsigned char objType; //Object dataset code (0x10 node, 0x11 way, 0x12 relation) or 0 if mixed
+	int64_t firstId, lastId;
+	uint64_t objCount;
 
+	O5mIndexEntry();
+};
+
+void SaveO5mIndex(const std::vector<class O5mIndexEntry> &index, uint64_t dataSize, std::streambuf &out);
+///Returns the size of the o5m data the index was built from
+uint64_t LoadO5mIndex(std::streambuf &in, std::vector<class O5mIndexEntry> &index);
+///Find the segment of the given type that would contain objId, or the first segment of that type
+///if objId is before all of them. Returns -1 if there are no segments of that type.
+int64_t FindO5mSegment(const std::vector<class O5mIndexEntry> &index, unsigned char objType, int64_t objId);
+int64_t FindO5mSegment(const std::vector<class O5mIndexEntry> &index, unsigned char objType);
+
+///Common o5m decoding state. Datasets are parsed from in memory buffers and fire a series of
+///events to the output object derived from IDataStreamHandler
+class O5mDecodeBase : public OsmDecoder
+{
+protected:
 	int64_t lastObjId;
 	int64_t lastTimeStamp;
 	int64_t lastChangeSet;
-	FixedDeque<std::string> stringPairs;
-	std::map<std::string, int> stringPairsDict;  
+	StringPairRing stringPairs;
 	double lastLat;
 	double lastLon;
 	int64_t lastRefNode;
@@ -39,22 +61,62 @@ protected:
 	unsigned refTableMaxSize;
 
 	//Various buffers to avoid continuously reallocating memory
-	std::string tmpBuff;
 	class MetaData tmpMetaData;
-	std::string combinedRawTmpBuff;
 	std::vector<int64_t> tmpRefsBuff;
 	TagMap tmpTagsBuff;
 	std::vector<std::string> tmpRefRolesBuff, tmpRefTypeStrBuff;
+	std::string tmpFirstStr, tmpSecondStr, tmpUidStr, tmpTypeAndRole;
+
+	//Objects excluded by decodeMask are deferred. If a wanted object follows before the next
+	//reset, they are skipped over to bring the delta and string table state up to date.
+	const uint8_t *datasetStart, *skippedStart;
+	std::string skippedBuff;
 
-	void DecodeBoundingBox();
-	void DecodeSingleString(std::istream &stream, std::string &out);
+	bool WantDataset(unsigned char code) const;
+	void CatchUpSkipped();
+	void ApplySkipped(const uint8_t *cursor, const uint8_t *end);
+	const uint8_t *SkipString(const uint8_t *cursor, const uint8_t *end);
+	const uint8_t *SkipStringPair(const uint8_t *cursor, const uint8_t *end);
+	const uint8_t *SkipMetaData(const uint8_t *cursor, const uint8_t *end);
+	///Update the decoder state for an object, without building it or passing it to the output
+	void SkipObject(unsigned char code, const uint8_t *cursor, const uint8_t *end);
+	void CheckStart(const uint8_t *cursor, const uint8_t *end);
+	bool DecodeDataset(unsigned char code, const uint8_t *cursor, const uint8_t *end);
+	bool DecodeSingleByteCode(unsigned char code);
+	const uint8_t *DecodeBuffered(const uint8_t *cursor, const uint8_t *end, bool &ok);
+	void DecodeHeaderDataset(const uint8_t *cursor, const uint8_t *end);
+	void DecodeBoundingBox(const uint8_t *cursor, const uint8_t *end);
+	const uint8_t *DecodeSingleString(const uint8_t *cursor, const uint8_t *end, std::string &out);
 	void ConsiderAddToStringRefTable(const std::string &firstStr, const std::string &secondStr);
-	void AddBuffToStringRefTable(const std::string &buff);
-	void DecodeMetaData(std::istream &nodeDataStream, class MetaData &out);
-	bool ReadStringPair(std::istream &stream, std::string &firstStr, std::string &secondStr);
-	void DecodeNode();
-	void DecodeWay();
-	void DecodeRelation();
+	void CheckStringRef(uint64_t ref);
+	const uint8_t *DecodeMetaData(const uint8_t *cursor, const uint8_t *end, class MetaData &out);
+	const uint8_t *ReadStringPair(const uint8_t *cursor, const uint8_t *end, std::string &firstStr, std::string &secondStr);
+	void DecodeTags(const uint8_t *cursor, const uint8_t *end);
+	void DecodeNode(const uint8_t *cursor, const uint8_t *end);
+	void DecodeWay(const uint8_t *cursor, const uint8_t *end);
+	void DecodeRelation(const uint8_t *cursor, const uint8_t *end);
+
+public:
+	O5mDecodeBase();
+	virtual ~O5mDecodeBase();
+
+	virtual void ResetDeltaCoding();
+	void DecodeFinish();
+};
+
+///Decodes a binary o5m stream and fires a series of events to the output object derived from IDataStreamHandler
+class O5mDecode : public O5mDecodeBase
+{
+protected:
+	std::istream handle;
+	std::string tmpBuff;
+	//On a seekable stream, skipped objects are not copied. The first is found again by its
+	//payload offset, code and length, followed by skippedItems more codes and datasets.
+	int64_t skippedOffset;
+	unsigned char skippedCode;
+	uint64_t skippedLength, skippedItems;
+
+	void CatchUpSeekable();
 
 public:
 	O5mDecode(std::streambuf &handleIn);
@@ -63,7 +125,76 @@ public:
 	void ResetDeltaCoding();
 	bool DecodeNext();
 	void DecodeHeader();
+	///Continue decoding at a segment offset from O5mIndexEntry. The stream must be seekable.
+	void SeekToSegment(uint64_t offset);
+};
+
+///Decodes o5m data held in memory, either a memory mapped file or a buffer owned by
+///the caller. Objects are parsed in place without copying.
+class O5mDecodeMapped : public O5mDecodeBase
+{
+protected:
+	const uint8_t *data, *cursor, *end;
+	void *mapping;
+	size_t mappingSize;
+
+public:
+	///Memory maps a file for reading
+	O5mDecodeMapped(const std::string &filename);
+	///Decodes from a buffer which must outlive the decoder. Paging advice is left to the caller.
+	O5mDecodeMapped(const uint8_t *buff, size_t len);
+	virtual ~O5mDecodeMapped();
+
+	bool DecodeNext();
+	void DecodeHeader();
+	virtual bool AtEnd() const {return cursor >= end;};
+	size_t DataSize() const {return end - data;};
+
+	///Continue decoding at a segment offset from O5mIndexEntry
+	virtual void SeekToSegment(uint64_t offset);
+	///Scan the data following the current position for reset segments, without decoding objects
+	void BuildIndex(std::vector<class O5mIndexEntry> &out) const;
+};
+
+///Decodes o5m data held in memory using a pool of worker threads. Each 0xff reset clears all
+///delta and string table state, so the data is split into segments at resets and the segments
+///are decoded concurrently. Events are delivered to the output in the original order by the
+///thread calling DecodeNext. Segments larger than maxSegmentSize, such as data without resets,
+///are decoded by the calling thread without buffering.
+class O5mDecodeParallel : public O5mDecodeMapped
+{
+protected:
+	std::vector<std::thread> workers;
+	std::deque<std::shared_ptr<class O5mSegmentJob> > pending; //Not yet started, in stream order
+	std::deque<std::shared_ptr<class O5mSegmentJob> > inFlight; //Not yet delivered, in stream order
+	std::mutex jobLock;
+	std::condition_variable workAvailable, workDone;
+	bool stopWorkers, workersStarted;
+
+	void StartWorkers();
+	void StopWorkers();
+	void WorkerLoop();
+	const uint8_t *ScanSegment(const uint8_t *start);
+	void QueueSegments();
+
+public:
+	O5mDecodeParallel(const std::string &filename, unsigned numThreads = 0);
+	O5mDecodeParallel(const uint8_t *buff, size_t len, unsigned numThreads = 0);
+	virtual ~O5mDecodeParallel();
+
+	bool DecodeNext();
 	void DecodeFinish();
+	bool AtEnd() const;
+	void SeekToSegment(uint64_t offset);
+
+	///Worker threads to use, zero for the number of hardware threads. Set before decoding starts.
+	unsigned numThreads;
+	///Maximum segments decoded ahead of the one being delivered, which bounds memory use
+	size_t reorderWindow;
+	///Resets closer together than this many bytes are combined into one segment
+	size_t minSegmentSize;
+	///Largest segment in bytes given to a worker, which bounds the events buffered per segment
+	size_t maxSegmentSize;
 };
 
 ///Encodes a stream of map objects into an o5m output binary stream
@@ -74,8 +205,7 @@ protected:
 	int64_t lastObjId;
 	int64_t lastTimeStamp;
 	int64_t lastChangeSet;
-	FixedDeque<std::string> stringPairs;
-	std::map<std::string, int> stringPairsDict; 
+	IndexedStringPairRing stringPairs;
 	double lastLat;
 	double lastLon;
 	int64_t lastRefNode;
@@ -84,15 +214,18 @@ protected:
 
 	unsigned refTableLengthThreshold;
 	unsigned refTableMaxSize;
-	int64_t runningRefOffset;
 	bool writtenHeader;
 
+	//Reusable buffers. Objects are built in objBuff after space reserved for the dataset
+	//code and length, so each object is emitted with a single write.
+	std::string objBuff, refBuff, uidBuff;
+
 	void WriteStart(bool isDiff);
-	void EncodeMetaData(const class MetaData &metaData, std::ostream &outStream);
+	void StartDataset();
+	void FinishDataset(unsigned char code);
+	void EncodeMetaData(const class MetaData &metaData, std::string &out);
 	void WriteStringPair(const std::string &firstString, const std::string &secondString, 
-			std::ostream &tmpStream);
-	void AddToRefTable(const std::string &encodedStrings);
-	size_t FindStringPairsIndex(std::string needle, bool &indexFound);
+			std::string &out);
 
 	virtual void write (const char* s, std::streamsize n);
 	virtual void operator<< (const std::string &val);
@@ -111,6 +244,8 @@ public:
 	bool StoreBounds(double x1, double y1, double x2, double y2);
 	bool StoreNode(int64_t objId, const class MetaData &metaData, 
 		const TagMap &tags, double lat, double lon);
+	bool StoreNodeFixed(int64_t objId, const class MetaData &metaData, 
+		const TagMap &tags, int64_t lat, int64_t lon);
 	bool StoreWay(int64_t objId, const class MetaData &metaData, 
 		const TagMap &tags, const std::vector<int64_t> &refs);
 	bool StoreRelation(int64_t objId, const class MetaData &metaData, const TagMap &tags, 
@@ -140,6 +275,57 @@ public:
 	virtual ~O5mEncode();
 };
 
+///Encodes o5m using a pool of worker threads. Incoming objects are collected into chunks and
+///each chunk is encoded independently, starting with a 0xff reset so it has fresh delta and
+///string table state. Chunks are written in their original order. The resets also allow the
+///output to be decoded in parallel by O5mDecodeParallel.
+class O5mEncodeParallel : public O5mEncode
+{
+protected:
+	std::shared_ptr<class O5mEncodeJob> filling;
+	size_t fillingObjects;
+	std::vector<std::thread> workers;
+	std::deque<std::shared_ptr<class O5mEncodeJob> > pending; //Not yet started, in stream order
+	std::deque<std::shared_ptr<class O5mEncodeJob> > inFlight; //Not yet written, in stream order
+	std::mutex jobLock;
+	std::condition_variable workAvailable, workDone;
+	bool stopWorkers, workersStarted;
+
+	void StartWorkers();
+	void StopWorkers();
+	void WorkerLoop();
+	class IDataStreamHandler &Target();
+	void ObjectAdded();
+	void SubmitChunk();
+	void WriteOldestChunk();
+
+public:
+	O5mEncodeParallel(std::streambuf &handle, unsigned numThreads = 0);
+	virtual ~O5mEncodeParallel();
+
+	bool Sync();
+	bool Reset();
+	bool Finish();
+
+	bool StoreBounds(double x1, double y1, double x2, double y2);
+	bool StoreNode(int64_t objId, const class MetaData &metaData, 
+		const TagMap &tags, double lat, double lon);
+	bool StoreNodeFixed(int64_t objId, const class MetaData &metaData, 
+		const TagMap &tags, int64_t lat, int64_t lon);
+	bool StoreWay(int64_t objId, const class MetaData &metaData, 
+		const TagMap &tags, const std::vector<int64_t> &refs);
+	bool StoreRelation(int64_t objId, const class MetaData &metaData, const TagMap &tags, 
+		const std::vector<std::string> &refTypeStrs, const std::vector<int64_t> &refIds, 
+		const std::vector<std::string> &refRoles);
+
+	///Worker threads to use, zero for the number of hardware threads. Set before encoding starts.
+	unsigned numThreads;
+	///Objects per independently encoded chunk
+	size_t chunkObjects;
+	///Maximum chunks queued or encoded ahead of the one being written, which bounds memory use
+	size_t reorderWindow;
+};
+
 #ifdef PYTHON_AWARE
 class PyO5mEncode : public O5mEncodeBase
 {
@@ -41,6 +41,8 @@ int main(int argc, char* argv[])
 	bool formatInOsm = false, formatInO5m = false, formatInPbf = false;
 	bool formatOutOsm = false, formatOutO5m = false, formatOutPbf = false;
 	bool formatOutNull = false, sort = false;
+	unsigned threads = 1;
+	string pbfCompression = "zlib";
 	po::options_description desc("Convert between osm, o5m, pbf file formats");
 	desc.add_options()
 		("help",																 "show help message")
@@ -54,6 +56,8 @@ int main(int argc, char* argv[])
 		("out-pbf", po::bool_switch(&formatOutPbf),			   "output file format is pbf")
 		("out-null", po::bool_switch(&formatOutNull),		   "do not write output")
 		("sort", po::bool_switch(&sort),		   "sort output by ID (memory intensive)")
+		("threads", po::value< unsigned >(&threads),		   "threads for o5m and pbf input and output (0 for all cores)")
+		("pbf-compression", po::value< string >(&pbfCompression),	   "pbf output blob compression: zlib, lzma or none")
 	;
 	po::positional_options_description p;
 	p.add("input", -1);
@@ -98,9 +102,30 @@ int main(int argc, char* argv[])
 	if(formatOutNull)
 		enc.reset(new class IDataStreamHandler());
 	else if(formatOutO5m or (filePart > -1 and outFilenameSplit[filePart] == "o5m"))
-		enc.reset(new class O5mEncode(*outbuff));
+	{
+		if(threads != 1)
+			enc.reset(new class O5mEncodeParallel(*outbuff, threads));
+		else
+			enc.reset(new class O5mEncode(*outbuff));
+	}
 	else if(formatOutPbf or (filePart > -1 and outFilenameSplit[filePart] == "pbf"))
-		enc.reset(new class PbfEncode(*outbuff));
+	{
+		shared_ptr<class PbfEncode> pbfEnc;
+		if(threads != 1)
+			pbfEnc.reset(new class PbfEncodeParallel(*outbuff, threads));
+		else
+			pbfEnc.reset(new class PbfEncode(*outbuff));
+		if(pbfCompression == "lzma")
+			pbfEnc->compressUsingLzma = true;
+		else if(pbfCompression == "none")
+			pbfEnc->compressUsingZLib = false;
+		else if(pbfCompression != "zlib")
+		{
+			cerr << "Unknown pbf compression " << pbfCompression << endl;
+			return -1;
+		}
+		enc = pbfEnc;
+	}
 	else if (formatOutOsm or (filePart > -1 and outFilenameSplit[filePart] == "osm") or consoleMode)
 		enc.reset(new class OsmXmlEncode(*outbuff, customAttribs));
 	else
@@ -114,6 +139,8 @@ int main(int argc, char* argv[])
 	std::streambuf *inbuff = nullptr;
 	string inFormat = "";
 	std::shared_ptr<class OsmDecoder> inDecoder;
+	std::shared_ptr<class O5mDecodeMapped> mappedDecoder;
+	std::shared_ptr<class PbfDecodeParallel> pbfParallelDecoder;
 	if(inputFiles[0] != "-")
 	{
 		std::filebuf *infb = new std::filebuf;
@@ -130,7 +157,13 @@ int main(int argc, char* argv[])
 		if(formatInO5m or inFilenameSplit[filePart2] == "o5m")
 		{
 			inFormat = "o5m";
-			inDecoder = make_shared<O5mDecode>(*inbuff);
+			if(threads != 1)
+			{
+				mappedDecoder = make_shared<O5mDecodeParallel>(inputFiles[0], threads);
+				inDecoder = mappedDecoder;
+			}
+			else
+				inDecoder = make_shared<O5mDecode>(*inbuff);
 		}
 		else if (formatInOsm or inFilenameSplit[filePart2] == "osm")
 		{
@@ -140,7 +173,13 @@ int main(int argc, char* argv[])
 		else if (formatInPbf or inFilenameSplit[filePart2] == "pbf")
 		{
 			inFormat = "pbf";
-			inDecoder = make_shared<PbfDecode>(*inbuff);
+			if(threads != 1)
+			{
+				pbfParallelDecoder = make_shared<PbfDecodeParallel>(*inbuff, threads);
+				inDecoder = pbfParallelDecoder;
+			}
+			else
+				inDecoder = make_shared<PbfDecode>(*inbuff);
 		}
 		else
 			throw runtime_error("Input file extension not supported");
@@ -172,7 +211,12 @@ int main(int argc, char* argv[])
 		throw runtime_error("Input file extension not specified/supported");
 
 	//Run decoder
-	LoadFromDecoder(*inbuff, inDecoder.get(), enc.get());
+	if(mappedDecoder)
+		LoadFromMappedDecoder(*mappedDecoder, enc.get());
+	else if(pbfParallelDecoder)
+		LoadFromPbfParallelDecoder(*pbfParallelDecoder, enc.get());
+	else
+		LoadFromDecoder(*inbuff, inDecoder.get(), enc.get());
 
 	//Tidy up. It is a good idea to delete the pipeline in order.
 	if(!consoleInput)
@@ -181,6 +225,7 @@ int main(int argc, char* argv[])
 		inbuff = nullptr;
 	}
 	inDecoder.reset();
+	mappedDecoder.reset();
 	enc.reset();
 	if(!consoleMode)
 	{
@@ -1,4 +1,5 @@
 #include "osmxml.h"
+#include "numparse.h"
 #include <sstream>
 #include <ctime>
 #include <assert.h>
@@ -18,6 +19,79 @@ static std::string LimitMessage(const std::string &name, size_t limit, size_t ac
 	return ss.str();
 }
 
+static std::string InvalidAttributeMessage(const char *name, const char *value)
+{
+	return std::string("Invalid value for attribute ") + name + ": " + value;
+}
+
+///Decimal degrees are read in units of 1e-12 degrees, which is exact in a double for any
+///coordinate. Dividing by a power of ten is exactly rounded, so out is the nearest double to
+///the text. If the text has no more than 7 decimal places, fixed is set to the value in units
+///of 1e-7 degrees and exact is set. An empty value is zero, as it is when missing.
+static bool ParseCoordinate(const char *str, double &out, int64_t &fixed, bool &exact)
+{
+	if(*str == '\0')
+	{
+		out = 0.0;
+		fixed = 0;
+		exact = true;
+		return true;
+	}
+
+	int64_t pico = 0;
+	if(ParseFixedPoint(str, 12, pico))
+	{
+		out = pico / 1e12;
+		fixed = pico / 100000;
+		exact = pico % 100000 == 0;
+		return true;
+	}
+
+	//Exponents and very long values are rare, so leave them to the C library
+	char *end = nullptr;
+	double val = strtod(str, &end);
+	if(end == str || *end != '\0')
+		return false;
+	out = val;
+	fixed = 0;
+	exact = false;
+	return true;
+}
+
+static bool ParseCoordinate(const char *str, double &out)
+{
+	int64_t fixed = 0;
+	bool exact = false;
+	return ParseCoordinate(str, out, fixed, exact);
+}
+
+static int ParseDigits(const char *str, int count)
+{
+	int val = 0;
+	for(int i=0; i<count; i++)
+		val = val * 10 + (str[i] - '0');
+	return val;
+}
+
+static int DaysInMonth(int year, int month)
+{
+	static const int days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+	if(month == 2 && year % 4 == 0 && (year % 100 != 0 || year % 400 == 0))
+		return 29;
+	return days[month-1];
+}
+
+///Days from 1970-01-01 to a date in the proleptic Gregorian calendar
+static int64_t DaysFromCivil(int64_t year, int month, int day)
+{
+	year -= month <= 2;
+	int64_t era = (year >= 0 ? year : year - 399) / 400;
+	int64_t yearOfEra = year - era * 400;
+	int64_t dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+	int64_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+	return era * 146097 + dayOfEra - 719468;
+}
+
 OsmXmlLimits::OsmXmlLimits()
 {
 	maxBytes = 0;
@@ -95,16 +169,6 @@ std::string escapexml(const std::string& src) {
 	return dst.str();
 }
 
-void XmlAttsToMap(const XML_Char **atts, std::map<std::string, std::string> &attribs)
-{
-	size_t i=0;
-	while(atts[i] != NULL)
-	{
-		attribs[atts[i]] = atts[i+1];
-		i += 2;
-	}
-}
-
 static void StartElement(void *userData, const XML_Char *name, const XML_Char **atts)
 {
 	((class OsmXmlDecodeString *)userData)->StartElement(name, atts);
@@ -130,6 +194,15 @@ static void EndChangeElement(void *userData, const XML_Char *name)
 OsmXmlDecodeString::OsmXmlDecodeString() : OsmDecoder()
 {
 	xmlDepth = 0;
+	currentObjectType = XmlNoElement;
+	lastObjectType = XmlNoElement;
+	objId = 0;
+	objLat = 0.0; objLon = 0.0;
+	objLatFixed = 0; objLonFixed = 0;
+	objPosFixed = true;
+	minLat = 0.0; minLon = 0.0; maxLat = 0.0; maxLon = 0.0;
+	memset(cachedDate, 0x00, sizeof(cachedDate));
+	cachedDateStart = 0;
 	parseCompleted = false;
 	parseCompletedOk = false;
 	parser = XML_ParserCreate(NULL);
@@ -165,10 +238,11 @@ bool OsmXmlDecodeString::FailLimit(const std::string &message)
 	return false;
 }
 
-bool OsmXmlDecodeString::CheckLimit(size_t value, size_t limit, const std::string &message)
+bool OsmXmlDecodeString::CheckLimit(size_t value, size_t limit, const char *name)
 {
+	//The message is only built if the limit is exceeded, as this is checked for every element
 	if(limit > 0 && value > limit)
-		return FailLimit(message);
+		return FailLimit(LimitMessage(name, limit, value));
 	return true;
 }
 
@@ -182,11 +256,9 @@ bool OsmXmlDecodeString::CheckElementLimits(const XML_Char *name, const XML_Char
 		attributeBytes += strlen(atts[i]) + strlen(atts[i+1]);
 	}
 
-	if(!CheckLimit(attributeCount, limits.maxAttributesPerElement,
-		LimitMessage("PGMAP_XML_MAX_ATTRIBUTES_PER_ELEMENT", limits.maxAttributesPerElement, attributeCount)))
+	if(!CheckLimit(attributeCount, limits.maxAttributesPerElement, "PGMAP_XML_MAX_ATTRIBUTES_PER_ELEMENT"))
 		return false;
-	if(!CheckLimit(attributeBytes, limits.maxAttributeBytes,
-		LimitMessage("PGMAP_XML_MAX_ATTRIBUTE_BYTES", limits.maxAttributeBytes, attributeBytes)))
+	if(!CheckLimit(attributeBytes, limits.maxAttributeBytes, "PGMAP_XML_MAX_ATTRIBUTE_BYTES"))
 		return false;
 	return true;
 }
@@ -196,58 +268,99 @@ void OsmXmlDecodeString::StartElement(const XML_Char *name, const XML_Char **att
 	this->xmlDepth ++;
 	//cout << this->xmlDepth << " startel " << name << endl;
 
-	if(!CheckLimit(this->xmlDepth, limits.maxDepth,
-		LimitMessage("PGMAP_XML_MAX_DEPTH", limits.maxDepth, this->xmlDepth)))
+	if(!CheckLimit(this->xmlDepth, limits.maxDepth, "PGMAP_XML_MAX_DEPTH"))
 		return;
 	if(!CheckElementLimits(name, atts))
 		return;
 
-	std::map<std::string, std::string> attribs;
-	XmlAttsToMap(atts, attribs);
-
 	if(this->xmlDepth == 2)
 	{
-		this->currentObjectType = name;
-		this->metadataMap = attribs;
+		if(strcmp(name, "node") == 0)
+			this->currentObjectType = XmlNode;
+		else if(strcmp(name, "way") == 0)
+			this->currentObjectType = XmlWay;
+		else if(strcmp(name, "relation") == 0)
+			this->currentObjectType = XmlRelation;
+		else if(strcmp(name, "bounds") == 0)
+			this->currentObjectType = XmlBounds;
+		else
+			this->currentObjectType = XmlOtherElement;
+		if(!DecodeObjectAttributes(atts))
+			return;
 		tagCount = 0;
 		wayNodeCount = 0;
 		relationMemberCount = 0;
-		if(strcmp(name, "node") == 0 || strcmp(name, "way") == 0 || strcmp(name, "relation") == 0)
+		if(this->currentObjectType == XmlNode || this->currentObjectType == XmlWay || this->currentObjectType == XmlRelation)
 		{
 			objectCount++;
-			if(!CheckLimit(objectCount, limits.maxObjects,
-				LimitMessage("CHANGESETS_MAXIMUM_ELEMENTS", limits.maxObjects, objectCount)))
+			if(!CheckLimit(objectCount, limits.maxObjects, "CHANGESETS_MAXIMUM_ELEMENTS"))
 				return;
 		}
 	}
 
 	else if(this->xmlDepth == 3)
 	{
-		if(strcmp(name, "tag") == 0)
+		//Missing attributes are treated as empty strings, and a missing ref as zero
+		const XML_Char *k = "", *v = "", *ref = "", *type = "", *role = "";
+		int64_t refId = 0;
+		for(size_t i=0; atts[i] != NULL; i += 2)
+		{
+			const XML_Char *att = atts[i];
+			switch(att[0])
+			{
+			case 'k':
+				if(att[1] == '\0')
+					k = atts[i+1];
+				break;
+			case 'v':
+				if(att[1] == '\0')
+					v = atts[i+1];
+				break;
+			case 'r':
+				if(strcmp(att, "ref") == 0)
+					ref = atts[i+1];
+				else if(strcmp(att, "role") == 0)
+					role = atts[i+1];
+				break;
+			case 't':
+				if(strcmp(att, "type") == 0)
+					type = atts[i+1];
+				break;
+			}
+		}
+
+		if(name[0] == 't' && strcmp(name, "tag") == 0)
 		{
 			tagCount++;
-			if(!CheckLimit(tagCount, limits.maxTagsPerObject,
-				LimitMessage("PGMAP_XML_MAX_TAGS_PER_OBJECT", limits.maxTagsPerObject, tagCount)))
+			if(!CheckLimit(tagCount, limits.maxTagsPerObject, "PGMAP_XML_MAX_TAGS_PER_OBJECT"))
 				return;
-			this->tags[attribs["k"]] = attribs["v"];
+			this->tags[k] = v;
 		}
-		if(strcmp(name, "nd") == 0 && currentObjectType == "way")
+		else if(name[0] == 'n' && strcmp(name, "nd") == 0 && currentObjectType == XmlWay)
 		{
 			wayNodeCount++;
-			if(!CheckLimit(wayNodeCount, limits.maxWayNodesPerObject,
-				LimitMessage("WAYNODES_MAXIMUM", limits.maxWayNodesPerObject, wayNodeCount)))
+			if(!CheckLimit(wayNodeCount, limits.maxWayNodesPerObject, "WAYNODES_MAXIMUM"))
+				return;
+			if(ref[0] != '\0' && !ParseInt64(ref, refId))
+			{
+				FailLimit(InvalidAttributeMessage("ref", ref));
 				return;
-			this->memObjIds.push_back(atol(attribs["ref"].c_str()));
+			}
+			this->memObjIds.push_back(refId);
 		}
-		if(strcmp(name, "member") == 0 && currentObjectType == "relation")
+		else if(name[0] == 'm' && strcmp(name, "member") == 0 && currentObjectType == XmlRelation)
 		{
 			relationMemberCount++;
-			if(!CheckLimit(relationMemberCount, limits.maxRelationMembersPerObject,
-				LimitMessage("RELATION_MEMBERS_MAXIMUM", limits.maxRelationMembersPerObject, relationMemberCount)))
+			if(!CheckLimit(relationMemberCount, limits.maxRelationMembersPerObject, "RELATION_MEMBERS_MAXIMUM"))
 				return;
-			this->memObjIds.push_back(atol(attribs["ref"].c_str()));
-			this->memObjTypes.push_back(attribs["type"]);
-			this->memObjRoles.push_back(attribs["role"]);
+			if(ref[0] != '\0' && !ParseInt64(ref, refId))
+			{
+				FailLimit(InvalidAttributeMessage("ref", ref));
+				return;
+			}
+			this->memObjIds.push_back(refId);
+			this->memObjTypes.push_back(type);
+			this->memObjRoles.push_back(role);
 		}
 	}
 }
@@ -256,27 +369,12 @@ void OsmXmlDecodeString::EndElement(const XML_Char *name)
 {
 	//cout << this->xmlDepth << " endel " << name << endl;
 	
-	if(this->xmlDepth == 2)
+	if(this->xmlDepth == 2 && this->errString.empty())
 	{	
-		if(this->currentObjectType == "bounds")
+		if(this->currentObjectType == XmlBounds)
 		{
-			double minlat=0.0, minlon=0.0, maxlat=0.0, maxlon=0.0;
-
-			TagMap::iterator it = this->metadataMap.find("minlat");
-			if(it != this->metadataMap.end())
-				minlat = atof(it->second.c_str());
-			it = this->metadataMap.find("minlon");
-			if(it != this->metadataMap.end())
-				minlon = atof(it->second.c_str());
-			it = this->metadataMap.find("maxlat");
-			if(it != this->metadataMap.end())
-				maxlat = atof(it->second.c_str());
-			it = this->metadataMap.find("maxlon");
-			if(it != this->metadataMap.end())
-				maxlon = atof(it->second.c_str());
-
 			if(output != nullptr)
-				stopProcessing |= output->StoreBounds(minlon, minlat, maxlon, maxlat);
+				stopProcessing |= output->StoreBounds(minLon, minLat, maxLon, maxLat);
 		}
 		else
 		{
@@ -286,36 +384,25 @@ void OsmXmlDecodeString::EndElement(const XML_Char *name)
 				stopProcessing |= output->Reset();
 			}
 
-			int64_t objId = 0;
-			TagMap::iterator it = this->metadataMap.find("id");
-			if(it != this->metadataMap.end())
-				objId = atol(it->second.c_str());
-
-			class MetaData metaData;
-			DecodeMetaData(metaData);
-
-			if(this->currentObjectType == "node")
+			if(this->currentObjectType == XmlNode)
 			{
-				double lat = 0.0, lon = 0.0;
-				it = this->metadataMap.find("lat");
-				if(it != this->metadataMap.end())
-					lat = atof(it->second.c_str());
-				it = this->metadataMap.find("lon");
-				if(it != this->metadataMap.end())
-					lon = atof(it->second.c_str());
-
 				if(output != nullptr)
-					stopProcessing |= output->StoreNode(objId, metaData, this->tags, lat, lon);
+				{
+					if(objPosFixed)
+						stopProcessing |= output->StoreNodeFixed(objId, objMetaData, this->tags, objLatFixed, objLonFixed);
+					else
+						stopProcessing |= output->StoreNode(objId, objMetaData, this->tags, objLat, objLon);
+				}
 			}
-			else if(this->currentObjectType == "way")
+			else if(this->currentObjectType == XmlWay)
 			{
 				if(output != nullptr)
-					stopProcessing |= output->StoreWay(objId, metaData, this->tags, this->memObjIds);
+					stopProcessing |= output->StoreWay(objId, objMetaData, this->tags, this->memObjIds);
 			}
-			else if(this->currentObjectType == "relation")
+			else if(this->currentObjectType == XmlRelation)
 			{
 				if(output != nullptr)
-					stopProcessing |= output->StoreRelation(objId, metaData, this->tags, 
+					stopProcessing |= output->StoreRelation(objId, objMetaData, this->tags, 
 						this->memObjTypes, this->memObjIds, this->memObjRoles);
 			}
 
@@ -323,8 +410,7 @@ void OsmXmlDecodeString::EndElement(const XML_Char *name)
 		}
 
 		//Clear data ready for further processing
-		this->currentObjectType = "";
-		this->metadataMap.clear();
+		this->currentObjectType = XmlNoElement;
 		this->tags.clear();
 		this->memObjIds.clear();
 		this->memObjTypes.clear();
@@ -334,35 +420,120 @@ void OsmXmlDecodeString::EndElement(const XML_Char *name)
 	this->xmlDepth --;
 }
 
-void OsmXmlDecodeString::DecodeMetaData(class MetaData &metaData)
+bool OsmXmlDecodeString::DecodeObjectAttributes(const XML_Char **atts)
 {
-	TagMap::iterator it = this->metadataMap.find("version");
-	if(it != this->metadataMap.end())
-		metaData.version = atol(it->second.c_str());
-	it = this->metadataMap.find("timestamp");
-	if(it != this->metadataMap.end())
+	objId = 0;
+	objLat = 0.0; objLon = 0.0;
+	objLatFixed = 0; objLonFixed = 0;
+	objPosFixed = true;
+	minLat = 0.0; minLon = 0.0; maxLat = 0.0; maxLon = 0.0;
+	objMetaData = MetaData();
+
+	//Dispatch on the first letter, then compare the whole name. The ID and position must be
+	//valid if given, but other numbers are zero if missing or invalid, as in uploads using
+	//placeholders. Empty positions are zero, as they were when read with atof.
+	for(size_t i=0; atts[i] != NULL; i += 2)
 	{
-		struct tm dt;
-		int timezoneOffsetMin=0;
-		ParseIso8601Datetime(it->second.c_str(), &dt, &timezoneOffsetMin);
-		TmToUtc(&dt, timezoneOffsetMin);
-		metaData.timestamp = (int64_t)timegm(&dt);
+		const XML_Char *att = atts[i], *val = atts[i+1];
+		bool ok = true, exact = true;
+		int64_t intVal = 0;
+		switch(att[0])
+		{
+		case 'i':
+			if(strcmp(att, "id") == 0)
+				ok = ParseInt64(val, objId);
+			break;
+		case 'l':
+			if(strcmp(att, "lat") == 0)
+			{
+				ok = ParseCoordinate(val, objLat, objLatFixed, exact);
+				objPosFixed &= exact;
+			}
+			else if(strcmp(att, "lon") == 0)
+			{
+				ok = ParseCoordinate(val, objLon, objLonFixed, exact);
+				objPosFixed &= exact;
+			}
+			break;
+		case 'm':
+			if(strcmp(att, "minlat") == 0)
+				ok = ParseCoordinate(val, minLat);
+			else if(strcmp(att, "minlon") == 0)
+				ok = ParseCoordinate(val, minLon);
+			else if(strcmp(att, "maxlat") == 0)
+				ok = ParseCoordinate(val, maxLat);
+			else if(strcmp(att, "maxlon") == 0)
+				ok = ParseCoordinate(val, maxLon);
+			break;
+		case 'v':
+			if(strcmp(att, "version") == 0)
+			{
+				ParseInt64(val, intVal);
+				objMetaData.version = intVal;
+			}
+			else if(strcmp(att, "visible") == 0)
+				objMetaData.visible = strcmp(val, "false") != 0;
+			break;
+		case 't':
+			if(strcmp(att, "timestamp") == 0)
+				objMetaData.timestamp = ParseTimestamp(val);
+			break;
+		case 'c':
+			if(strcmp(att, "changeset") == 0)
+				ParseInt64(val, objMetaData.changeset);
+			else if(strcmp(att, "current") == 0)
+				objMetaData.current = strcmp(val, "false") != 0;
+			break;
+		case 'u':
+			if(strcmp(att, "uid") == 0)
+			{
+				ParseInt64(val, intVal);
+				objMetaData.uid = intVal;
+			}
+			else if(strcmp(att, "user") == 0)
+				objMetaData.username = val;
+			break;
+		}
+		if(!ok)
+			return FailLimit(InvalidAttributeMessage(att, val));
 	}
-	it = this->metadataMap.find("changeset");
-	if(it != this->metadataMap.end())
-		metaData.changeset = atol(it->second.c_str());
-	it = this->metadataMap.find("uid");
-	if(it != this->metadataMap.end())
-		metaData.uid = atol(it->second.c_str());
-	it = this->metadataMap.find("user");
-	if(it != this->metadataMap.end())
-		metaData.username = it->second;
-	it = this->metadataMap.find("visible");
-	if(it != this->metadataMap.end())
-		metaData.visible = it->second != "false"; 
-	it = this->metadataMap.find("current");
-	if(it != this->metadataMap.end())
-		metaData.current = it->second != "false";
+	return true;
+}
+
+int64_t OsmXmlDecodeString::ParseTimestamp(const char *str)
+{
+	//Fast path for the form OSM uses, YYYY-MM-DDTHH:MM:SSZ
+	const char *pattern = "0000-00-00T00:00:00Z";
+	size_t i = 0;
+	for(; pattern[i] != '\0'; i++)
+	{
+		if(pattern[i] == '0' ? str[i] < '0' || str[i] > '9' : str[i] != pattern[i])
+			break;
+	}
+
+	if(pattern[i] == '\0' && str[i] == '\0')
+	{
+		int hour = ParseDigits(str+11, 2), minute = ParseDigits(str+14, 2), second = ParseDigits(str+17, 2);
+		bool timeValid = hour < 24 && minute < 60 && second < 60;
+		if(timeValid && memcmp(str, cachedDate, sizeof(cachedDate)) != 0)
+		{
+			int year = ParseDigits(str, 4), month = ParseDigits(str+5, 2), day = ParseDigits(str+8, 2);
+			if(month >= 1 && month <= 12 && day >= 1 && day <= DaysInMonth(year, month))
+			{
+				memcpy(cachedDate, str, sizeof(cachedDate));
+				cachedDateStart = DaysFromCivil(year, month, day) * 86400;
+			}
+		}
+		if(timeValid && memcmp(str, cachedDate, sizeof(cachedDate)) == 0)
+			return cachedDateStart + hour * 3600 + minute * 60 + second;
+	}
+
+	//Other forms, and out of range values which are normalised as timegm does
+	struct tm dt;
+	int timezoneOffsetMin=0;
+	ParseIso8601Datetime(str, &dt, &timezoneOffsetMin);
+	TmToUtc(&dt, timezoneOffsetMin);
+	return (int64_t)timegm(&dt);
 }
 
 bool OsmXmlDecodeString::DecodeSubString(const char *xml, size_t len, bool done)
@@ -375,8 +546,7 @@ bool OsmXmlDecodeString::DecodeSubString(const char *xml, size_t len, bool done)
 	if(len > std::numeric_limits<size_t>::max() - bytesDecoded)
 		return FailLimit("XML_UPLOAD_MAXIMUM_BYTES limit exceeded");
 	bytesDecoded += len;
-	if(!CheckLimit(bytesDecoded, limits.maxBytes,
-		LimitMessage("XML_UPLOAD_MAXIMUM_BYTES", limits.maxBytes, bytesDecoded)))
+	if(!CheckLimit(bytesDecoded, limits.maxBytes, "XML_UPLOAD_MAXIMUM_BYTES"))
 		return false;
 
 	if(this->firstParseCall)
@@ -738,10 +908,10 @@ bool OsmChangeXmlDecodeString::FailLimit(const std::string &message)
 	return false;
 }
 
-bool OsmChangeXmlDecodeString::CheckLimit(size_t value, size_t limit, const std::string &message)
+bool OsmChangeXmlDecodeString::CheckLimit(size_t value, size_t limit, const char *name)
 {
 	if(limit > 0 && value > limit)
-		return FailLimit(message);
+		return FailLimit(LimitMessage(name, limit, value));
 	return true;
 }
 
@@ -755,11 +925,9 @@ bool OsmChangeXmlDecodeString::CheckElementLimits(const XML_Char *name, const XM
 		attributeBytes += strlen(atts[i]) + strlen(atts[i+1]);
 	}
 
-	if(!CheckLimit(attributeCount, limits.maxAttributesPerElement,
-		LimitMessage("PGMAP_XML_MAX_ATTRIBUTES_PER_ELEMENT", limits.maxAttributesPerElement, attributeCount)))
+	if(!CheckLimit(attributeCount, limits.maxAttributesPerElement, "PGMAP_XML_MAX_ATTRIBUTES_PER_ELEMENT"))
 		return false;
-	if(!CheckLimit(attributeBytes, limits.maxAttributeBytes,
-		LimitMessage("PGMAP_XML_MAX_ATTRIBUTE_BYTES", limits.maxAttributeBytes, attributeBytes)))
+	if(!CheckLimit(attributeBytes, limits.maxAttributeBytes, "PGMAP_XML_MAX_ATTRIBUTE_BYTES"))
 		return false;
 	return true;
 }
@@ -769,25 +937,27 @@ void OsmChangeXmlDecodeString::StartElement(const XML_Char *name, const XML_Char
 	this->xmlDepth ++;
 	//cout << this->xmlDepth << " startel " << name << endl;
 
-	if(!CheckLimit(this->xmlDepth, limits.maxDepth,
-		LimitMessage("PGMAP_XML_MAX_DEPTH", limits.maxDepth, this->xmlDepth)))
+	if(!CheckLimit(this->xmlDepth, limits.maxDepth, "PGMAP_XML_MAX_DEPTH"))
 		return;
 	if(!CheckElementLimits(name, atts))
 		return;
 
 	if(this->xmlDepth == 2)
 	{
-		std::map<std::string, std::string> attribs;
-		XmlAttsToMap(atts, attribs);
-
 		currentAction = name;
-		std::map<std::string, std::string>::iterator it = attribs.find("if-unused");
-		this->ifunused = (it != attribs.end());
+		this->ifunused = false;
+		for(size_t i=0; atts[i] != NULL; i += 2)
+		{
+			if(strcmp(atts[i], "if-unused") == 0)
+				this->ifunused = true;
+		}
 	}
 	else if(this->xmlDepth > 2)
 	{
 		osmDataDecoder.xmlDepth = this->xmlDepth - 2;
 		osmDataDecoder.StartElement(name, atts);
+		if(!osmDataDecoder.errString.empty())
+			FailLimit(osmDataDecoder.errString);
 	}
 }
 
@@ -821,8 +991,7 @@ bool OsmChangeXmlDecodeString::DecodeSubString(const char *xml, size_t len, bool
 	if(len > std::numeric_limits<size_t>::max() - bytesDecoded)
 		return FailLimit("XML_UPLOAD_MAXIMUM_BYTES limit exceeded");
 	bytesDecoded += len;
-	if(!CheckLimit(bytesDecoded, limits.maxBytes,
-		LimitMessage("XML_UPLOAD_MAXIMUM_BYTES", limits.maxBytes, bytesDecoded)))
+	if(!CheckLimit(bytesDecoded, limits.maxBytes, "XML_UPLOAD_MAXIMUM_BYTES"))
 		return false;
 
 	if (XML_Parse(parser, xml, len, done) == XML_STATUS_ERROR)
@@ -34,18 +34,31 @@ class OsmXmlDecodeString : public OsmDecoder
 {
 	friend class OsmChangeXmlDecodeString;
 protected:
+	enum XmlObjectType {XmlNoElement, XmlOtherElement, XmlBounds, XmlNode, XmlWay, XmlRelation};
+
 	XML_Parser parser;
 	int xmlDepth;
-	std::string currentObjectType, lastObjectType;
-	TagMap metadataMap, tags;
+	XmlObjectType currentObjectType, lastObjectType;
+	//Attributes of the current object, read as the element starts
+	int64_t objId;
+	double objLat, objLon, minLat, minLon, maxLat, maxLon;
+	int64_t objLatFixed, objLonFixed; //Units of 1e-7 degrees, set if objPosFixed
+	bool objPosFixed; //The position has no more than 7 decimal places
+	class MetaData objMetaData;
+	//Date of the last canonical timestamp and the time at its start, as objects often share a date
+	char cachedDate[10];
+	int64_t cachedDateStart;
+	TagMap tags;
 	std::vector<int64_t> memObjIds;
 	std::vector<std::string> memObjTypes, memObjRoles;
 	bool firstParseCall, parseCompleted, stopProcessing;
 	class OsmXmlLimits limits;
 	size_t bytesDecoded, objectCount, tagCount, wayNodeCount, relationMemberCount;
 
-	void DecodeMetaData(class MetaData &metaData);
-	bool CheckLimit(size_t value, size_t limit, const std::string &message);
+	///Returns false if an attribute is not a valid number
+	bool DecodeObjectAttributes(const XML_Char **atts);
+	int64_t ParseTimestamp(const char *str);
+	bool CheckLimit(size_t value, size_t limit, const char *name);
 	bool CheckElementLimits(const XML_Char *name, const XML_Char **atts);
 	bool FailLimit(const std::string &message);
 
@@ -161,7 +174,7 @@ protected:
 	class OsmXmlLimits limits;
 	size_t bytesDecoded;
 
-	bool CheckLimit(size_t value, size_t limit, const std::string &message);
+	bool CheckLimit(size_t value, size_t limit, const char *name);
 	bool CheckElementLimits(const XML_Char *name, const XML_Char **atts);
 	bool FailLimit(const std::string &message);
 
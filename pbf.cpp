@@ -4,40 +4,17 @@
 #include <sstream>
 #include <cmath>
 #include <stdexcept>
+#include <unordered_map>
 #include "pbf/fileformat.pb.h"
 #include "pbf/osmformat.pb.h"
 #include <arpa/inet.h>
-#include <boost/iostreams/filtering_streambuf.hpp>
-#include <boost/iostreams/copy.hpp>
-#include <boost/iostreams/filter/zlib.hpp>
 #include "OsmData.h"
 #include "utils.h"
+#include "varint.h"
 using namespace std;
 
-// https://stackoverflow.com/questions/27529570/simple-zlib-c-string-compression-and-decompression
-std::string CompressData(const std::string &data)
-{
-    std::stringstream compressed;
-    std::stringstream decompressed;
-    decompressed << data;
-    boost::iostreams::filtering_streambuf<boost::iostreams::input> out;
-    out.push(boost::iostreams::zlib_compressor());
-    out.push(decompressed);
-    boost::iostreams::copy(out, compressed);
-    return compressed.str();
-}
-
-std::string DecompressData(const std::string &data)
-{
-    std::stringstream compressed;
-    std::stringstream decompressed;
-    compressed << data;
-    boost::iostreams::filtering_streambuf<boost::iostreams::input> in;
-    in.push(boost::iostreams::zlib_decompressor());
-    in.push(compressed);
-    boost::iostreams::copy(in, decompressed);
-    return decompressed.str();
-}
+//Larger raw_size hints are not trusted for preallocation. The PBF spec limits blobs to 32MB.
+static const size_t PBF_MAX_RAW_SIZE_HINT = 64 * 1024 * 1024;
 
 void ReadExactLengthPbf(std::istream &str, char *out, size_t len)
 {
@@ -52,12 +29,11 @@ void ReadExactLengthPbf(std::istream &str, char *out, size_t len)
 	}
 }
 
-bool DecodeOsmHeader(std::string &decBlob,
+bool DecodeOsmHeader(const std::string &decBlob,
 	class IDataStreamHandler* output)
 {
 	OSMPBF::HeaderBlock hb;
-	std::istringstream iss(decBlob);
-	bool ok = hb.ParseFromIstream(&iss);
+	bool ok = hb.ParseFromString(decBlob);
 	if(!ok)
 		throw runtime_error("Error decoding PBF HeaderBlock");
 
@@ -137,38 +113,45 @@ bool DecodeOsmDenseNodes(const OSMPBF::DenseNodes &dense,
 	const std::vector<std::string> &stringTab,
 	class IDataStreamHandler* output)
 {
-	//Decode tags
-	vector<map<string, string> > tags;
-	map<string, string> current;
-	for(int j=0; j<dense.keys_vals_size(); j++)
-	{
-		int32_t sti = dense.keys_vals(j);
-		if(sti > 0 and (size_t)sti < stringTab.size() and j<dense.keys_vals_size()-1)
-		{
-			int32_t sti2 = dense.keys_vals(j+1);
-			current[stringTab[sti]] = stringTab[sti2];
-			j++;
-		}
-		else
-		{
-			tags.push_back(current);
-			current.clear();
-		}
-	}
-
 	int64_t idc = 0, latc = 0, lonc = 0, timestampc = 0, changesetc = 0;
 	int32_t uidc = 0, user_sidc = 0;
+	int kvPos = 0;
+	const int kvSize = dense.keys_vals_size();
+	TagMap tags;
 	for(int j=0; j<dense.id_size() and j<dense.lat_size() and j<dense.lon_size(); j++)
 	{
 		idc += dense.id(j);
 		latc += dense.lat(j);
 		lonc += dense.lon(j);
 
+		//Tags of each node are key/value string indices, ending with a zero. They are read
+		//alongside the nodes rather than collected for the whole block first.
+		tags.clear();
+		bool terminated = false;
+		while(kvPos < kvSize)
+		{
+			int32_t sti = dense.keys_vals(kvPos);
+			if(sti > 0 and (size_t)sti < stringTab.size() and kvPos+1 < kvSize)
+			{
+				int32_t sti2 = dense.keys_vals(kvPos+1);
+				std::string &val = tags[stringTab[sti]];
+				if(sti2 >= 0 and (size_t)sti2 < stringTab.size())
+					val = stringTab[sti2];
+				else
+					val.clear();
+				kvPos += 2;
+			}
+			else
+			{
+				kvPos ++;
+				terminated = true;
+				break;
+			}
+		}
+		if(!terminated)
+			tags.clear();
+
 		class MetaData metaData;
-		TagMap empty;
-		const TagMap *tagMapPtr = &empty;
-		if((size_t)j < tags.size())
-			tagMapPtr = &tags[j];
 		
 		if(dense.has_denseinfo())
 		{
@@ -209,7 +192,7 @@ bool DecodeOsmDenseNodes(const OSMPBF::DenseNodes &dense,
 		bool halt = false;
 		if(output)
 			output->StoreNode(idc, metaData, 
-				*tagMapPtr, 
+				tags, 
 				1e-9 * (lat_offset + (granularity * latc)), 
 				1e-9 * (lon_offset + (granularity * lonc)));
 		if(halt)
@@ -245,11 +228,8 @@ bool DecodeOsmWays(const OSMPBF::PrimitiveGroup& pg,
 		}
 
 		int64_t refsc = 0;
-		for(int j=0; j<way.refs_size(); j++)
-		{
-			refsc += way.refs(j);
-			refs.push_back(refsc);
-		}
+		refs.assign(way.refs().begin(), way.refs().end());
+		AccumulateDeltas(refs.data(), refs.size(), refsc);
 		
 		bool halt = false;
 		if(output)
@@ -326,21 +306,777 @@ bool DecodeOsmRelations(const OSMPBF::PrimitiveGroup& pg,
 	return false;
 }
 
+// ******** PBF wire format decoding *********
+// These follow the libprotobuf based functions above, but read the data in place.
+
+static void DecodeWireInfo(const PbfWireSpan &span, const class PbfWireBlock &block, class MetaData &out)
+{
+	PbfWireReader info(span);
+	uint32_t field, wireType;
+	int64_t userSid = 0;
+	bool hasUserSid = false;
+	while(info.Next(field, wireType))
+	{
+		if(wireType != PbfWireReader::WireVarint)
+		{
+			info.Skip(wireType);
+			continue;
+		}
+		switch(field)
+		{
+		case 1:
+			out.version = (int32_t)info.ReadVarint();
+			break;
+		case 2:
+			out.timestamp = (int64_t)info.ReadVarint()*block.date_granularity / 1000;
+			break;
+		case 3:
+			out.changeset = (int64_t)info.ReadVarint();
+			break;
+		case 4:
+			out.uid = (int32_t)info.ReadVarint();
+			break;
+		case 5:
+			userSid = (uint32_t)info.ReadVarint();
+			hasUserSid = true;
+			break;
+		case 6:
+			out.visible = info.ReadVarint() != 0;
+			break;
+		default:
+			info.ReadVarint();
+			break;
+		}
+	}
+	if(hasUserSid and block.ValidString(userSid))
+		block.GetString(userSid, out.username);
+}
+
+static void DecodeWireTags(const class PbfWireBlock &block, TagMap &tags)
+{
+	std::string key, val;
+	for(size_t j=0; j<block.keys.size() and j<block.vals.size(); j++)
+	{
+		uint32_t keyIndex = block.keys[j];
+		uint32_t valIndex = block.vals[j];
+		if(block.ValidString(keyIndex) and block.ValidString(valIndex))
+		{
+			block.GetString(keyIndex, key);
+			block.GetString(valIndex, val);
+			tags[key] = val;
+		}
+	}
+}
+
+static void DecodeWireNode(const PbfWireSpan &span, class PbfWireBlock &block,
+	class IDataStreamHandler* output)
+{
+	block.keys.clear();
+	block.vals.clear();
+	int64_t objId = 0, lat = 0, lon = 0;
+	PbfWireSpan info;
+
+	PbfWireReader node(span);
+	uint32_t field, wireType;
+	while(node.Next(field, wireType))
+	{
+		if(field == 1 and wireType == PbfWireReader::WireVarint)
+			objId = node.ReadZigzag();
+		else if(field == 2)
+			node.ReadRepeatedVarint(wireType, block.keys);
+		else if(field == 3)
+			node.ReadRepeatedVarint(wireType, block.vals);
+		else if(field == 4 and wireType == PbfWireReader::WireLengthDelimited)
+			info = node.ReadBytes();
+		else if(field == 8 and wireType == PbfWireReader::WireVarint)
+			lat = node.ReadZigzag();
+		else if(field == 9 and wireType == PbfWireReader::WireVarint)
+			lon = node.ReadZigzag();
+		else
+			node.Skip(wireType);
+	}
+
+	class MetaData metaData;
+	TagMap tags;
+	DecodeWireTags(block, tags);
+	if(info.start != nullptr)
+		DecodeWireInfo(info, block, metaData);
+
+	if(output)
+		output->StoreNode(objId, metaData, tags, 
+			1e-9 * (block.lat_offset + (block.granularity * lat)), 
+			1e-9 * (block.lon_offset + (block.granularity * lon)));
+}
+
+static void DecodeWireDenseInfo(const PbfWireSpan &span, class PbfWireBlock &block)
+{
+	PbfWireReader di(span);
+	uint32_t field, wireType;
+	while(di.Next(field, wireType))
+	{
+		switch(field)
+		{
+		case 1:
+			di.ReadRepeatedVarint(wireType, block.versions);
+			break;
+		case 2:
+			di.ReadRepeatedZigzag(wireType, block.timestamps);
+			break;
+		case 3:
+			di.ReadRepeatedZigzag(wireType, block.changesets);
+			break;
+		case 4:
+			di.ReadRepeatedZigzag(wireType, block.uids);
+			break;
+		case 5:
+			di.ReadRepeatedZigzag(wireType, block.userSids);
+			break;
+		case 6:
+			di.ReadRepeatedVarint(wireType, block.visibles);
+			break;
+		default:
+			di.Skip(wireType);
+			break;
+		}
+	}
+}
+
+static void DecodeWireDenseNodes(const PbfWireSpan &span, class PbfWireBlock &block,
+	class IDataStreamHandler* output)
+{
+	block.ids.clear();
+	block.lats.clear();
+	block.lons.clear();
+	block.keysVals.clear();
+	block.versions.clear();
+	block.timestamps.clear();
+	block.changesets.clear();
+	block.uids.clear();
+	block.userSids.clear();
+	block.visibles.clear();
+	bool hasDenseInfo = false;
+
+	//Ids and positions are resolved from deltas as they are read
+	int64_t idc = 0, latc = 0, lonc = 0;
+	PbfWireReader dense(span);
+	uint32_t field, wireType;
+	while(dense.Next(field, wireType))
+	{
+		if(field == 1)
+			dense.ReadRepeatedZigzagDeltas(wireType, idc, block.ids);
+		else if(field == 5 and wireType == PbfWireReader::WireLengthDelimited)
+		{
+			DecodeWireDenseInfo(dense.ReadBytes(), block);
+			hasDenseInfo = true;
+		}
+		else if(field == 8)
+			dense.ReadRepeatedZigzagDeltas(wireType, latc, block.lats);
+		else if(field == 9)
+			dense.ReadRepeatedZigzagDeltas(wireType, lonc, block.lons);
+		else if(field == 10)
+			dense.ReadRepeatedVarint(wireType, block.keysVals);
+		else
+			dense.Skip(wireType);
+	}
+
+	int64_t timestampc = 0, changesetc = 0;
+	int32_t uidc = 0, user_sidc = 0;
+	size_t kvPos = 0;
+	std::string key, val;
+	TagMap tags;
+	for(size_t j=0; j<block.ids.size() and j<block.lats.size() and j<block.lons.size(); j++)
+	{
+		//Tags of each node are key/value string indices, ending with a zero
+		tags.clear();
+		bool terminated = false;
+		while(kvPos < block.keysVals.size())
+		{
+			int32_t sti = (int32_t)block.keysVals[kvPos];
+			if(block.ValidString(sti) and kvPos+1 < block.keysVals.size())
+			{
+				int32_t sti2 = (int32_t)block.keysVals[kvPos+1];
+				block.GetString(sti, key);
+				if(sti2 >= 0 and (size_t)sti2 < block.strings.size())
+					block.GetString(sti2, val);
+				else
+					val.clear();
+				tags[key] = val;
+				kvPos += 2;
+			}
+			else
+			{
+				kvPos ++;
+				terminated = true;
+				break;
+			}
+		}
+		if(!terminated)
+			tags.clear();
+
+		class MetaData metaData;
+		if(hasDenseInfo)
+		{
+			if(j < block.versions.size())
+				metaData.version = (int32_t)block.versions[j];
+
+			if(j < block.timestamps.size())
+			{
+				timestampc += block.timestamps[j];
+				metaData.timestamp = timestampc*block.date_granularity / 1000;
+			}
+
+			if(j < block.changesets.size())
+			{
+				changesetc += block.changesets[j];
+				metaData.changeset = changesetc;
+			}
+
+			if(j < block.uids.size())
+			{
+				uidc += (int32_t)block.uids[j];
+				metaData.uid = uidc;
+			}
+
+			if(j < block.userSids.size())
+			{
+				user_sidc += (int32_t)block.userSids[j];
+				if(block.ValidString(user_sidc))
+					block.GetString(user_sidc, metaData.username);
+			}
+
+			if(j < block.visibles.size())
+				metaData.visible = block.visibles[j] != 0;
+		}
+
+		if(output)
+			output->StoreNode(block.ids[j], metaData, tags, 
+				1e-9 * (block.lat_offset + (block.granularity * block.lats[j])), 
+				1e-9 * (block.lon_offset + (block.granularity * block.lons[j])));
+	}
+}
+
+static void DecodeWireWay(const PbfWireSpan &span, class PbfWireBlock &block,
+	class IDataStreamHandler* output)
+{
+	block.keys.clear();
+	block.vals.clear();
+	block.refs.clear();
+	int64_t objId = 0, refsc = 0;
+	PbfWireSpan info;
+
+	PbfWireReader way(span);
+	uint32_t field, wireType;
+	while(way.Next(field, wireType))
+	{
+		if(field == 1 and wireType == PbfWireReader::WireVarint)
+			objId = (int64_t)way.ReadVarint();
+		else if(field == 2)
+			way.ReadRepeatedVarint(wireType, block.keys);
+		else if(field == 3)
+			way.ReadRepeatedVarint(wireType, block.vals);
+		else if(field == 4 and wireType == PbfWireReader::WireLengthDelimited)
+			info = way.ReadBytes();
+		else if(field == 8)
+			way.ReadRepeatedZigzagDeltas(wireType, refsc, block.refs);
+		else
+			way.Skip(wireType);
+	}
+
+	class MetaData metaData;
+	TagMap tags;
+	DecodeWireTags(block, tags);
+	if(info.start != nullptr)
+		DecodeWireInfo(info, block, metaData);
+
+	if(output)
+		output->StoreWay(objId, metaData, tags, block.refs);
+}
+
+static void DecodeWireRelation(const PbfWireSpan &span, class PbfWireBlock &block,
+	class IDataStreamHandler* output)
+{
+	block.keys.clear();
+	block.vals.clear();
+	block.refs.clear();
+	block.types.clear();
+	block.roles.clear();
+	int64_t objId = 0, memidsc = 0;
+	PbfWireSpan info;
+
+	PbfWireReader relation(span);
+	uint32_t field, wireType;
+	while(relation.Next(field, wireType))
+	{
+		if(field == 1 and wireType == PbfWireReader::WireVarint)
+			objId = (int64_t)relation.ReadVarint();
+		else if(field == 2)
+			relation.ReadRepeatedVarint(wireType, block.keys);
+		else if(field == 3)
+			relation.ReadRepeatedVarint(wireType, block.vals);
+		else if(field == 4 and wireType == PbfWireReader::WireLengthDelimited)
+			info = relation.ReadBytes();
+		else if(field == 8)
+			relation.ReadRepeatedVarint(wireType, block.roles);
+		else if(field == 9)
+			relation.ReadRepeatedZigzagDeltas(wireType, memidsc, block.refs);
+		else if(field == 10)
+			relation.ReadRepeatedVarint(wireType, block.types);
+		else
+			relation.Skip(wireType);
+	}
+
+	class MetaData metaData;
+	TagMap tags;
+	DecodeWireTags(block, tags);
+	if(info.start != nullptr)
+		DecodeWireInfo(info, block, metaData);
+
+	std::vector<std::string> refTypeStrs;
+	std::vector<int64_t> refIds;
+	std::vector<std::string> refRoles;
+	for(size_t j=0; j<block.refs.size() and j<block.types.size() and j<block.roles.size(); j++)
+	{
+		switch(block.types[j])
+		{
+			case OSMPBF::Relation_MemberType_NODE:
+				refTypeStrs.push_back("node");
+				break;
+			case OSMPBF::Relation_MemberType_WAY:
+				refTypeStrs.push_back("way");
+				break;
+			case OSMPBF::Relation_MemberType_RELATION:
+				refTypeStrs.push_back("relation");
+				break;
+			default:
+				refTypeStrs.push_back("");
+				break;
+		}
+		refIds.push_back(block.refs[j]);
+		int32_t roleIndex = (int32_t)block.roles[j];
+		refRoles.push_back("");
+		if(block.ValidString(roleIndex))
+			block.GetString(roleIndex, refRoles.back());
+	}
+
+	if(output)
+		output->StoreRelation(objId, metaData, 
+			tags, refTypeStrs, refIds, refRoles);
+}
+
+///Decode the objects held in one field of a PrimitiveGroup: 1 nodes, 2 dense nodes, 3 ways or 4 relations
+static void DecodeWireGroupField(const PbfWireSpan &group, uint32_t objField, class PbfWireBlock &block,
+	class IDataStreamHandler* output)
+{
+	PbfWireReader pg(group);
+	uint32_t field, wireType;
+	while(pg.Next(field, wireType))
+	{
+		if(field != objField or wireType != PbfWireReader::WireLengthDelimited)
+		{
+			pg.Skip(wireType);
+			continue;
+		}
+		PbfWireSpan obj = pg.ReadBytes();
+		switch(objField)
+		{
+		case 1:
+			DecodeWireNode(obj, block, output);
+			break;
+		case 2:
+			DecodeWireDenseNodes(obj, block, output);
+			break;
+		case 3:
+			DecodeWireWay(obj, block, output);
+			break;
+		case 4:
+			DecodeWireRelation(obj, block, output);
+			break;
+		}
+	}
+}
+
+// ******** PBF blob summary *****************
+
+PbfBlobSummary::PbfBlobSummary()
+{
+	objType = 0;
+	minId = 0;
+	maxId = 0;
+	objCount = 0;
+	hasBbox = false;
+	minLon = 0.0;
+	minLat = 0.0;
+	maxLon = 0.0;
+	maxLat = 0.0;
+}
+
+void PbfBlobSummary::Encode(std::string &out) const
+{
+	out = "ix";
+	AppendVarint(1, out); //Format version
+	out.push_back(this->objType);
+	AppendZigzag(this->minId, out);
+	AppendZigzag(this->maxId, out);
+	AppendVarint(this->objCount, out);
+	out.push_back(this->hasBbox ? 1 : 0);
+	if(this->hasBbox)
+	{
+		//Rounded outwards, so the box contains every node
+		AppendZigzag(floor(this->minLon * 1e7), out);
+		AppendZigzag(floor(this->minLat * 1e7), out);
+		AppendZigzag(ceil(this->maxLon * 1e7), out);
+		AppendZigzag(ceil(this->maxLat * 1e7), out);
+	}
+}
+
+bool PbfBlobSummary::Decode(const std::string &data)
+{
+	//Other encoders may use indexdata for something else, so check carefully
+	if(data.size() < 3 or data[0] != 'i' or data[1] != 'x')
+		return false;
+	const uint8_t *cursor = (const uint8_t *)data.data() + 2;
+	const uint8_t *end = (const uint8_t *)data.data() + data.size();
+	uint64_t version = 0;
+	cursor = DecodeVarint(cursor, end, version);
+	if(cursor == NULL or version != 1 or cursor >= end)
+		return false;
+	this->objType = *cursor;
+	cursor ++;
+	if(this->objType != 'n' and this->objType != 'w' and this->objType != 'r')
+		return false;
+	cursor = DecodeZigzag(cursor, end, this->minId);
+	if(cursor != NULL)
+		cursor = DecodeZigzag(cursor, end, this->maxId);
+	if(cursor != NULL)
+		cursor = DecodeVarint(cursor, end, this->objCount);
+	if(cursor == NULL or cursor >= end)
+		return false;
+	this->hasBbox = *cursor != 0;
+	cursor ++;
+	if(this->hasBbox)
+	{
+		int64_t coords[4];
+		for(int i=0; i<4 and cursor != NULL; i++)
+			cursor = DecodeZigzag(cursor, end, coords[i]);
+		if(cursor == NULL)
+			return false;
+		this->minLon = coords[0] * 1e-7;
+		this->minLat = coords[1] * 1e-7;
+		this->maxLon = coords[2] * 1e-7;
+		this->maxLat = coords[3] * 1e-7;
+	}
+	return true;
+}
+
+template<class T> static void SummariseBlob(char objType, const std::vector<T> &objs, size_t start, size_t end, 
+	class PbfBlobSummary &out)
+{
+	out = PbfBlobSummary();
+	out.objType = objType;
+	out.objCount = end - start;
+	for(size_t i=start; i<end; i++)
+	{
+		int64_t objId = objs[i].objId;
+		if(i == start or objId < out.minId)
+			out.minId = objId;
+		if(i == start or objId > out.maxId)
+			out.maxId = objId;
+	}
+}
+
+static void SummariseNodeBlob(const std::vector<class OsmNode> &nodes, size_t start, size_t end, 
+	class PbfBlobSummary &out)
+{
+	SummariseBlob('n', nodes, start, end, out);
+	for(size_t i=start; i<end; i++)
+	{
+		const class OsmNode &node = nodes[i];
+		if(i == start or node.lon < out.minLon)
+			out.minLon = node.lon;
+		if(i == start or node.lat < out.minLat)
+			out.minLat = node.lat;
+		if(i == start or node.lon > out.maxLon)
+			out.maxLon = node.lon;
+		if(i == start or node.lat > out.maxLat)
+			out.maxLat = node.lat;
+	}
+	out.hasBbox = end > start;
+}
+
+// ******** PBF blob index *******************
+
+PbfIndexEntry::PbfIndexEntry()
+{
+	offset = 0;
+	rawSize = 0;
+	objType = 0;
+	minId = 0;
+	maxId = 0;
+	objCount = 0;
+}
+
+void SavePbfIndex(const std::vector<class PbfIndexEntry> &index, uint64_t dataSize, std::streambuf &out)
+{
+	std::string buff = "pbfi";
+	buff.append(EncodeVarint(1)); //Format version
+	buff.append(EncodeVarint(dataSize));
+	buff.append(EncodeVarint(index.size()));
+	for(size_t i=0; i<index.size(); i++)
+	{
+		const class PbfIndexEntry &entry = index[i];
+		buff.append(EncodeVarint(entry.offset));
+		buff.append(EncodeVarint(entry.blobType.size()));
+		buff.append(entry.blobType);
+		buff.append(EncodeVarint(entry.rawSize));
+		buff.append(1, entry.objType);
+		buff.append(EncodeZigzag(entry.minId));
+		buff.append(EncodeZigzag(entry.maxId));
+		buff.append(EncodeVarint(entry.objCount));
+	}
+	if(out.sputn(buff.data(), buff.size()) != (std::streamsize)buff.size())
+		throw std::runtime_error("Failed to write pbf index");
+}
+
+uint64_t LoadPbfIndex(std::streambuf &in, std::vector<class PbfIndexEntry> &index)
+{
+	std::istream handle(&in);
+	char magic[4];
+	handle.read(magic, 4);
+	if(handle.fail() || std::string(magic, 4) != "pbfi")
+		throw std::runtime_error("Not a pbf index");
+	if(DecodeVarint(handle) != 1)
+		throw std::runtime_error("Unsupported pbf index version");
+	uint64_t dataSize = DecodeVarint(handle);
+	uint64_t count = DecodeVarint(handle);
+
+	index.clear();
+	for(uint64_t i=0; i<count; i++)
+	{
+		class PbfIndexEntry entry;
+		entry.offset = DecodeVarint(handle);
+		uint64_t typeLen = DecodeVarint(handle);
+		if(typeLen > 64)
+			throw std::runtime_error("Corrupt pbf index");
+		entry.blobType.resize(typeLen);
+		handle.read(&entry.blobType[0], typeLen);
+		entry.rawSize = DecodeVarint(handle);
+		int objType = handle.get();
+		if(handle.fail())
+			throw std::runtime_error("Truncated pbf index");
+		entry.objType = objType;
+		entry.minId = DecodeZigzag(handle);
+		entry.maxId = DecodeZigzag(handle);
+		entry.objCount = DecodeVarint(handle);
+		index.push_back(entry);
+	}
+	return dataSize;
+}
+
+static int PbfTypeRank(char objType)
+{
+	switch(objType)
+	{
+	case 'n': return 1;
+	case 'w': return 2;
+	case 'r': return 3;
+	}
+	return 0;
+}
+
+static bool PbfBlobContains(const class PbfIndexEntry &entry, char objType, int64_t objId)
+{
+	return entry.objType == objType and entry.objCount > 0 and entry.minId <= objId and objId <= entry.maxId;
+}
+
+int64_t FindPbfBlob(const std::vector<class PbfIndexEntry> &index, char objType, int64_t objId)
+{
+	//In a file sorted by type then ID, the last blob starting at or before the ID is the one
+	int rank = PbfTypeRank(objType);
+	size_t lo = 0, hi = index.size();
+	while(lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		const class PbfIndexEntry &entry = index[mid];
+		int midRank = PbfTypeRank(entry.objType);
+		if(midRank < rank or (midRank == rank and entry.minId <= objId))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if(lo > 0 and PbfBlobContains(index[lo-1], objType, objId))
+		return lo-1;
+
+	//The file may not be sorted, so check every blob
+	for(size_t i=0; i<index.size(); i++)
+		if(PbfBlobContains(index[i], objType, objId))
+			return i;
+	return -1;
+}
+
+int64_t FindPbfBlob(const std::vector<class PbfIndexEntry> &index, char objType)
+{
+	for(size_t i=0; i<index.size(); i++)
+		if(index[i].objType == objType)
+			return i;
+	return -1;
+}
+
+static void IndexObjectId(class PbfIndexEntry &entry, char objType, int64_t objId)
+{
+	if(entry.objCount == 0)
+	{
+		entry.objType = objType;
+		entry.minId = objId;
+		entry.maxId = objId;
+	}
+	else
+	{
+		if(entry.objType != objType)
+			entry.objType = 0;
+		if(objId < entry.minId)
+			entry.minId = objId;
+		if(objId > entry.maxId)
+			entry.maxId = objId;
+	}
+	entry.objCount ++;
+}
+
+static int64_t ReadWireObjectId(const PbfWireSpan &span, bool zigzag)
+{
+	PbfWireReader obj(span);
+	uint32_t field, wireType;
+	int64_t objId = 0;
+	while(obj.Next(field, wireType))
+	{
+		if(field == 1 and wireType == PbfWireReader::WireVarint)
+			objId = zigzag ? obj.ReadZigzag() : (int64_t)obj.ReadVarint();
+		else
+			obj.Skip(wireType);
+	}
+	return objId;
+}
+
+///Find the IDs in a PrimitiveBlock, without decoding anything else
+static void IndexWireBlock(const std::string &decBlob, class PbfWireBlock &block, class PbfIndexEntry &entry)
+{
+	block.Parse((const uint8_t *)decBlob.data(), decBlob.size());
+	for(size_t i=0; i<block.groups.size(); i++)
+	{
+		PbfWireReader pg(block.groups[i]);
+		uint32_t field, wireType;
+		while(pg.Next(field, wireType))
+		{
+			if(field < 1 or field > 4 or wireType != PbfWireReader::WireLengthDelimited)
+			{
+				pg.Skip(wireType);
+				continue;
+			}
+			PbfWireSpan obj = pg.ReadBytes();
+			if(field == 1)
+				IndexObjectId(entry, 'n', ReadWireObjectId(obj, true));
+			else if(field == 2)
+			{
+				block.ids.clear();
+				int64_t idc = 0;
+				PbfWireReader dense(obj);
+				while(dense.Next(field, wireType))
+				{
+					if(field == 1)
+						dense.ReadRepeatedZigzagDeltas(wireType, idc, block.ids);
+					else
+						dense.Skip(wireType);
+				}
+				for(size_t j=0; j<block.ids.size(); j++)
+					IndexObjectId(entry, 'n', block.ids[j]);
+			}
+			else if(field == 3)
+				IndexObjectId(entry, 'w', ReadWireObjectId(obj, false));
+			else
+				IndexObjectId(entry, 'r', ReadWireObjectId(obj, false));
+		}
+	}
+}
+
 // ********************************************
 
-PbfDecode::PbfDecode(std::streambuf &handleIn):
+///Returns the decompressed content of a blob, which may be held in buff
+static const std::string *InflateBlob(const OSMPBF::Blob &blob, class ZlibCodec &codec, 
+	class LzmaCodec &lzmaCodec, std::string &buff)
+{
+	//Raw data is decoded where it is, compressed data is inflated into a reused buffer
+	if(blob.has_raw())
+		return &blob.raw();
+	size_t rawSize = blob.raw_size() > 0 ? (size_t)blob.raw_size() : 0;
+	if(rawSize > PBF_MAX_RAW_SIZE_HINT)
+		rawSize = 0;
+	if(blob.has_zlib_data())
+	{
+		const std::string &zlibData = blob.zlib_data();
+		codec.Decompress(zlibData.data(), zlibData.size(), buff, rawSize);
+	}
+	else if(blob.has_lzma_data())
+	{
+		const std::string &lzmaData = blob.lzma_data();
+		lzmaCodec.Decompress(lzmaData.data(), lzmaData.size(), buff, rawSize);
+	}
+	else
+		buff.clear();
+	return &buff;
+}
+
+PbfDecodeBase::PbfDecodeBase():
 	OsmDecoder(),
-	handle(&handleIn)
+	useWireParser(false)
 {
 
 }
 
+PbfDecodeBase::~PbfDecodeBase()
+{
+
+}
+
+bool PbfDecodeBase::DecodeBlob(const std::string &headerType, const std::string &blobData)
+{
+	OSMPBF::Blob blob;
+	bool ok = blob.ParseFromString(blobData);
+	if(!ok)
+		throw runtime_error("Error decoding PBF Blob");
+
+	const std::string *decBlob = InflateBlob(blob, this->codec, this->lzmaCodec, this->decBuff);
+
+	bool halt = false;
+	if(headerType == "OSMHeader")
+	{
+		if(this->decodeMask & DecodeBounds)
+			halt = DecodeOsmHeader(*decBlob, this->output);
+	}
+
+	else if(headerType == "OSMData")
+	{
+		if(this->useWireParser)
+			halt = DecodeOsmDataWire(*decBlob);
+		else
+			halt = DecodeOsmData(*decBlob);
+	}
+
+	return halt;
+}
+
+PbfDecode::PbfDecode(std::streambuf &handleIn):
+	PbfDecodeBase(),
+	handle(&handleIn),
+	skippedBlobs(0)
+{
+	this->ClearFilters();
+}
+
 PbfDecode::~PbfDecode()
 {
 
 }
 
-bool PbfDecode::DecodeNext()
+bool PbfDecode::ReadBlob(std::string &headerType, std::string &blobData, bool applyFilter)
 {
 	int32_t blobHeaderLenNbo;
 	ReadExactLengthPbf(handle, (char*)&blobHeaderLenNbo, sizeof(int32_t));
@@ -356,32 +1092,94 @@ bool PbfDecode::DecodeNext()
 	if(!ok)
 		throw runtime_error("Error decoding PBF BlobHeader");
 
-	std::string headerType = header.type();
-
+	headerType = header.type();
 	int32_t blobSize = header.datasize();
-	std::string refData2;
-	refData2.resize(blobSize);
-	ReadExactLengthPbf(handle, &refData2[0], blobSize);
 
-	OSMPBF::Blob blob;
-	std::istringstream iss2(refData2);
-	ok = blob.ParseFromIstream(&iss2);
-	if(!ok)
-		throw runtime_error("Error decoding PBF Blob");
+	class PbfBlobSummary summary;
+	if(applyFilter and header.has_indexdata() and summary.Decode(header.indexdata()) 
+		and !this->BlobWanted(summary))
+	{
+		handle.ignore(blobSize);
+		if(handle.gcount() != blobSize)
+			throw std::runtime_error("Input underflow");
+		blobData.clear();
+		this->skippedBlobs ++;
+		return false;
+	}
 
-	string decBlob;
-	if(blob.has_raw())
-		decBlob = blob.raw();
-	else if(blob.has_zlib_data())
-		decBlob = DecompressData(blob.zlib_data());
+	blobData.resize(blobSize);
+	ReadExactLengthPbf(handle, &blobData[0], blobSize);
+	return true;
+}
 
-	bool halt = false;
-	if(headerType == "OSMHeader")
-		halt = DecodeOsmHeader(decBlob, this->output);
+static int PbfTypeIndex(char objType)
+{
+	switch(objType)
+	{
+	case 'n': return 0;
+	case 'w': return 1;
+	case 'r': return 2;
+	}
+	return -1;
+}
 
-	else if(headerType == "OSMData")
-		halt = DecodeOsmData(decBlob);
+bool PbfDecode::BlobWanted(const class PbfBlobSummary &summary) const
+{
+	int typeIndex = PbfTypeIndex(summary.objType);
+	if(typeIndex < 0)
+		return true;
+	static const unsigned typeMasks[3] = {DecodeNodes, DecodeWays, DecodeRelations};
+	if(!(this->decodeMask & typeMasks[typeIndex]))
+		return false;
+
+	if(this->idFilter[typeIndex] and (summary.maxId < this->idFilterMin[typeIndex] 
+		or summary.minId > this->idFilterMax[typeIndex]))
+		return false;
+
+	if(this->bboxFilter and summary.hasBbox and (summary.maxLon < this->filterBbox[0] 
+		or summary.maxLat < this->filterBbox[1] or summary.minLon > this->filterBbox[2] 
+		or summary.minLat > this->filterBbox[3]))
+		return false;
+	return true;
+}
+
+void PbfDecode::SetBboxFilter(double x1, double y1, double x2, double y2)
+{
+	this->bboxFilter = true;
+	this->filterBbox[0] = x1;
+	this->filterBbox[1] = y1;
+	this->filterBbox[2] = x2;
+	this->filterBbox[3] = y2;
+}
+
+void PbfDecode::SetIdFilter(char objType, int64_t minId, int64_t maxId)
+{
+	int typeIndex = PbfTypeIndex(objType);
+	if(typeIndex < 0)
+		throw std::invalid_argument("Object type must be n, w or r");
+	this->idFilter[typeIndex] = true;
+	this->idFilterMin[typeIndex] = minId;
+	this->idFilterMax[typeIndex] = maxId;
+}
 
+void PbfDecode::ClearFilters()
+{
+	this->bboxFilter = false;
+	for(int i=0; i<3; i++)
+	{
+		this->idFilter[i] = false;
+		this->idFilterMin[i] = 0;
+		this->idFilterMax[i] = 0;
+	}
+}
+
+bool PbfDecode::DecodeNext()
+{
+	std::string headerType, blobData;
+	if(!this->ReadBlob(headerType, blobData))
+		return true;
+
+	bool halt = this->DecodeBlob(headerType, blobData);
 	if(halt) return false;
 	return true;
 }
@@ -392,11 +1190,57 @@ void PbfDecode::DecodeFinish()
 		this->output->Finish();
 }
 
-bool PbfDecode::DecodeOsmData(std::string &decBlob)
+void PbfDecode::SeekToBlob(uint64_t offset)
+{
+	this->handle.clear();
+	this->handle.seekg(offset);
+	if(this->handle.fail())
+		throw std::runtime_error("Failed to seek to pbf blob");
+	this->prevObjType.clear();
+}
+
+void PbfDecode::BuildIndex(std::vector<class PbfIndexEntry> &out, uint64_t *dataSize)
+{
+	out.clear();
+	std::streampos start = this->handle.tellg();
+	if(start < 0)
+		throw std::runtime_error("pbf stream is not seekable");
+
+	class PbfWireBlock block;
+	std::string headerType, blobData;
+	while(this->handle.peek() != std::char_traits<char>::eof())
+	{
+		class PbfIndexEntry entry;
+		entry.offset = this->handle.tellg();
+		this->ReadBlob(headerType, blobData, false);
+		entry.blobType = headerType;
+
+		OSMPBF::Blob blob;
+		if(!blob.ParseFromString(blobData))
+			throw runtime_error("Error decoding PBF Blob");
+		if(blob.has_raw_size())
+			entry.rawSize = blob.raw_size();
+		else if(blob.has_raw())
+			entry.rawSize = blob.raw().size();
+
+		if(headerType == "OSMData")
+		{
+			const std::string *decBlob = InflateBlob(blob, this->codec, this->lzmaCodec, this->decBuff);
+			IndexWireBlock(*decBlob, block, entry);
+		}
+		out.push_back(entry);
+	}
+
+	this->handle.clear();
+	if(dataSize != nullptr)
+		*dataSize = this->handle.tellg();
+	this->handle.seekg(start);
+}
+
+bool PbfDecodeBase::DecodeOsmData(const std::string &decBlob)
 {
 	OSMPBF::PrimitiveBlock pb;
-	std::istringstream iss(decBlob);
-	bool ok = pb.ParseFromIstream(&iss);
+	bool ok = pb.ParseFromString(decBlob);
 	if(!ok)
 		throw runtime_error("Error decoding PBF PrimitiveBlock");
 
@@ -417,7 +1261,7 @@ bool PbfDecode::DecodeOsmData(std::string &decBlob)
 	if(pb.has_lon_offset())
 		lon_offset = pb.lon_offset();
 	if(pb.has_date_granularity())
-		lon_offset = pb.date_granularity();
+		date_granularity = pb.date_granularity();
 
 	int pbs = pb.primitivegroup_size();
 	for(int i=0; i<pbs; i++)
@@ -425,145 +1269,745 @@ bool PbfDecode::DecodeOsmData(std::string &decBlob)
 		bool halt = false;
 		const OSMPBF::PrimitiveGroup& pg = pb.primitivegroup(i);
 
-		if(pg.nodes_size() > 0)
-		{
-			halt |= CheckOutputType("n");
-			halt |= DecodeOsmNodes(pg, lat_offset, lon_offset,
-				granularity, date_granularity,
-				stringTab, this->output);	
-		}
+		//Groups hold a single object type, so unwanted groups are skipped whole
+		if(pg.nodes_size() > 0 and (this->decodeMask & DecodeNodes))
+		{
+			halt |= CheckOutputType("n");
+			halt |= DecodeOsmNodes(pg, lat_offset, lon_offset,
+				granularity, date_granularity,
+				stringTab, this->output);	
+		}
+
+		if(pg.has_dense() and (this->decodeMask & DecodeNodes))
+		{
+			halt |= CheckOutputType("n");
+			const OSMPBF::DenseNodes &dense = pg.dense();
+			halt |= DecodeOsmDenseNodes(dense, lat_offset, lon_offset,
+				granularity, date_granularity,
+				stringTab, this->output);
+		}
+
+		if(pg.ways_size() > 0 and (this->decodeMask & DecodeWays))
+		{
+			halt |= CheckOutputType("w");
+			halt |= DecodeOsmWays(pg, date_granularity,
+				stringTab, this->output);
+		}
+
+		if(pg.relations_size() > 0 and (this->decodeMask & DecodeRelations))
+		{
+			halt |= CheckOutputType("r");
+			halt |= DecodeOsmRelations(pg, date_granularity,
+				stringTab, this->output);
+		}
+
+		//Changeset decoding not supported
+
+		if(halt)
+			return true;
+	}
+	return false;
+}
+
+bool PbfDecodeBase::DecodeOsmDataWire(const std::string &decBlob)
+{
+	class PbfWireBlock &block = this->wireBlock;
+	block.Parse((const uint8_t *)decBlob.data(), decBlob.size());
+
+	for(size_t i=0; i<block.groups.size(); i++)
+	{
+		bool halt = false;
+		const PbfWireSpan &group = block.groups[i];
+
+		//Find the object types in the group
+		bool hasNodes = false, hasDense = false, hasWays = false, hasRelations = false;
+		PbfWireReader pg(group);
+		uint32_t field, wireType;
+		while(pg.Next(field, wireType))
+		{
+			hasNodes |= field == 1;
+			hasDense |= field == 2;
+			hasWays |= field == 3;
+			hasRelations |= field == 4;
+			pg.Skip(wireType);
+		}
+
+		//Groups hold a single object type, so unwanted groups are skipped whole
+		if(hasNodes and (this->decodeMask & DecodeNodes))
+		{
+			halt |= CheckOutputType("n");
+			DecodeWireGroupField(group, 1, block, this->output);
+		}
+
+		if(hasDense and (this->decodeMask & DecodeNodes))
+		{
+			halt |= CheckOutputType("n");
+			DecodeWireGroupField(group, 2, block, this->output);
+		}
+
+		if(hasWays and (this->decodeMask & DecodeWays))
+		{
+			halt |= CheckOutputType("w");
+			DecodeWireGroupField(group, 3, block, this->output);
+		}
+
+		if(hasRelations and (this->decodeMask & DecodeRelations))
+		{
+			halt |= CheckOutputType("r");
+			DecodeWireGroupField(group, 4, block, this->output);
+		}
+
+		if(halt)
+			return true;
+	}
+	return false;
+}
+
+bool PbfDecodeBase::CheckOutputType(const char *objType)
+{
+	//Some encoders need to know when we switch object type
+	bool halt = false;
+	if(prevObjType != objType and prevObjType.length() > 0)		
+		if(output)
+		{
+			halt |= output->Sync();
+			halt |= output->Reset();
+		}
+
+	prevObjType = objType;
+	return halt;
+}
+
+// ******** Parallel PBF decoder *************
+
+///A blob read from the stream, decoded to events by a worker thread
+class PbfBlobJob
+{
+public:
+	std::string headerType, blobData;
+	class OsmEventBuffer events;
+	std::string firstObjType, lastObjType;
+	bool done, halted;
+	std::string error;
+
+	PbfBlobJob() : done(false), halted(false) {};
+};
+
+///Decoder state owned by a single worker thread
+class PbfBlobDecode : public PbfDecodeBase
+{
+public:
+	PbfBlobDecode() : PbfDecodeBase() {};
+	virtual ~PbfBlobDecode()
+	{
+		this->output = nullptr;
+	};
+
+	bool DecodeNext() {return false;};
+
+	void DecodeJob(class PbfBlobJob &job)
+	{
+		//Changes of object type within the blob are found here. Changes between
+		//blobs are handled when the events are delivered.
+		this->prevObjType.clear();
+		this->output = &job.events;
+		job.halted = this->DecodeBlob(job.headerType, job.blobData);
+		this->output = nullptr;
+
+		job.blobData.clear();
+		job.blobData.shrink_to_fit();
+		job.lastObjType = this->prevObjType;
+		for(size_t i=0; i<job.events.events.size() && job.firstObjType.empty(); i++)
+		{
+			switch(job.events.events[i])
+			{
+			case OsmEventBuffer::EventNode:
+				job.firstObjType = "n";
+				break;
+			case OsmEventBuffer::EventWay:
+				job.firstObjType = "w";
+				break;
+			case OsmEventBuffer::EventRelation:
+				job.firstObjType = "r";
+				break;
+			default:
+				break;
+			}
+		}
+	}
+};
+
+PbfDecodeParallel::PbfDecodeParallel(std::streambuf &handleIn, unsigned numThreads):
+	PbfDecode(handleIn),
+	stopWorkers(false),
+	workersStarted(false),
+	readerDone(false),
+	numThreads(numThreads),
+	reorderWindow(0)
+{
+
+}
+
+PbfDecodeParallel::~PbfDecodeParallel()
+{
+	this->StopWorkers();
+}
+
+void PbfDecodeParallel::StartWorkers()
+{
+	this->workersStarted = true;
+	unsigned threadCount = this->numThreads;
+	if(threadCount == 0)
+		threadCount = std::thread::hardware_concurrency();
+	if(threadCount == 0)
+		threadCount = 2;
+	if(this->reorderWindow == 0)
+		this->reorderWindow = threadCount * 2;
+	if(threadCount < 2)
+		return;
+
+	for(unsigned i=0; i<threadCount; i++)
+		this->workers.push_back(std::thread(&PbfDecodeParallel::WorkerLoop, this));
+	this->reader = std::thread(&PbfDecodeParallel::ReaderLoop, this);
+}
+
+void PbfDecodeParallel::StopWorkers()
+{
+	{
+		std::lock_guard<std::mutex> lock(this->jobLock);
+		this->stopWorkers = true;
+	}
+	this->workAvailable.notify_all();
+	this->spaceAvailable.notify_all();
+	if(this->reader.joinable())
+		this->reader.join();
+	for(size_t i=0; i<this->workers.size(); i++)
+		this->workers[i].join();
+	this->workers.clear();
+	this->pending.clear();
+	this->inFlight.clear();
+}
+
+void PbfDecodeParallel::ReaderLoop()
+{
+	try
+	{
+		while(this->handle.peek() != std::char_traits<char>::eof())
+		{
+			{
+				std::unique_lock<std::mutex> lock(this->jobLock);
+				this->spaceAvailable.wait(lock, [this]{return this->stopWorkers || this->inFlight.size() < this->reorderWindow;});
+				if(this->stopWorkers)
+					break;
+			}
+
+			std::shared_ptr<class PbfBlobJob> job = make_shared<class PbfBlobJob>();
+			if(!this->ReadBlob(job->headerType, job->blobData))
+				continue;
+
+			{
+				std::lock_guard<std::mutex> lock(this->jobLock);
+				this->inFlight.push_back(job);
+				this->pending.push_back(job);
+			}
+			this->workAvailable.notify_one();
+		}
+	}
+	catch(std::exception &err)
+	{
+		std::lock_guard<std::mutex> lock(this->jobLock);
+		this->readerError = err.what();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(this->jobLock);
+		this->readerDone = true;
+	}
+	this->workDone.notify_all();
+}
+
+void PbfDecodeParallel::WorkerLoop()
+{
+	class PbfBlobDecode dec;
+	while(true)
+	{
+		std::shared_ptr<class PbfBlobJob> job;
+		{
+			std::unique_lock<std::mutex> lock(this->jobLock);
+			this->workAvailable.wait(lock, [this]{return this->stopWorkers || !this->pending.empty();});
+			if(this->stopWorkers)
+				return;
+			job = this->pending.front();
+			this->pending.pop_front();
+		}
+		dec.decodeMask = this->decodeMask;
+		dec.useWireParser = this->useWireParser;
+
+		try
+		{
+			dec.DecodeJob(*job);
+		}
+		catch(std::exception &err)
+		{
+			job->error = err.what();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(this->jobLock);
+			job->done = true;
+		}
+		this->workDone.notify_all();
+	}
+}
+
+bool PbfDecodeParallel::DecodeNext()
+{
+	if(!this->workersStarted)
+		this->StartWorkers();
+	if(this->workers.empty())
+		return PbfDecode::DecodeNext(); //Single thread, so decode in place without buffering
+
+	std::shared_ptr<class PbfBlobJob> job;
+	{
+		std::unique_lock<std::mutex> lock(this->jobLock);
+		this->workDone.wait(lock, [this]{return (!this->inFlight.empty() && this->inFlight.front()->done) 
+			|| (this->inFlight.empty() && this->readerDone);});
+		if(this->inFlight.empty())
+		{
+			if(!this->readerError.empty())
+				throw std::runtime_error(this->readerError);
+			return true;
+		}
+		job = this->inFlight.front();
+		this->inFlight.pop_front();
+	}
+	this->spaceAvailable.notify_one();
+
+	if(!job->error.empty())
+		throw std::runtime_error(job->error);
+
+	bool halt = job->halted;
+	if(!job->firstObjType.empty())
+		halt |= this->CheckOutputType(job->firstObjType.c_str());
+	if(this->output != nullptr)
+		halt |= job->events.Replay(*this->output);
+	if(!job->lastObjType.empty())
+		this->prevObjType = job->lastObjType;
+	return !halt;
+}
+
+void PbfDecodeParallel::SeekToBlob(uint64_t offset)
+{
+	//Abandon blobs read from the old position. The pipeline restarts on the next DecodeNext.
+	this->StopWorkers();
+	this->stopWorkers = false;
+	this->workersStarted = false;
+	this->readerDone = false;
+	this->readerError.clear();
+	PbfDecode::SeekToBlob(offset);
+}
+
+void PbfDecodeParallel::DecodeFinish()
+{
+	this->StopWorkers();
+	PbfDecode::DecodeFinish();
+}
+
+bool PbfDecodeParallel::AtEnd()
+{
+	if(!this->workersStarted)
+		this->StartWorkers();
+	if(this->workers.empty())
+		return this->handle.peek() == std::char_traits<char>::eof();
+
+	std::lock_guard<std::mutex> lock(this->jobLock);
+	return this->readerDone && this->inFlight.empty() && this->readerError.empty();
+}
+
+// *******************************************
+
+
+///Metadata fields that differ from their defaults. Fields that are default for every object in
+///a group are left out, as readers assume the default when a field is absent.
+class PbfInfoFields
+{
+public:
+	bool version, timestamp, changeset, uid, user, hidden;
+
+	PbfInfoFields() : version(false), timestamp(false), changeset(false), uid(false), user(false), hidden(false) {};
+
+	void Add(const class MetaData &metaData)
+	{
+		version |= metaData.version != 0;
+		timestamp |= metaData.timestamp != 0;
+		changeset |= metaData.changeset != 0;
+		uid |= metaData.uid != 0;
+		user |= metaData.username.size() > 0;
+		hidden |= !metaData.visible;
+	}
+
+	bool Any() const
+	{
+		return version or timestamp or changeset or uid or user or hidden;
+	}
+};
+
+///Set the Info of a Way or Relation, or leave it out if all fields are default
+template<class T> static void EncodePbfInfo(const class MetaData &metaData, int32_t userSid, 
+	int32_t date_granularity, bool encodeHistorical, T *obj)
+{
+	class PbfInfoFields fields;
+	fields.Add(metaData);
+	if(!encodeHistorical)
+		fields.hidden = false;
+	if(!fields.Any())
+		return;
+
+	//Version is always set because its protobuf default is -1
+	OSMPBF::Info *info = obj->mutable_info();
+	info->set_version(metaData.version);
+	if(fields.timestamp)
+		info->set_timestamp(metaData.timestamp * 1000 / date_granularity);
+	if(fields.changeset)
+		info->set_changeset(metaData.changeset);
+	if(fields.uid)
+		info->set_uid(metaData.uid);
+	if(fields.user)
+		info->set_user_sid(userSid);
+	if(encodeHistorical)
+		info->set_visible(metaData.visible);
+}
+
+static size_t PbfVarintSize(uint64_t val)
+{
+	size_t len = 1;
+	while(val >= 0x80)
+	{
+		val >>= 7;
+		len ++;
+	}
+	return len;
+}
+
+///Size of an int32 or int64 field, which takes ten bytes if negative
+static size_t PbfIntSize(int64_t val)
+{
+	return val < 0 ? 10 : PbfVarintSize(val);
+}
+
+static size_t PbfZigzagSize(int64_t val)
+{
+	return PbfVarintSize(((uint64_t)val << 1) ^ (uint64_t)(val >> 63));
+}
+
+///Chooses the objects for one PrimitiveBlock. Objects are added in order while keeping an upper
+///bound on the serialized block size, and are refused once the next would take the block over
+///the size limit. The strings are interned at the same time to build the string table, and
+///each string reference is recorded per object in the order the encoder uses them, so the
+///encoder does not look strings up again.
+class PbfBlockBuilder
+{
+protected:
+	size_t sizeLimit, maxGroupObjects;
+	bool encodeMetaData, encodeHistorical;
+	int32_t granularity, date_granularity;
+	int64_t lat_offset, lon_offset;
+
+	std::unordered_map<std::string, uint32_t> strIds; //Interned strings, numbered as first seen
+	std::vector<const std::string *> strs; //Keys of strIds by number
+	std::vector<uint32_t> strFreq;
+	std::vector<uint32_t> refs; //Interned string of each reference, in encoding order
+	std::vector<int32_t> tableIndex; //String table position of each interned string
+	std::vector<size_t> objRefStarts; //Position in refs of the first reference of each object
+	size_t refPos, refEnd; //References of the object being encoded
+	size_t objStrs, objRefs; //Sizes before the object being added
+	size_t fixedBytes, stringBytes;
+	size_t plainRefs, zigzagRefs; //String indices, which are not known until the table is sorted
+
+	//Dense nodes are delta coded within each group
+	int64_t idc, latc, lonc, timestampc, changesetc, uidc;
+
+	void StartObject();
+	void CountString(const std::string &str);
+	void CountTags(const TagMap &tags);
+	size_t InfoSize(const class MetaData &metaData);
+	bool Commit(size_t objBytes, size_t objPlainRefs, size_t objZigzagRefs);
+
+public:
+	PbfBlockBuilder(const class PbfEncodeBase &enc, size_t sizeLimit, size_t maxGroupObjects);
+	virtual ~PbfBlockBuilder() {};
+
+	///Each returns false, leaving the block unchanged, if the object does not fit
+	///Node positions are in nanodegrees
+	bool AddNode(const class OsmNode &n, int64_t lat, int64_t lon);
+	bool AddWay(const class OsmWay &w);
+	bool AddRelation(const class OsmRelation &r);
+
+	///Upper bound on the serialized size of the block so far
+	size_t EstimatedSize() const;
+
+	///Write the string table, most frequent strings first
+	void EncodeStringTable(OSMPBF::StringTable *st);
+	///Start encoding the strings of an object, numbered in the order it was added. Encoding an
+	///object must use exactly the references counted for it, or runtime_error is thrown.
+	void BeginObject(size_t objNum);
+	void EndObject();
+	///String table index of the next string reference, once the table is written
+	int32_t NextString()
+	{
+		if(refPos >= refEnd)
+			throw runtime_error("PBF object uses more strings than were counted");
+		return tableIndex[refs[refPos++]];
+	}
+
+	size_t count;
+};
+
+PbfBlockBuilder::PbfBlockBuilder(const class PbfEncodeBase &enc, size_t sizeLimit, size_t maxGroupObjects):
+	sizeLimit(sizeLimit), maxGroupObjects(maxGroupObjects)
+{
+	encodeMetaData = enc.encodeMetaData;
+	encodeHistorical = enc.encodeHistorical;
+	granularity = enc.granularity;
+	date_granularity = enc.date_granularity;
+	lat_offset = enc.lat_offset;
+	lon_offset = enc.lon_offset;
+	if(this->maxGroupObjects == 0)
+		this->maxGroupObjects = 1;
+
+	//Block settings, string table header and the leading empty string
+	fixedBytes = 64;
+	stringBytes = 2;
+	plainRefs = 0;
+	zigzagRefs = 0;
+	refPos = 0;
+	refEnd = 0;
+	objStrs = 0;
+	objRefs = 0;
+	idc = 0; latc = 0; lonc = 0; timestampc = 0; changesetc = 0; uidc = 0;
+	count = 0;
+}
+
+void PbfBlockBuilder::StartObject()
+{
+	objStrs = strs.size();
+	objRefs = refs.size();
+}
 
-		if(pg.has_dense())
-		{
-			halt |= CheckOutputType("n");
-			const OSMPBF::DenseNodes &dense = pg.dense();
-			halt |= DecodeOsmDenseNodes(dense, lat_offset, lon_offset,
-				granularity, date_granularity,
-				stringTab, this->output);
-		}
+void PbfBlockBuilder::CountString(const std::string &str)
+{
+	auto it = strIds.find(str);
+	if(it != strIds.end())
+	{
+		strFreq[it->second] ++;
+		refs.push_back(it->second);
+		return;
+	}
+	uint32_t id = strs.size();
+	it = strIds.emplace(str, id).first;
+	strs.push_back(&it->first);
+	strFreq.push_back(1);
+	refs.push_back(id);
+	stringBytes += 1 + PbfVarintSize(str.size()) + str.size();
+}
 
-		if(pg.ways_size() > 0)
-		{
-			halt |= CheckOutputType("w");
-			halt |= DecodeOsmWays(pg, date_granularity,
-				stringTab, this->output);
-		}
+void PbfBlockBuilder::CountTags(const TagMap &tags)
+{
+	for(auto it = tags.begin(); it != tags.end(); it++)
+	{
+		this->CountString(it->first);
+		this->CountString(it->second);
+	}
+}
 
-		if(pg.relations_size() > 0)
-		{
-			halt |= CheckOutputType("r");
-			halt |= DecodeOsmRelations(pg, date_granularity,
-				stringTab, this->output);
-		}
+size_t PbfBlockBuilder::EstimatedSize() const
+{
+	//Index 0 is the empty string, so the largest index is the number of distinct strings
+	size_t maxIndex = strs.size();
+	return fixedBytes + stringBytes + plainRefs * PbfVarintSize(maxIndex) 
+		+ zigzagRefs * PbfVarintSize(2 * maxIndex);
+}
 
-		//Changeset decoding not supported
+bool PbfBlockBuilder::Commit(size_t objBytes, size_t objPlainRefs, size_t objZigzagRefs)
+{
+	fixedBytes += objBytes;
+	plainRefs += objPlainRefs;
+	zigzagRefs += objZigzagRefs;
+	if(EstimatedSize() <= sizeLimit and strs.size() < INT32_MAX - 1000)
+	{
+		objRefStarts.push_back(objRefs);
+		count ++;
+		return true;
+	}
 
-		if(halt)
-			return true;
+	//Does not fit, so undo the object
+	fixedBytes -= objBytes;
+	plainRefs -= objPlainRefs;
+	zigzagRefs -= objZigzagRefs;
+	for(size_t i=objRefs; i<refs.size(); i++)
+		strFreq[refs[i]] --;
+	refs.resize(objRefs);
+	for(size_t i=objStrs; i<strs.size(); i++)
+	{
+		stringBytes -= 1 + PbfVarintSize(strs[i]->size()) + strs[i]->size();
+		strIds.erase(*strs[i]);
 	}
+	strs.resize(objStrs);
+	strFreq.resize(objStrs);
 	return false;
 }
 
-bool PbfDecode::CheckOutputType(const char *objType)
+size_t PbfBlockBuilder::InfoSize(const class MetaData &metaData)
 {
-	//Some encoders need to know when we switch object type
-	bool halt = false;
-	if(prevObjType != objType and prevObjType.length() > 0)		
-		if(output)
-		{
-			halt |= output->Sync();
-			halt |= output->Reset();
-		}
-
-	prevObjType = objType;
-	return halt;
+	//Info message of a way or relation, with its field keys and header
+	this->CountString(metaData.username);
+	size_t bytes = 6 + 1 + PbfIntSize((int32_t)metaData.version);
+	bytes += 1 + PbfIntSize(metaData.timestamp * 1000 / date_granularity);
+	bytes += 1 + PbfIntSize(metaData.changeset);
+	bytes += 1 + PbfIntSize((int32_t)metaData.uid);
+	bytes += 1; //user_sid key, the index is counted as a reference
+	if(encodeHistorical)
+		bytes += 2;
+	return bytes;
 }
 
-// *******************************************
+bool PbfBlockBuilder::AddNode(const class OsmNode &n, int64_t lat, int64_t lon)
+{
+	this->StartObject();
+	size_t bytes = 0;
+	if(count % maxGroupObjects == 0)
+	{
+		//New group with a DenseNodes and DenseInfo, each packed field has a key and length
+		bytes += 96;
+		idc = 0; latc = 0; lonc = 0; timestampc = 0; changesetc = 0; uidc = 0;
+	}
 
+	int64_t lati = (lat - lat_offset) / granularity;
+	int64_t loni = (lon - lon_offset) / granularity;
+	bytes += PbfZigzagSize(n.objId - idc) + PbfZigzagSize(lati - latc) + PbfZigzagSize(loni - lonc);
+	bytes += 1; //Zero ending the tags in keys_vals
+	this->CountTags(n.tags);
+	size_t objZigzagRefs = 0;
 
-void GenerateStringTable(const std::vector<const class OsmObject *> &ways, size_t startc, 
-	bool encodeMetaData, 
-	size_t &maxWaysToProcess, OSMPBF::StringTable *st, 
-	std::map<std::string, int32_t> &strIndexOut)
-{
-	std::map<std::string, std::uint32_t> strFreq;
-	size_t processed = 0;
-	for(size_t i=startc; i<startc + maxWaysToProcess; i++)
+	int64_t ts = 0;
+	if(encodeMetaData)
 	{
-		const class OsmObject &n = *(ways[i]);
-		const TagMap &tags = n.tags;
-		for(auto it = tags.begin(); it != tags.end(); it++)
-		{
-			auto it2 = strFreq.find(it->first);
-			if(it2 != strFreq.end())
-				it2->second ++;
-			else
-				strFreq[it->first] = 1;
+		ts = n.metaData.timestamp * 1000 / date_granularity;
+		bytes += PbfIntSize((int32_t)n.metaData.version);
+		bytes += PbfZigzagSize(ts - timestampc);
+		bytes += PbfZigzagSize(n.metaData.changeset - changesetc);
+		bytes += PbfZigzagSize((int64_t)n.metaData.uid - uidc);
+		this->CountString(n.metaData.username);
+		objZigzagRefs = 1;
+		if(encodeHistorical)
+			bytes += 1;
+	}
 
-			it2 = strFreq.find(it->second);
-			if(it2 != strFreq.end())
-				it2->second ++;
-			else
-				strFreq[it->second] = 1;
-		}
+	if(!this->Commit(bytes, 2 * n.tags.size(), objZigzagRefs))
+		return false;
 
-		if(encodeMetaData)
-		{
-			auto it2 = strFreq.find(n.metaData.username);
-			if(it2 != strFreq.end())
-				it2->second ++;
-			else
-				strFreq[n.metaData.username] = 1;
-		}
+	idc = n.objId;
+	latc = lati;
+	lonc = loni;
+	timestampc = ts;
+	changesetc = n.metaData.changeset;
+	uidc = n.metaData.uid;
+	return true;
+}
 
-		const class OsmRelation *rel = dynamic_cast<const class OsmRelation *>(&n);
-		if(rel != nullptr)
-		{
-			const std::vector<std::string> &refRoles = rel->refRoles;
-			for(size_t j=0; j<refRoles.size(); j++)
-			{
-				auto it2 = strFreq.find(refRoles[j]);
-				if(it2 != strFreq.end())
-					it2->second ++;
-				else
-					strFreq[refRoles[j]] = 1;
-			}
-		}
+bool PbfBlockBuilder::AddWay(const class OsmWay &w)
+{
+	this->StartObject();
+	size_t bytes = 0;
+	if(count % maxGroupObjects == 0)
+		bytes += 6;
+
+	//Way message header, id and the keys, vals and refs packed field headers
+	bytes += 6 + 1 + PbfIntSize(w.objId) + 18;
+	this->CountTags(w.tags);
+	size_t objPlainRefs = 2 * w.tags.size();
+
+	int64_t refc = 0;
+	for(size_t j=0; j<w.refs.size(); j++)
+	{
+		bytes += PbfZigzagSize(w.refs[j] - refc);
+		refc = w.refs[j];
+	}
 
-		processed = i;
-		if(strFreq.size() >= INT32_MAX - 1000)
-			break; //Stop because we have a full string table
+	if(encodeMetaData)
+	{
+		bytes += this->InfoSize(w.metaData);
+		objPlainRefs ++;
 	}
-	maxWaysToProcess = processed+1-startc;
 
-	std::map<std::uint32_t, std::vector<std::string> > strByFreq;
-	for(auto it=strFreq.begin(); it != strFreq.end(); it++)
+	return this->Commit(bytes, objPlainRefs, 0);
+}
+
+bool PbfBlockBuilder::AddRelation(const class OsmRelation &r)
+{
+	this->StartObject();
+	size_t bytes = 0;
+	if(count % maxGroupObjects == 0)
+		bytes += 6;
+
+	//Relation message header, id and the keys, vals, roles_sid, memids and types packed field headers
+	bytes += 6 + 1 + PbfIntSize(r.objId) + 30;
+	this->CountTags(r.tags);
+	size_t objPlainRefs = 2 * r.tags.size();
+
+	int64_t refc = 0;
+	for(size_t j=0; j<r.refTypeStrs.size() and j<r.refIds.size() and j<r.refRoles.size(); j++)
 	{
-		strByFreq[it->second].push_back(it->first);
+		const std::string &typeStr = r.refTypeStrs[j];
+		if(typeStr != "node" and typeStr != "way" and typeStr != "relation")
+			continue;
+		this->CountString(r.refRoles[j]);
+		objPlainRefs ++;
+		bytes += PbfZigzagSize(r.refIds[j] - refc) + 1;
+		refc = r.refIds[j];
 	}
-	vector<std::uint32_t> freqBins;
-	for(auto it = strByFreq.begin(); it != strByFreq.end(); it++)
+
+	if(encodeMetaData)
 	{
-		freqBins.push_back(it->first);
+		bytes += this->InfoSize(r.metaData);
+		objPlainRefs ++;
 	}
-	std::sort(freqBins.begin(), freqBins.end(), greater<int>()); 
+
+	return this->Commit(bytes, objPlainRefs, 0);
+}
+
+void PbfBlockBuilder::EncodeStringTable(OSMPBF::StringTable *st)
+{
+	//Most frequent first so they get short indices, ties in string order
+	std::vector<uint32_t> order(strs.size());
+	for(size_t i=0; i<order.size(); i++)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+		if(this->strFreq[a] != this->strFreq[b])
+			return this->strFreq[a] > this->strFreq[b];
+		return *this->strs[a] < *this->strs[b];
+	});
 
 	//Add strings to block
 	st->add_s(""); //First string is always empty in pbf
-	for(size_t i=0; i<freqBins.size(); i++)
+	tableIndex.resize(strs.size());
+	for(size_t i=0; i<order.size(); i++)
 	{
-		std::vector<std::string> &bin = strByFreq[freqBins[i]];
-		std::sort(bin.begin(), bin.end());
-		for(size_t j=0; j<bin.size(); j++)
-			st->add_s(bin[j]);
+		st->add_s(*strs[order[i]]);
+		tableIndex[order[i]] = i+1;
 	}
+}
 
-	//Index strings for fast lookup
-	for(int i=1; i<st->s_size(); i++)
-	{
-		strIndexOut[st->s(i)] = i;
-	}
+void PbfBlockBuilder::BeginObject(size_t objNum)
+{
+	refPos = objRefStarts.at(objNum);
+	refEnd = objNum + 1 < objRefStarts.size() ? objRefStarts[objNum + 1] : refs.size();
+}
+
+void PbfBlockBuilder::EndObject()
+{
+	if(refPos != refEnd)
+		throw runtime_error("PBF object uses fewer strings than were counted");
 }
 
 // *******************************************
@@ -575,6 +2019,9 @@ PbfEncodeBase::PbfEncodeBase()
 	maxGroupObjects = 8000;
 	headerWritten = false;
 	compressUsingZLib = true;
+	compressUsingLzma = false;
+	compressionLevel = Z_DEFAULT_COMPRESSION;
+	writeIndexData = true;
 	writingProgram = "cppo5m";
 	maxPayloadSize = 32 * 1024 * 1024;
 	maxHeaderSize = 64 * 1024;
@@ -622,6 +2069,21 @@ bool PbfEncodeBase::StoreBounds(double x1, double y1, double x2, double y2)
 
 bool PbfEncodeBase::StoreNode(int64_t objId, const class MetaData &metaData, 
 	const TagMap &tags, double lat, double lon)
+{
+	this->BufferNode(objId, metaData, tags, lat, lon, std::round(lat / 1e-9), std::round(lon / 1e-9));
+	return false;
+}
+
+bool PbfEncodeBase::StoreNodeFixed(int64_t objId, const class MetaData &metaData, 
+	const TagMap &tags, int64_t lat, int64_t lon)
+{
+	//Positions are encoded in nanodegrees, so this is exact
+	this->BufferNode(objId, metaData, tags, lat / 1e7, lon / 1e7, lat * 100, lon * 100);
+	return false;
+}
+
+void PbfEncodeBase::BufferNode(int64_t objId, const class MetaData &metaData, 
+	const TagMap &tags, double lat, double lon, int64_t nanoLat, int64_t nanoLon)
 {
 	if(prevObjType != "n" and prevObjType.size() > 0)
 		this->EncodeBuffer();
@@ -630,9 +2092,10 @@ bool PbfEncodeBase::StoreNode(int64_t objId, const class MetaData &metaData,
 		this->EncodeBuffer();
 
 	buffer.StoreNode(objId, metaData, tags, lat, lon);
+	nodeLats.push_back(nanoLat);
+	nodeLons.push_back(nanoLon);
 
 	prevObjType = "n";
-	return false;
 }
 
 bool PbfEncodeBase::StoreWay(int64_t objId, const class MetaData &metaData, 
@@ -674,7 +2137,8 @@ void PbfEncodeBase::operator<< (const std::string &val)
 
 }
 
-void PbfEncodeBase::WriteBlobPayload(const std::string &blobPayload, const char *type)
+void PbfEncodeBase::WriteBlobPayload(const std::string &blobPayload, const char *type, 
+	const std::string &indexData)
 {
 	//cout << type << "," << blobPayload.size() << endl;
 	if(blobPayload.size() > this->maxPayloadSize)
@@ -682,8 +2146,10 @@ void PbfEncodeBase::WriteBlobPayload(const std::string &blobPayload, const char
 
 	OSMPBF::Blob blob;
 	blob.set_raw_size(blobPayload.size());
-	if(this->compressUsingZLib)
-		blob.set_zlib_data(CompressData(blobPayload));
+	if(this->compressUsingLzma)
+		this->lzmaCodec.Compress(blobPayload.data(), blobPayload.size(), *blob.mutable_lzma_data(), this->compressionLevel);
+	else if(this->compressUsingZLib)
+		this->codec.Compress(blobPayload.data(), blobPayload.size(), *blob.mutable_zlib_data(), this->compressionLevel);
 	else
 		blob.set_raw(blobPayload);
 	std::string packedBlob;
@@ -691,6 +2157,8 @@ void PbfEncodeBase::WriteBlobPayload(const std::string &blobPayload, const char
 
 	OSMPBF::BlobHeader header;
 	header.set_type(type);
+	if(indexData.size() > 0)
+		header.set_indexdata(indexData);
 	header.set_datasize(packedBlob.size());
 	std::string packedHeader;
 	header.SerializeToString(&packedHeader);
@@ -701,15 +2169,19 @@ void PbfEncodeBase::WriteBlobPayload(const std::string &blobPayload, const char
 	this->write (packedBlob.c_str(), packedBlob.size());
 }
 
+void PbfEncodeBase::WriteHeader()
+{
+	if(headerWritten)
+		return;
+	std::string hbEncoded;
+	this->EncodeHeaderBlock(hbEncoded);
+	this->WriteBlobPayload(hbEncoded, "OSMHeader");
+	this->headerWritten = true;
+}
+
 void PbfEncodeBase::EncodeBuffer()
 {
-	if(!headerWritten)
-	{
-		std::string hbEncoded;
-		this->EncodeHeaderBlock(hbEncoded);
-		this->WriteBlobPayload(hbEncoded, "OSMHeader");
-		this->headerWritten = true;
-	}
+	this->WriteHeader();
 
 	int countTypes = 0;
 	countTypes += this->buffer.nodes.size() > 0;
@@ -723,14 +2195,22 @@ void PbfEncodeBase::EncodeBuffer()
 		errStr += " On a deep level, I know I'm not up to this task. I'm so sorry.";
 		throw logic_error(errStr);
 	}
+	class PbfBlobSummary summary;
+	std::string indexData;
 	if(this->buffer.nodes.size() > 0)
 	{
 		std::string denseNodes;
 		size_t nodesc = 0;
 		while(nodesc < this->buffer.nodes.size())
 		{
-			EncodePbfDenseNodesSizeLimited(this->buffer.nodes, nodesc, denseNodes);
-			this->WriteBlobPayload(denseNodes, "OSMData");
+			size_t startc = nodesc;
+			EncodePbfDenseNodes(this->buffer.nodes, this->nodeLats, this->nodeLons, nodesc, denseNodes);
+			if(this->writeIndexData)
+			{
+				SummariseNodeBlob(this->buffer.nodes, startc, nodesc, summary);
+				summary.Encode(indexData);
+			}
+			this->WriteBlobPayload(denseNodes, "OSMData", indexData);
 		}
 	}
 
@@ -740,8 +2220,14 @@ void PbfEncodeBase::EncodeBuffer()
 		size_t wayc = 0;
 		while(wayc < this->buffer.ways.size())
 		{
-			EncodePbfWaysSizeLimited(this->buffer.ways, wayc, waysPacked);
-			this->WriteBlobPayload(waysPacked, "OSMData");
+			size_t startc = wayc;
+			EncodePbfWays(this->buffer.ways, wayc, waysPacked);
+			if(this->writeIndexData)
+			{
+				SummariseBlob('w', this->buffer.ways, startc, wayc, summary);
+				summary.Encode(indexData);
+			}
+			this->WriteBlobPayload(waysPacked, "OSMData", indexData);
 		}
 	}
 
@@ -751,12 +2237,20 @@ void PbfEncodeBase::EncodeBuffer()
 		size_t relc = 0;
 		while(relc < this->buffer.relations.size())
 		{
-			EncodePbfRelationsSizeLimited(this->buffer.relations, relc, relsPacked);
-			this->WriteBlobPayload(relsPacked, "OSMData");
+			size_t startc = relc;
+			EncodePbfRelations(this->buffer.relations, relc, relsPacked);
+			if(this->writeIndexData)
+			{
+				SummariseBlob('r', this->buffer.relations, startc, relc, summary);
+				summary.Encode(indexData);
+			}
+			this->WriteBlobPayload(relsPacked, "OSMData", indexData);
 		}
 	}
 
 	this->buffer.Clear();
+	this->nodeLats.clear();
+	this->nodeLons.clear();
 }
 
 void PbfEncodeBase::EncodeHeaderBlock(std::string &out)
@@ -786,17 +2280,20 @@ void PbfEncodeBase::EncodeHeaderBlock(std::string &out)
 		throw runtime_error("HeaderBlock size exceeds what PBF allows");
 }
 
-void PbfEncodeBase::EncodePbfDenseNodes(const std::vector<class OsmNode> &nodes, size_t &nodec, 
-	size_t maxNodesToProcess, 
-	std::string &out)
+void PbfEncodeBase::EncodePbfDenseNodes(const std::vector<class OsmNode> &nodes, 
+	const std::vector<int64_t> &lats, const std::vector<int64_t> &lons, size_t &nodec, std::string &out)
 {
-	//Create string table
-	size_t nodesRemaining = nodes.size()-nodec;
-	if(maxNodesToProcess > nodesRemaining)
-		maxNodesToProcess = nodesRemaining;
-	if(maxNodesToProcess > this->optimalDenseNodes)
-		maxNodesToProcess = this->optimalDenseNodes;
+	//Choose the nodes that fit in the block
 	const size_t startNodec = nodec;
+	class PbfBlockBuilder builder(*this, this->maxPayloadSize, this->maxGroupObjects);
+	while(startNodec + builder.count < nodes.size() and builder.count < this->optimalDenseNodes)
+	{
+		size_t i = startNodec + builder.count;
+		if(!builder.AddNode(nodes[i], lats[i], lons[i]))
+			break;
+	}
+	if(builder.count == 0)
+		throw runtime_error("Failed to encode nodes without breaking maxPayloadSize limit");
 
 	OSMPBF::PrimitiveBlock pb;
 	pb.set_granularity(this->granularity);
@@ -806,30 +2303,33 @@ void PbfEncodeBase::EncodePbfDenseNodes(const std::vector<class OsmNode> &nodes,
 
 	OSMPBF::StringTable *st = pb.mutable_stringtable();
 
-	std::vector<const class OsmObject *> nodePtrs;
-	for(size_t i=0; i<nodes.size(); i++)
-		nodePtrs.push_back(&nodes[i]);
-	std::map<std::string, int32_t> strIndex;
-
-	GenerateStringTable(nodePtrs, nodec, this->encodeMetaData,
-		maxNodesToProcess, st, 
-		strIndex);
+	builder.EncodeStringTable(st);
 
 	//Write nodes in groups
-	size_t stopIndex = startNodec+maxNodesToProcess;
+	size_t stopIndex = startNodec+builder.count;
 	while(nodec < stopIndex)
 	{
 		size_t nodesInGroup = stopIndex - nodec;
 		if(nodesInGroup > maxGroupObjects)
 			 nodesInGroup = maxGroupObjects;
 
-		//Check if all tags are empty
-		//TODO
+		//keys_vals may be left out if no node in the group has tags, as can DenseInfo columns
+		//that are default for every node
+		bool hasTags = false;
+		class PbfInfoFields fields;
+		for(size_t i=nodec; i<nodec+nodesInGroup; i++)
+		{
+			hasTags |= nodes[i].tags.size() > 0;
+			if(this->encodeMetaData)
+				fields.Add(nodes[i].metaData);
+		}
+		if(!this->encodeHistorical)
+			fields.hidden = false;
 
 		OSMPBF::PrimitiveGroup *pg = pb.add_primitivegroup();
 		OSMPBF::DenseNodes *dn = pg->mutable_dense();
 		OSMPBF::DenseInfo *di = nullptr; 
-		if(this->encodeMetaData)
+		if(fields.Any())
 			di = dn->mutable_denseinfo();
 
 		int64_t idc = 0, latc = 0, lonc = 0, timestampc = 0, changesetc = 0;
@@ -837,39 +2337,57 @@ void PbfEncodeBase::EncodePbfDenseNodes(const std::vector<class OsmNode> &nodes,
 		for(size_t i=nodec; i<nodec+nodesInGroup; i++)
 		{
 			const class OsmNode &n = nodes[i];
+			builder.BeginObject(i - startNodec);
 			dn->add_id(n.objId-idc);
 			idc = n.objId;
-			int64_t lati = std::round((n.lat / 1e-9) - lat_offset) / granularity;
+			int64_t lati = (lats[i] - lat_offset) / granularity;
 			dn->add_lat(lati - latc);
 			latc = lati;
-			int64_t loni = std::round((n.lon / 1e-9) - lon_offset) / granularity;
+			int64_t loni = (lons[i] - lon_offset) / granularity;
 			dn->add_lon(loni - lonc);
 			lonc = loni;
 
 			const TagMap &tags = n.tags;
 			for(auto it = tags.begin(); it != tags.end(); it++)
 			{
-				dn->add_keys_vals(strIndex[it->first]);
-				dn->add_keys_vals(strIndex[it->second]);
+				dn->add_keys_vals(builder.NextString());
+				dn->add_keys_vals(builder.NextString());
 			}
-			dn->add_keys_vals(0);
+			if(hasTags)
+				dn->add_keys_vals(0);
 
-			if(this->encodeMetaData)
+			if(di != nullptr)
 			{
-				di->add_version(n.metaData.version);
-				int64_t ts = n.metaData.timestamp * 1000 / date_granularity;
-				di->add_timestamp(ts - timestampc);
-				timestampc = ts;
-				di->add_changeset(n.metaData.changeset - changesetc);
-				changesetc = n.metaData.changeset;
-				di->add_uid(n.metaData.uid - uidc);
-				int32_t si = strIndex[n.metaData.username];
-				di->add_user_sid(si-user_sidc);
-				user_sidc = si;
-
-				if(this->encodeHistorical)
+				int32_t si = builder.NextString();
+				if(fields.version)
+					di->add_version(n.metaData.version);
+				if(fields.timestamp)
+				{
+					int64_t ts = n.metaData.timestamp * 1000 / date_granularity;
+					di->add_timestamp(ts - timestampc);
+					timestampc = ts;
+				}
+				if(fields.changeset)
+				{
+					di->add_changeset(n.metaData.changeset - changesetc);
+					changesetc = n.metaData.changeset;
+				}
+				if(fields.uid)
+				{
+					di->add_uid(n.metaData.uid - uidc);
+					uidc = n.metaData.uid;
+				}
+				if(fields.user)
+				{
+					di->add_user_sid(si-user_sidc);
+					user_sidc = si;
+				}
+				if(fields.hidden)
 					di->add_visible(n.metaData.visible);
 			}
+			else if(this->encodeMetaData)
+				builder.NextString(); //Username is not written
+			builder.EndObject();
 		}
 
 		nodec += nodesInGroup;
@@ -878,60 +2396,34 @@ void PbfEncodeBase::EncodePbfDenseNodes(const std::vector<class OsmNode> &nodes,
 	pb.SerializeToString(&out);
 }
 
-void PbfEncodeBase::EncodePbfDenseNodesSizeLimited(const std::vector<class OsmNode> &nodes, size_t &nodec, std::string &out)
+void PbfEncodeBase::EncodePbfWays(const std::vector<class OsmWay> &ways, size_t &wayc, std::string &out)
 {
-	const size_t startNodec = nodec;
-	uint32_t objLimit = this->optimalDenseNodes;
-	this->EncodePbfDenseNodes(nodes, nodec, objLimit, out);
-
-	while(out.size() > maxPayloadSize)
+	//Choose the ways that fit in the block
+	const size_t startWayc = wayc;
+	class PbfBlockBuilder builder(*this, this->maxPayloadSize, this->maxGroupObjects);
+	while(startWayc + builder.count < ways.size() and builder.count < this->optimalWays)
 	{
-		//Payload is too big, so we need to re-encode by limiting number of groups
-		objLimit /= 2;
-		nodec = startNodec;
-		this->EncodePbfDenseNodes(nodes, nodec, objLimit, out);
-
-		if(out.size() > maxPayloadSize and objLimit <= 1)
-			throw runtime_error("Failed to encode nodes without breaking maxPayloadSize limit");
+		if(!builder.AddWay(ways[startWayc + builder.count]))
+			break;
 	}
-}
-
-void PbfEncodeBase::EncodePbfWays(const std::vector<class OsmWay> &ways, size_t &wayc, size_t maxWaysToProcess, 
-	std::string &out)
-{
-	//Create string table
-	size_t waysRemaining = ways.size()-wayc;
-	if(maxWaysToProcess > waysRemaining)
-		maxWaysToProcess = waysRemaining;
-	if(maxWaysToProcess > this->optimalWays)
-		maxWaysToProcess = this->optimalWays;
-	const size_t startWayc = wayc;
+	if(builder.count == 0)
+		throw runtime_error("Failed to encode ways without breaking maxPayloadSize limit");
 
 	OSMPBF::PrimitiveBlock pb;
 	pb.set_date_granularity(this->date_granularity);
 
 	OSMPBF::StringTable *st = pb.mutable_stringtable();
 
-	std::vector<const class OsmObject *> wayPtrs;
-	for(size_t i=0; i<ways.size(); i++)
-		wayPtrs.push_back(&ways[i]);
-	std::map<std::string, int32_t> strIndex;
-
-	GenerateStringTable(wayPtrs, wayc, this->encodeMetaData,
-		maxWaysToProcess, st, 
-		strIndex);
+	builder.EncodeStringTable(st);
 	
 	//Write ways in groups
-	size_t stopIndex = startWayc+maxWaysToProcess;
+	size_t stopIndex = startWayc+builder.count;
 	while(wayc < stopIndex)
 	{
 		size_t waysInGroup = stopIndex - wayc;
 		if(waysInGroup > maxGroupObjects)
 			 waysInGroup = maxGroupObjects;
 
-		//Check if all tags are empty
-		//TODO
-
 		OSMPBF::PrimitiveGroup *pg = pb.add_primitivegroup();
 
 		for(size_t i=wayc; i<wayc+waysInGroup; i++)
@@ -940,11 +2432,12 @@ void PbfEncodeBase::EncodePbfWays(const std::vector<class OsmWay> &ways, size_t
 
 			const class OsmWay &w = ways[i];
 			const TagMap &tags = w.tags;
+			builder.BeginObject(i - startWayc);
 			ow->set_id(w.objId);
 			for(auto it = tags.begin(); it != tags.end(); it++)
 			{
-				ow->add_keys(strIndex[it->first]);
-				ow->add_vals(strIndex[it->second]);
+				ow->add_keys(builder.NextString());
+				ow->add_vals(builder.NextString());
 			}
 
 			int64_t refc = 0;
@@ -955,18 +2448,8 @@ void PbfEncodeBase::EncodePbfWays(const std::vector<class OsmWay> &ways, size_t
 			}
 
 			if(this->encodeMetaData)
-			{
-				OSMPBF::Info *info = ow->mutable_info();
-
-				info->set_version(w.metaData.version);
-				info->set_timestamp(w.metaData.timestamp * 1000 / date_granularity);
-				info->set_changeset(w.metaData.changeset);
-				info->set_uid(w.metaData.uid);
-				info->set_user_sid(strIndex[w.metaData.username]);
-
-				if(this->encodeHistorical)
-					info->set_visible(w.metaData.visible);
-			}
+				EncodePbfInfo(w.metaData, builder.NextString(), date_granularity, this->encodeHistorical, ow);
+			builder.EndObject();
 		}
 
 		wayc += waysInGroup;
@@ -975,61 +2458,36 @@ void PbfEncodeBase::EncodePbfWays(const std::vector<class OsmWay> &ways, size_t
 	pb.SerializeToString(&out);
 }
 
-void PbfEncodeBase::EncodePbfWaysSizeLimited(const std::vector<class OsmWay> &ways, size_t &wayc, std::string &out)
-{
-	const size_t startWayc = wayc;
-	uint32_t objLimit = this->optimalWays;
-	this->EncodePbfWays(ways, wayc, objLimit, out);
-
-	while(out.size() > maxPayloadSize)
-	{
-		//Payload is too big, so we need to re-encode by limiting number of groups
-		objLimit /= 2;
-		wayc = startWayc;
-		this->EncodePbfWays(ways, wayc, objLimit, out);
-
-		if(out.size() > maxPayloadSize and objLimit <= 1)
-			throw runtime_error("Failed to encode ways without breaking maxPayloadSize limit");
-	}
-}
-
-void PbfEncodeBase::EncodePbfRelations(const std::vector<class OsmRelation> &relations, size_t &relationc, size_t maxRelationsToProcess, 
+void PbfEncodeBase::EncodePbfRelations(const std::vector<class OsmRelation> &relations, size_t &relationc, 
 	std::string &out)
 {
-	//Create string table
-	size_t relationsRemain = relations.size()-relationc;
-	if(maxRelationsToProcess > relationsRemain)
-		maxRelationsToProcess = relationsRemain;
-	if(maxRelationsToProcess > this->optimalRelations)
-		maxRelationsToProcess = this->optimalRelations;
+	//Choose the relations that fit in the block
 	const size_t startRelationc = relationc;
+	class PbfBlockBuilder builder(*this, this->maxPayloadSize, this->maxGroupObjects);
+	while(startRelationc + builder.count < relations.size() and builder.count < this->optimalRelations)
+	{
+		if(!builder.AddRelation(relations[startRelationc + builder.count]))
+			break;
+	}
+	if(builder.count == 0)
+		throw runtime_error("Failed to encode relations without breaking maxPayloadSize limit");
 
 	OSMPBF::PrimitiveBlock pb;
 	pb.set_date_granularity(this->date_granularity);
 
 	OSMPBF::StringTable *st = pb.mutable_stringtable();
 
-	std::vector<const class OsmObject *> relPtrs;
-	for(size_t i=0; i<relations.size(); i++)
-		relPtrs.push_back(&relations[i]);
-	std::map<std::string, int32_t> strIndex;
-
-	GenerateStringTable(relPtrs, relationc, this->encodeMetaData,
-		maxRelationsToProcess, st, 
-		strIndex);
+	builder.EncodeStringTable(st);
 	
 	//Write relations in groups
 	bool groupCountOk = true;
-	size_t stopIndex = startRelationc+maxRelationsToProcess;
+	size_t stopIndex = startRelationc+builder.count;
 	while(relationc < stopIndex and groupCountOk)
 	{
 		size_t relsInGroup = stopIndex - relationc;
 		if(relsInGroup > maxGroupObjects)
 			 relsInGroup = maxGroupObjects;
 
-		//Check if all tags are empty
-		//TODO
-
 		OSMPBF::PrimitiveGroup *pg = pb.add_primitivegroup();
 
 		for(size_t i=relationc; i<relationc+relsInGroup; i++)
@@ -1038,11 +2496,12 @@ void PbfEncodeBase::EncodePbfRelations(const std::vector<class OsmRelation> &rel
 
 			const class OsmRelation &r = relations[i];
 			const TagMap &tags = r.tags;
+			builder.BeginObject(i - startRelationc);
 			orl->set_id(r.objId);
 			for(auto it = tags.begin(); it != tags.end(); it++)
 			{
-				orl->add_keys(strIndex[it->first]);
-				orl->add_vals(strIndex[it->second]);
+				orl->add_keys(builder.NextString());
+				orl->add_vals(builder.NextString());
 			}
 
 			int64_t refc = 0;
@@ -1056,25 +2515,15 @@ void PbfEncodeBase::EncodePbfRelations(const std::vector<class OsmRelation> &rel
 				else if (r.refTypeStrs[j]!="node")
 					continue;
 
-				orl->add_roles_sid(strIndex[r.refRoles[j]]);
+				orl->add_roles_sid(builder.NextString());
 				orl->add_memids(r.refIds[j]-refc);
 				refc = r.refIds[j];
 				orl->add_types(mt);
 			}
 
 			if(this->encodeMetaData)
-			{
-				OSMPBF::Info *info = orl->mutable_info();
-
-				info->set_version(r.metaData.version);
-				info->set_timestamp(r.metaData.timestamp * 1000 / date_granularity);
-				info->set_changeset(r.metaData.changeset);
-				info->set_uid(r.metaData.uid);
-				info->set_user_sid(strIndex[r.metaData.username]);
-
-				if(this->encodeHistorical)
-					info->set_visible(r.metaData.visible);
-			}
+				EncodePbfInfo(r.metaData, builder.NextString(), date_granularity, this->encodeHistorical, orl);
+			builder.EndObject();
 		}
 
 		relationc += relsInGroup;
@@ -1083,34 +2532,275 @@ void PbfEncodeBase::EncodePbfRelations(const std::vector<class OsmRelation> &rel
 	pb.SerializeToString(&out);
 }
 
-void PbfEncodeBase::EncodePbfRelationsSizeLimited(const std::vector<class OsmRelation> &relations, size_t &relc, std::string &out)
+// *************************************
+
+PbfEncode::PbfEncode(std::streambuf &handleIn): PbfEncodeBase(), handle(&handleIn)
+{
+
+}
+
+PbfEncode::~PbfEncode()
+{
+
+}
+
+// ******** Parallel PBF encoder *************
+
+///A chunk of objects, encoded to PBF blobs by a worker thread
+class PbfEncodeJob
+{
+public:
+	std::vector<class OsmNode> nodes;
+	std::vector<int64_t> nodeLats, nodeLons;
+	std::vector<class OsmWay> ways;
+	std::vector<class OsmRelation> relations;
+	std::string encoded;
+	bool done;
+	std::string error;
+
+	PbfEncodeJob() : done(false) {};
+};
+
+///Encoder state owned by a single worker thread, which writes to a string
+class PbfBlobEncode : public PbfEncodeBase
 {
-	const size_t startRelc = relc;
-	uint32_t objLimit = this->optimalRelations;
-	this->EncodePbfRelations(relations, relc, objLimit, out);
+protected:
+	virtual void write (const char* s, std::streamsize n)
+	{
+		this->out->append(s, n);
+	}
+
+	virtual void operator<< (const std::string &val)
+	{
+		this->out->append(val);
+	}
+
+public:
+	std::string *out;
+
+	PbfBlobEncode() : PbfEncodeBase()
+	{
+		headerWritten = true; //The header is written by PbfEncodeParallel
+		out = nullptr;
+	};
+	virtual ~PbfBlobEncode() {};
 
-	while(out.size() > maxPayloadSize)
+	void CopySettings(const class PbfEncodeBase &src)
 	{
-		//Payload is too big, so we need to re-encode by limiting number of groups
-		objLimit /= 2;
-		relc = startRelc;
-		this->EncodePbfRelations(relations, relc, objLimit, out);
+		this->encodeMetaData = src.encodeMetaData;
+		this->encodeHistorical = src.encodeHistorical;
+		this->compressUsingZLib = src.compressUsingZLib;
+		this->compressUsingLzma = src.compressUsingLzma;
+		this->compressionLevel = src.compressionLevel;
+		this->writeIndexData = src.writeIndexData;
+		this->maxGroupObjects = src.maxGroupObjects;
+		this->writingProgram = src.writingProgram;
+		this->granularity = src.granularity;
+		this->date_granularity = src.date_granularity;
+		this->lat_offset = src.lat_offset;
+		this->lon_offset = src.lon_offset;
+	}
 
-		if(out.size() > maxPayloadSize and objLimit <= 1)
-			throw runtime_error("Failed to encode relations without breaking maxPayloadSize limit");
+	void EncodeJob(class PbfEncodeJob &job)
+	{
+		this->buffer.nodes.swap(job.nodes);
+		this->nodeLats.swap(job.nodeLats);
+		this->nodeLons.swap(job.nodeLons);
+		this->buffer.ways.swap(job.ways);
+		this->buffer.relations.swap(job.relations);
+		this->out = &job.encoded;
+		this->EncodeBuffer();
+		this->out = nullptr;
 	}
+};
+
+PbfEncodeParallel::PbfEncodeParallel(std::streambuf &handle, unsigned numThreads): 
+	PbfEncode(handle),
+	stopWorkers(false),
+	workersStarted(false),
+	numThreads(numThreads),
+	chunkObjects(64000),
+	reorderWindow(0)
+{
+
 }
 
-// *************************************
+PbfEncodeParallel::~PbfEncodeParallel()
+{
+	//Write out anything queued, but the caller is responsible for calling Finish
+	try
+	{
+		while(!this->inFlight.empty())
+			this->WriteOldestJob();
+	}
+	catch(std::exception &err)
+	{
+		cerr << err.what() << endl;
+	}
+	this->StopWorkers();
+}
 
-PbfEncode::PbfEncode(std::streambuf &handleIn): PbfEncodeBase(), handle(&handleIn)
+void PbfEncodeParallel::StartWorkers()
 {
+	this->workersStarted = true;
+	unsigned threadCount = this->numThreads;
+	if(threadCount == 0)
+		threadCount = std::thread::hardware_concurrency();
+	if(threadCount == 0)
+		threadCount = 2;
+	if(this->reorderWindow == 0)
+		this->reorderWindow = threadCount * 2;
+	if(threadCount < 2)
+		return;
 
+	for(unsigned i=0; i<threadCount; i++)
+		this->workers.push_back(std::thread(&PbfEncodeParallel::WorkerLoop, this));
 }
 
-PbfEncode::~PbfEncode()
+void PbfEncodeParallel::StopWorkers()
+{
+	{
+		std::lock_guard<std::mutex> lock(this->jobLock);
+		this->stopWorkers = true;
+	}
+	this->workAvailable.notify_all();
+	for(size_t i=0; i<this->workers.size(); i++)
+		this->workers[i].join();
+	this->workers.clear();
+}
+
+void PbfEncodeParallel::WorkerLoop()
+{
+	class PbfBlobEncode enc;
+	while(true)
+	{
+		std::shared_ptr<class PbfEncodeJob> job;
+		{
+			std::unique_lock<std::mutex> lock(this->jobLock);
+			this->workAvailable.wait(lock, [this]{return this->stopWorkers || !this->pending.empty();});
+			if(this->stopWorkers)
+				return;
+			job = this->pending.front();
+			this->pending.pop_front();
+		}
+		enc.CopySettings(*this);
+
+		try
+		{
+			enc.EncodeJob(*job);
+		}
+		catch(std::exception &err)
+		{
+			job->error = err.what();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(this->jobLock);
+			job->done = true;
+		}
+		this->workDone.notify_all();
+	}
+}
+
+void PbfEncodeParallel::EncodeBuffer()
+{
+	if(!this->workersStarted)
+		this->StartWorkers();
+	if(this->workers.empty())
+	{
+		PbfEncodeBase::EncodeBuffer(); //Single thread, so encode in place
+		return;
+	}
+
+	this->WriteHeader();
+	if(this->buffer.nodes.empty() && this->buffer.ways.empty() && this->buffer.relations.empty())
+		return;
+
+	while(this->inFlight.size() >= this->reorderWindow)
+		this->WriteOldestJob();
+
+	std::shared_ptr<class PbfEncodeJob> job = make_shared<class PbfEncodeJob>();
+	job->nodes.swap(this->buffer.nodes);
+	job->nodeLats.swap(this->nodeLats);
+	job->nodeLons.swap(this->nodeLons);
+	job->ways.swap(this->buffer.ways);
+	job->relations.swap(this->buffer.relations);
+	this->buffer.Clear();
+	this->nodeLats.clear();
+	this->nodeLons.clear();
+
+	this->inFlight.push_back(job);
+	{
+		std::lock_guard<std::mutex> lock(this->jobLock);
+		this->pending.push_back(job);
+	}
+	this->workAvailable.notify_one();
+}
+
+void PbfEncodeParallel::ObjectAdded()
+{
+	if(!this->workersStarted)
+		this->StartWorkers();
+	if(this->workers.empty())
+		return;
+	size_t buffered = this->buffer.nodes.size() + this->buffer.ways.size() + this->buffer.relations.size();
+	if(buffered >= this->chunkObjects)
+		this->EncodeBuffer();
+}
+
+void PbfEncodeParallel::WriteOldestJob()
+{
+	std::shared_ptr<class PbfEncodeJob> job = this->inFlight.front();
+	{
+		std::unique_lock<std::mutex> lock(this->jobLock);
+		this->workDone.wait(lock, [&job]{return job->done;});
+	}
+	this->inFlight.pop_front();
+
+	if(!job->error.empty())
+		throw std::runtime_error(job->error);
+	this->write(job->encoded.data(), job->encoded.size());
+}
+
+bool PbfEncodeParallel::Finish()
+{
+	PbfEncodeBase::Finish();
+	while(!this->inFlight.empty())
+		this->WriteOldestJob();
+	return false;
+}
+
+bool PbfEncodeParallel::StoreNode(int64_t objId, const class MetaData &metaData, 
+	const TagMap &tags, double lat, double lon)
+{
+	PbfEncodeBase::StoreNode(objId, metaData, tags, lat, lon);
+	this->ObjectAdded();
+	return false;
+}
+
+bool PbfEncodeParallel::StoreNodeFixed(int64_t objId, const class MetaData &metaData, 
+	const TagMap &tags, int64_t lat, int64_t lon)
+{
+	PbfEncodeBase::StoreNodeFixed(objId, metaData, tags, lat, lon);
+	this->ObjectAdded();
+	return false;
+}
+
+bool PbfEncodeParallel::StoreWay(int64_t objId, const class MetaData &metaData, 
+	const TagMap &tags, const std::vector<int64_t> &refs)
 {
+	PbfEncodeBase::StoreWay(objId, metaData, tags, refs);
+	this->ObjectAdded();
+	return false;
+}
 
+bool PbfEncodeParallel::StoreRelation(int64_t objId, const class MetaData &metaData, const TagMap &tags, 
+	const std::vector<std::string> &refTypeStrs, const std::vector<int64_t> &refIds, 
+	const std::vector<std::string> &refRoles)
+{
+	PbfEncodeBase::StoreRelation(objId, metaData, tags, refTypeStrs, refIds, refRoles);
+	this->ObjectAdded();
+	return false;
 }
 
 //*******************************************
@@ -2,20 +2,97 @@
 #define _PBF_H
 
 #include "OsmData.h"
+#include "zlibcodec.h"
+#include "lzmacodec.h"
+#include "pbfwire.h"
 #include <iostream>
+#include <memory>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #ifdef PYTHON_AWARE
 #include <Python.h>
 #endif
 
-///Decodes a binary PBF stream and fires a series of events to the output object derived from IDataStreamHandler
-class PbfDecode : public OsmDecoder
+///Location and summary of a PBF blob
+class PbfIndexEntry
+{
+public:
+	uint64_t offset; //Byte offset of the blob header length
+	std::string blobType; //OSMHeader or OSMData
+	uint64_t rawSize; //Decompressed size, if given by the blob
+	char objType; //'n', 'w' or 'r', or 0 if empty or mixed
+	int64_t minId, maxId;
+	uint64_t objCount;
+
+	PbfIndexEntry();
+};
+
+///Summary of a data blob, written by PbfEncode to BlobHeader.indexdata so readers can skip
+///blobs without inflating them
+class PbfBlobSummary
+{
+public:
+	char objType; //'n', 'w' or 'r'
+	int64_t minId, maxId;
+	uint64_t objCount;
+	bool hasBbox; //Node blobs only
+	double minLon, minLat, maxLon, maxLat;
+
+	PbfBlobSummary();
+	void Encode(std::string &out) const;
+	///Returns false if the data is not a summary in this format
+	bool Decode(const std::string &data);
+};
+
+void SavePbfIndex(const std::vector<class PbfIndexEntry> &index, uint64_t dataSize, std::streambuf &out);
+///Returns the size of the pbf data the index was built from
+uint64_t LoadPbfIndex(std::streambuf &in, std::vector<class PbfIndexEntry> &index);
+///Find a data blob of the given type with objId in its ID range, or -1 if there is none. This is
+///a binary search if the file is sorted by type then ID (Sort.Type_then_ID), otherwise a scan.
+int64_t FindPbfBlob(const std::vector<class PbfIndexEntry> &index, char objType, int64_t objId);
+///Find the first data blob of the given type, or -1 if there is none
+int64_t FindPbfBlob(const std::vector<class PbfIndexEntry> &index, char objType);
+
+///Decodes PBF blobs, independent of where the data is read from
+class PbfDecodeBase : public OsmDecoder
 {
 protected:
-	std::istream handle;
 	std::string prevObjType;
+	class ZlibCodec codec;
+	class LzmaCodec lzmaCodec;
+	std::string decBuff;
+	class PbfWireBlock wireBlock;
 
-	bool DecodeOsmData(std::string &decBlob);
+	bool DecodeOsmData(const std::string &decBlob);
+	bool DecodeOsmDataWire(const std::string &decBlob);
 	bool CheckOutputType(const char *objType);
+	///Inflate and decode a blob given its header type and encoded Blob message. Returns true to halt.
+	bool DecodeBlob(const std::string &headerType, const std::string &blobData);
+
+public:
+	PbfDecodeBase();
+	virtual ~PbfDecodeBase();
+
+	///Decode PrimitiveBlocks with the built in wire format reader rather than libprotobuf.
+	///Off by default until it has had wider testing on malformed input.
+	bool useWireParser;
+};
+
+///Decodes a binary PBF stream and fires a series of events to the output object derived from IDataStreamHandler
+class PbfDecode : public PbfDecodeBase
+{
+protected:
+	std::istream handle;
+	bool bboxFilter;
+	double filterBbox[4];
+	bool idFilter[3];
+	int64_t idFilterMin[3], idFilterMax[3];
+
+	///Returns false if the blob was skipped by the filters, leaving blobData empty
+	bool ReadBlob(std::string &headerType, std::string &blobData, bool applyFilter = true);
+	bool BlobWanted(const class PbfBlobSummary &summary) const;
 
 public:
 	PbfDecode(std::streambuf &handleIn);
@@ -23,6 +100,63 @@ public:
 
 	bool DecodeNext();
 	void DecodeFinish();
+
+	///Continue decoding at a blob offset from PbfIndexEntry. The stream must be seekable.
+	virtual void SeekToBlob(uint64_t offset);
+	///List the blobs from the current position to the end of the stream. Data blobs are
+	///inflated but only their ID columns are read. The stream must be seekable and is
+	///returned to its current position.
+	void BuildIndex(std::vector<class PbfIndexEntry> &out, uint64_t *dataSize = nullptr);
+
+	// Filters are applied to whole blobs using the summary in BlobHeader.indexdata, so matching
+	// blobs may still contain other objects. Blobs without a summary are always decoded.
+	// Blobs of types excluded by decodeMask are also skipped.
+
+	///Skip node blobs outside a region. Set before decoding starts.
+	void SetBboxFilter(double x1, double y1, double x2, double y2);
+	///Skip blobs of a type ('n', 'w' or 'r') with no IDs in a range. Set before decoding starts.
+	void SetIdFilter(char objType, int64_t minId, int64_t maxId);
+	void ClearFilters();
+
+	///Number of blobs skipped by the filters
+	uint64_t skippedBlobs;
+};
+
+///Decodes PBF as a pipeline. A reader thread slices the stream into blobs, a pool of worker
+///threads inflates and decodes them, and the events are delivered to the output in the original
+///order by the thread calling DecodeNext. As the input is read ahead, loop until AtEnd rather
+///than checking the stream.
+class PbfDecodeParallel : public PbfDecode
+{
+protected:
+	std::thread reader;
+	std::vector<std::thread> workers;
+	std::deque<std::shared_ptr<class PbfBlobJob> > pending; //Not yet started, in stream order
+	std::deque<std::shared_ptr<class PbfBlobJob> > inFlight; //Not yet delivered, in stream order
+	std::mutex jobLock;
+	std::condition_variable workAvailable, workDone, spaceAvailable;
+	bool stopWorkers, workersStarted, readerDone;
+	std::string readerError;
+
+	void StartWorkers();
+	void StopWorkers();
+	void ReaderLoop();
+	void WorkerLoop();
+
+public:
+	PbfDecodeParallel(std::streambuf &handleIn, unsigned numThreads = 0);
+	virtual ~PbfDecodeParallel();
+
+	bool DecodeNext();
+	void DecodeFinish();
+	///True when every blob in the stream has been delivered
+	bool AtEnd();
+	void SeekToBlob(uint64_t offset);
+
+	///Worker threads to use, zero for the number of hardware threads. Set before decoding starts.
+	unsigned numThreads;
+	///Maximum blobs read or decoded ahead of the one being delivered, which bounds memory use
+	size_t reorderWindow;
 };
 
 
@@ -34,24 +168,27 @@ protected:
 	virtual void write (const char* s, std::streamsize n);
 	virtual void operator<< (const std::string &val);
 	class OsmData buffer;
+	std::vector<int64_t> nodeLats, nodeLons; //Positions of the buffered nodes in nanodegrees
 	std::string prevObjType;
 	bool headerWritten;
+	class ZlibCodec codec;
+	class LzmaCodec lzmaCodec;
 	uint32_t maxPayloadSize, maxHeaderSize, optimalDenseNodes, optimalWays, optimalRelations;
 
-	void EncodeBuffer();
+	virtual void EncodeBuffer();
+	void WriteHeader();
 	void EncodeHeaderBlock(std::string &out);
-	void EncodePbfDenseNodes(const std::vector<class OsmNode> &nodes, size_t &nodec, size_t maxNodesToProcess, 
-		std::string &out);
-	void EncodePbfWays(const std::vector<class OsmWay> &ways, size_t &wayc, size_t maxWaysToProcess, 
-		std::string &out);
-	void EncodePbfRelations(const std::vector<class OsmRelation> &relations, size_t &relationc, size_t maxRelsToProcess, 
-		std::string &out);
-
-	void EncodePbfDenseNodesSizeLimited(const std::vector<class OsmNode> &nodes, size_t &nodec, std::string &out);
-	void EncodePbfWaysSizeLimited(const std::vector<class OsmWay> &ways, size_t &wayc, std::string &out);
-	void EncodePbfRelationsSizeLimited(const std::vector<class OsmRelation> &relations, size_t &relc, std::string &out);
+	///Each encodes one block starting from the counter, which is advanced past the objects used.
+	///The block is closed before it would exceed maxPayloadSize.
+	void EncodePbfDenseNodes(const std::vector<class OsmNode> &nodes, const std::vector<int64_t> &lats, 
+		const std::vector<int64_t> &lons, size_t &nodec, std::string &out);
+	void EncodePbfWays(const std::vector<class OsmWay> &ways, size_t &wayc, std::string &out);
+	void EncodePbfRelations(const std::vector<class OsmRelation> &relations, size_t &relationc, std::string &out);
 
-	void WriteBlobPayload(const std::string &blobPayload, const char *type);
+	void BufferNode(int64_t objId, const class MetaData &metaData, const TagMap &tags, 
+		double lat, double lon, int64_t nanoLat, int64_t nanoLon);
+	void WriteBlobPayload(const std::string &blobPayload, const char *type, 
+		const std::string &indexData = std::string());
 
 public:
 	PbfEncodeBase();
@@ -65,6 +202,8 @@ public:
 	bool StoreBounds(double x1, double y1, double x2, double y2);
 	bool StoreNode(int64_t objId, const class MetaData &metaData, 
 		const TagMap &tags, double lat, double lon);
+	bool StoreNodeFixed(int64_t objId, const class MetaData &metaData, 
+		const TagMap &tags, int64_t lat, int64_t lon);
 	bool StoreWay(int64_t objId, const class MetaData &metaData, 
 		const TagMap &tags, const std::vector<int64_t> &refs);
 	bool StoreRelation(int64_t objId, const class MetaData &metaData, const TagMap &tags, 
@@ -72,6 +211,13 @@ public:
 		const std::vector<std::string> &refRoles);
 
 	bool encodeMetaData, encodeHistorical, compressUsingZLib;
+	///Write lzma_data blobs rather than zlib. They are smaller but slower to write and few
+	///other readers support them.
+	bool compressUsingLzma;
+	///Write a PbfBlobSummary for each data blob
+	bool writeIndexData;
+	///zlib level or lzma preset from 0 to 9, or Z_DEFAULT_COMPRESSION
+	int compressionLevel;
 	size_t maxGroupObjects;
 	std::string writingProgram;
 	int32_t granularity, date_granularity;
@@ -99,6 +245,51 @@ public:
 	virtual ~PbfEncode();
 };
 
+///Encodes PBF using a pool of worker threads. The buffer is handed to a worker every
+///chunkObjects objects, which builds and compresses the blobs. Blobs are written in their
+///original order.
+class PbfEncodeParallel : public PbfEncode
+{
+protected:
+	std::vector<std::thread> workers;
+	std::deque<std::shared_ptr<class PbfEncodeJob> > pending; //Not yet started, in stream order
+	std::deque<std::shared_ptr<class PbfEncodeJob> > inFlight; //Not yet written, in stream order
+	std::mutex jobLock;
+	std::condition_variable workAvailable, workDone;
+	bool stopWorkers, workersStarted;
+
+	void StartWorkers();
+	void StopWorkers();
+	void WorkerLoop();
+	void EncodeBuffer();
+	void ObjectAdded();
+	void WriteOldestJob();
+
+public:
+	PbfEncodeParallel(std::streambuf &handle, unsigned numThreads = 0);
+	virtual ~PbfEncodeParallel();
+
+	bool Finish();
+
+	bool StoreNode(int64_t objId, const class MetaData &metaData, 
+		const TagMap &tags, double lat, double lon);
+	bool StoreNodeFixed(int64_t objId, const class MetaData &metaData, 
+		const TagMap &tags, int64_t lat, int64_t lon);
+	bool StoreWay(int64_t objId, const class MetaData &metaData, 
+		const TagMap &tags, const std::vector<int64_t> &refs);
+	bool StoreRelation(int64_t objId, const class MetaData &metaData, const TagMap &tags, 
+		const std::vector<std::string> &refTypeStrs, const std::vector<int64_t> &refIds, 
+		const std::vector<std::string> &refRoles);
+
+	///Worker threads to use, zero for the number of hardware threads. Set before encoding starts.
+	unsigned numThreads;
+	///Objects buffered before they are passed to a worker
+	size_t chunkObjects;
+	///Maximum chunks queued or encoded ahead of the one being written. Together with
+	///chunkObjects, this bounds memory use.
+	size_t reorderWindow;
+};
+
 #ifdef PYTHON_AWARE
 class PyPbfEncode : public PbfEncodeBase
 {
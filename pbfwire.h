@@ -0,0 +1,223 @@
+#ifndef _PBF_WIRE_H
+#define _PBF_WIRE_H
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <stdint.h>
+#include "varint.h"
+
+///A run of bytes inside a decoded buffer, which must outlive it
+class PbfWireSpan
+{
+public:
+	const uint8_t *start;
+	size_t len;
+
+	PbfWireSpan() : start(nullptr), len(0) {};
+	PbfWireSpan(const uint8_t *start, size_t len) : start(start), len(len) {};
+	const uint8_t *End() const {return start + len;};
+};
+
+///Reads protobuf wire format in place, without building a message tree. Throws
+///std::runtime_error if the data is truncated or malformed.
+class PbfWireReader
+{
+protected:
+	const uint8_t *pos, *end;
+
+	static void Malformed()
+	{
+		throw std::runtime_error("Error decoding PBF: malformed protobuf data");
+	}
+
+public:
+	enum WireType {WireVarint = 0, WireFixed64 = 1, WireLengthDelimited = 2, WireFixed32 = 5};
+
+	PbfWireReader(const uint8_t *start, const uint8_t *end) : pos(start), end(end) {};
+	PbfWireReader(const PbfWireSpan &span) : pos(span.start), end(span.End()) {};
+
+	uint64_t ReadVarint()
+	{
+		uint64_t val = 0;
+		pos = DecodeVarint(pos, end, val);
+		if(pos == NULL)
+			Malformed();
+		return val;
+	}
+
+	int64_t ReadZigzag()
+	{
+		uint64_t val = this->ReadVarint();
+		return (val >> 1) ^ (-(val & 1));
+	}
+
+	///Reads the next field key. Returns false at the end of the message.
+	bool Next(uint32_t &field, uint32_t &wireType)
+	{
+		if(pos >= end)
+			return false;
+		uint64_t key = this->ReadVarint();
+		field = key >> 3;
+		wireType = key & 0x7;
+		return true;
+	}
+
+	PbfWireSpan ReadBytes()
+	{
+		uint64_t len = this->ReadVarint();
+		if(len > (uint64_t)(end - pos))
+			Malformed();
+		PbfWireSpan span(pos, len);
+		pos += len;
+		return span;
+	}
+
+	void Skip(uint32_t wireType)
+	{
+		size_t len = 0;
+		switch(wireType)
+		{
+		case WireVarint:
+			this->ReadVarint();
+			return;
+		case WireFixed64:
+			len = 8;
+			break;
+		case WireLengthDelimited:
+			this->ReadBytes();
+			return;
+		case WireFixed32:
+			len = 4;
+			break;
+		default:
+			Malformed();
+		}
+		if(len > (size_t)(end - pos))
+			Malformed();
+		pos += len;
+	}
+
+	// Repeated scalar fields may be packed or not, and may occur several times. Values are
+	// appended to out.
+
+	void ReadRepeatedVarint(uint32_t wireType, std::vector<int64_t> &out)
+	{
+		if(wireType == WireVarint)
+		{
+			out.push_back((int64_t)this->ReadVarint());
+			return;
+		}
+		if(wireType != WireLengthDelimited)
+			Malformed();
+		PbfWireReader packed(this->ReadBytes());
+		while(packed.pos < packed.end)
+			out.push_back((int64_t)packed.ReadVarint());
+	}
+
+	void ReadRepeatedZigzag(uint32_t wireType, std::vector<int64_t> &out)
+	{
+		if(wireType == WireVarint)
+		{
+			out.push_back(this->ReadZigzag());
+			return;
+		}
+		if(wireType != WireLengthDelimited)
+			Malformed();
+		PbfWireReader packed(this->ReadBytes());
+		while(packed.pos < packed.end)
+			out.push_back(packed.ReadZigzag());
+	}
+
+	///Delta coded zigzag values. The running total is kept in last.
+	void ReadRepeatedZigzagDeltas(uint32_t wireType, int64_t &last, std::vector<int64_t> &out)
+	{
+		if(wireType == WireVarint)
+		{
+			last += this->ReadZigzag();
+			out.push_back(last);
+			return;
+		}
+		if(wireType != WireLengthDelimited)
+			Malformed();
+		PbfWireSpan packed = this->ReadBytes();
+		if(DecodeZigzagDeltas(packed.start, packed.End(), last, out) == NULL)
+			Malformed();
+	}
+};
+
+///Scratch space for decoding a PrimitiveBlock in place. It is reused between blocks, so
+///decoding does not allocate once the buffers have grown. Strings are views into the
+///decompressed block.
+class PbfWireBlock
+{
+public:
+	std::vector<PbfWireSpan> strings, groups;
+	int32_t granularity, date_granularity;
+	int64_t lat_offset, lon_offset;
+
+	//Columns of the object being decoded
+	std::vector<int64_t> ids, lats, lons, keys, vals, keysVals, refs, types, roles;
+	std::vector<int64_t> versions, timestamps, changesets, uids, userSids, visibles;
+
+	PbfWireBlock()
+	{
+		granularity = 100;
+		date_granularity = 1000;
+		lat_offset = 0;
+		lon_offset = 0;
+	}
+
+	///Read the string table and block settings and find the primitive groups
+	void Parse(const uint8_t *data, size_t len)
+	{
+		strings.clear();
+		groups.clear();
+		granularity = 100;
+		date_granularity = 1000;
+		lat_offset = 0;
+		lon_offset = 0;
+
+		PbfWireReader block(data, data + len);
+		uint32_t field, wireType;
+		while(block.Next(field, wireType))
+		{
+			if(field == 1 && wireType == PbfWireReader::WireLengthDelimited)
+			{
+				PbfWireReader st(block.ReadBytes());
+				while(st.Next(field, wireType))
+				{
+					if(field == 1 && wireType == PbfWireReader::WireLengthDelimited)
+						strings.push_back(st.ReadBytes());
+					else
+						st.Skip(wireType);
+				}
+			}
+			else if(field == 2 && wireType == PbfWireReader::WireLengthDelimited)
+				groups.push_back(block.ReadBytes());
+			else if(field == 17 && wireType == PbfWireReader::WireVarint)
+				granularity = (int32_t)block.ReadVarint();
+			else if(field == 18 && wireType == PbfWireReader::WireVarint)
+				date_granularity = (int32_t)block.ReadVarint();
+			else if(field == 19 && wireType == PbfWireReader::WireVarint)
+				lat_offset = (int64_t)block.ReadVarint();
+			else if(field == 20 && wireType == PbfWireReader::WireVarint)
+				lon_offset = (int64_t)block.ReadVarint();
+			else
+				block.Skip(wireType);
+		}
+	}
+
+	bool ValidString(int64_t index) const
+	{
+		return index > 0 && (uint64_t)index < strings.size();
+	}
+
+	void GetString(int64_t index, std::string &out) const
+	{
+		const PbfWireSpan &s = strings[index];
+		out.assign((const char *)s.start, s.len);
+	}
+};
+
+#endif //_PBF_WIRE_H
@@ -1,11 +1,1145 @@
 #include "o5m.h"
+#include "pbf.h"
+#include "numparse.h"
+#include "pbf/fileformat.pb.h"
 #include <iostream>
+#include <sstream>
+#include <deque>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+#include <assert.h>
+#include <arpa/inet.h>
 using namespace std;
 
+void TestParseNumber()
+{
+	int64_t val = 7;
+	assert (ParseInt64("-42", val) && val == -42);
+	assert (ParseInt64("+3", val) && val == 3);
+	assert (ParseInt64("9223372036854775807", val) && val == INT64_MAX);
+	assert (ParseInt64("-9223372036854775808", val) && val == INT64_MIN);
+	val = 7;
+	assert (!ParseInt64("9223372036854775808", val));
+	assert (!ParseInt64("-9223372036854775809", val));
+	assert (!ParseInt64("12a", val));
+	assert (!ParseInt64("1e5", val));
+	assert (!ParseInt64("", val));
+	assert (!ParseInt64("-", val));
+	assert (!ParseInt64("1.", val));
+	assert (val == 7);
+
+	assert (ParseFixedPoint("-51.5074812", 7, val) && val == -515074812);
+	assert (ParseFixedPoint("1.5", 7, val) && val == 15000000);
+	assert (ParseFixedPoint(".5", 7, val) && val == 5000000);
+	assert (ParseFixedPoint("2.", 7, val) && val == 20000000);
+	assert (ParseFixedPoint("+3", 0, val) && val == 3);
+	//Rounding is decided by the 13th decimal place
+	assert (ParseFixedPoint("1.0000000000005", 12, val) && val == 1000000000001);
+	assert (ParseFixedPoint("1.0000000000004999", 12, val) && val == 1000000000000);
+	assert (ParseFixedPoint("-1.0000000000005", 12, val) && val == -1000000000001);
+	assert (ParseFixedPoint("-1.0000000000004999", 12, val) && val == -1000000000000);
+	assert (ParseFixedPoint("179.9999999999999", 12, val) && val == 180000000000000);
+	assert (ParseFixedPoint("-9223372.036854775807", 12, val) && val == -INT64_MAX);
+	val = 7;
+	assert (!ParseFixedPoint("9223372.036854775808", 12, val));
+	assert (!ParseFixedPoint("-9223372.036854775808", 12, val)); //Magnitudes are limited to INT64_MAX
+	assert (!ParseFixedPoint("922337203685477580.8", 1, val));
+	assert (!ParseFixedPoint("1.5a", 7, val));
+	assert (!ParseFixedPoint("1e5", 7, val));
+	assert (!ParseFixedPoint(".", 7, val));
+	assert (!ParseFixedPoint("-", 7, val));
+	assert (!ParseFixedPoint("-.", 7, val));
+	assert (!ParseFixedPoint("", 7, val));
+	assert (val == 7);
+}
+
+void TestStringPairRing()
+{
+	//Four slots of up to 6 bytes, so pushing wraps round several times
+	class StringPairRing ring;
+	ring.SetBufferSize(4, 6);
+	std::deque<std::pair<std::string, std::string> > model; //Oldest first
+	std::string first, second;
+	for(int i=0; i<15; i++)
+	{
+		std::string a = std::to_string(i), b = i % 3 ? "v" + std::to_string(i % 7) : "";
+		ring.PushBack(a.data(), a.size(), b.data(), b.size());
+		model.push_back(std::make_pair(a, b));
+		if(model.size() > 4)
+			model.pop_front();
+
+		assert (ring.Size() == model.size());
+		assert (!ring.ValidRef(0) && !ring.ValidRef(model.size() + 1));
+		for(size_t ref=1; ref<=model.size(); ref++)
+		{
+			assert (ring.ValidRef(ref));
+			const std::pair<std::string, std::string> &expected = model[model.size() - ref];
+			ring.GetPair(ref, first, second);
+			assert (first == expected.first && second == expected.second);
+			ring.GetFirst(ref, first);
+			assert (first == expected.first);
+		}
+	}
+
+	//An entry that does not fit a slot is rejected, leaving the ring unchanged
+	bool rejected = false;
+	try
+	{
+		ring.PushBack("abcd", 4, "efg", 3);
+	}
+	catch(std::runtime_error &err)
+	{
+		rejected = true;
+	}
+	assert (rejected);
+	ring.GetPair(1, first, second);
+	assert (ring.Size() == 4 && first == "14" && second == "v0");
+
+	ring.PushBack("abc", 3, "def", 3); //Exactly fills a slot
+	ring.GetPair(1, first, second);
+	assert (first == "abc" && second == "def");
+	ring.GetPair(4, first, second);
+	assert (first == "12" && second == "");
+
+	ring.Clear();
+	assert (ring.Size() == 0 && !ring.ValidRef(1));
+}
+
+///Records events as text, so the output of different decoders can be compared
+class EventLog : public IDataStreamHandler
+{
+public:
+	std::stringstream text;
+	///Log positions as integers in units of 1e-7 degrees, truncated from nanodegrees as the PBF
+	///encoder does at its default granularity, so they survive a PBF round trip
+	bool roundPositions;
+	///If false, metadata is logged as if it was missing
+	bool logMetaData;
+
+	EventLog() : roundPositions(false), logMetaData(true)
+	{
+		text.precision(17);
+	}
+
+	bool Sync() {text << "sync\n"; return false;};
+	bool Reset() {text << "reset\n"; return false;};
+	bool StoreIsDiff(bool isDiff) {text << "isdiff " << isDiff << "\n"; return false;};
+	bool StoreBounds(double x1, double y1, double x2, double y2)
+	{
+		text << "bounds " << x1 << " " << y1 << " " << x2 << " " << y2 << "\n";
+		return false;
+	}
+
+	bool StoreNode(int64_t objId, const class MetaData &metaData,
+		const TagMap &tags, double lat, double lon)
+	{
+		text << "node " << objId << " ";
+		if(this->roundPositions)
+			text << llround(lat / 1e-9) / 100 << " " << llround(lon / 1e-9) / 100;
+		else
+			text << lat << " " << lon;
+		this->LogObject(metaData, tags);
+		return false;
+	}
+
+	bool StoreWay(int64_t objId, const class MetaData &metaData,
+		const TagMap &tags, const std::vector<int64_t> &refs)
+	{
+		text << "way " << objId;
+		for(size_t i=0; i<refs.size(); i++)
+			text << " " << refs[i];
+		this->LogObject(metaData, tags);
+		return false;
+	}
+
+	bool StoreRelation(int64_t objId, const class MetaData &metaData, const TagMap &tags,
+		const std::vector<std::string> &refTypeStrs, const std::vector<int64_t> &refIds,
+		const std::vector<std::string> &refRoles)
+	{
+		text << "relation " << objId;
+		for(size_t i=0; i<refIds.size(); i++)
+			text << " " << refTypeStrs[i] << ":" << refIds[i] << ":" << refRoles[i];
+		this->LogObject(metaData, tags);
+		return false;
+	}
+
+	void LogObject(const class MetaData &metaDataIn, const TagMap &tags)
+	{
+		const class MetaData &metaData = this->logMetaData ? metaDataIn : MetaData();
+		text << " v" << metaData.version << " t" << metaData.timestamp << " c" << metaData.changeset
+			<< " u" << metaData.uid << " " << metaData.username << " " << metaData.visible;
+		for(TagMap::const_iterator it=tags.begin(); it != tags.end(); it++)
+			text << " " << it->first << "=" << it->second;
+		text << "\n";
+	}
+};
+
+///Writes nodes, ways and relations with a mix of tags and metadata. The first firstRun objects
+///are written without a reset, then there is a reset every resetEvery objects. There is also
+///a reset where the object type changes, unless resetBetweenTypes is false.
+static void WriteTestData(class IDataStreamHandler &out, int firstRun, int resetEvery, 
+	bool resetBetweenTypes = true)
+{
+	const int numNodes = 6000, numWays = 1500, numRelations = 300;
+	std::vector<int64_t> refs;
+	std::vector<std::string> refTypes, refRoles;
+	int sinceReset = 0;
+	for(int i=0; i<numNodes+numWays+numRelations; i++)
+	{
+		bool typeChange = i == numNodes || i == numNodes+numWays;
+		if((typeChange && resetBetweenTypes) || (i > firstRun && sinceReset >= resetEvery))
+		{
+			out.Sync();
+			out.Reset();
+			sinceReset = 0;
+		}
+		sinceReset++;
+
+		class MetaData metaData;
+		TagMap tags;
+		if(i % 3 != 0)
+		{
+			metaData.version = 1 + i % 5;
+			metaData.timestamp = 1500000000 + i * 37;
+			metaData.changeset = 1000 + i / 10;
+			metaData.uid = 10 + i % 7;
+			metaData.username = "user" + std::to_string(i % 7);
+		}
+		if(i % 4 == 0)
+			tags["name"] = "Object " + std::to_string(i);
+		if(i % 5 == 0)
+			tags["highway"] = i % 2 ? "residential" : "footway";
+
+		if(i < numNodes)
+			out.StoreNode(1000 + i * 3, metaData, tags, 51.5 + (i % 97) * 0.0001234567, -0.1 - (i % 89) * 0.0007654321);
+		else if(i < numNodes+numWays)
+		{
+			refs.clear();
+			for(int j=0; j<2+i%9; j++)
+				refs.push_back(1000 + ((i * 7 + j * 3) % numNodes) * 3);
+			out.StoreWay(500 + i, metaData, tags, refs);
+		}
+		else
+		{
+			refs.clear(); refTypes.clear(); refRoles.clear();
+			for(int j=0; j<1+i%4; j++)
+			{
+				refTypes.push_back(j % 2 ? "way" : "node");
+				refs.push_back(j % 2 ? 500 + numNodes + j : 1000 + j * 3);
+				refRoles.push_back(j == 0 ? "outer" : "");
+			}
+			out.StoreRelation(i, metaData, tags, refTypes, refs, refRoles);
+		}
+	}
+	out.Finish();
+}
+
+static std::string DecodeO5mSerial(const std::string &data)
+{
+	class EventLog log;
+	class O5mDecodeMapped dec((const uint8_t *)data.data(), data.size());
+	dec.output = &log;
+	dec.DecodeHeader();
+	while(!dec.AtEnd())
+		dec.DecodeNext();
+	dec.DecodeFinish();
+	return log.text.str();
+}
+
+void TestO5mDecodeParallel()
+{
+	std::stringbuf buff;
+	{
+		class O5mEncode enc(buff);
+		WriteTestData(enc, 4000, 250);
+	}
+	std::string data = buff.str();
+	std::string expected = DecodeO5mSerial(data);
+	assert (expected.find("relation") != std::string::npos);
+
+	//The first segment exceeds the smaller limits, and is decoded in place between buffered ones
+	size_t maxSizes[] = {32*1024*1024, 20000, 4000, 0};
+	for(size_t i=0; i<sizeof(maxSizes)/sizeof(size_t); i++)
+	{
+		class EventLog log;
+		class O5mDecodeParallel dec((const uint8_t *)data.data(), data.size(), 3);
+		dec.minSegmentSize = 0;
+		dec.maxSegmentSize = maxSizes[i];
+		dec.reorderWindow = 4;
+		dec.output = &log;
+		dec.DecodeHeader();
+		while(!dec.AtEnd())
+			dec.DecodeNext();
+		dec.DecodeFinish();
+		assert (log.text.str() == expected);
+	}
+}
+
+///Removes reset events, which differ between encoders that split the data differently
+static std::string WithoutResets(const std::string &text)
+{
+	std::stringstream in(text);
+	std::string out, line;
+	while(std::getline(in, line))
+	{
+		if(line != "reset")
+			out += line + "\n";
+	}
+	return out;
+}
+
+void TestO5mEncodeParallel()
+{
+	std::stringbuf serialBuff;
+	{
+		class O5mEncode enc(serialBuff);
+		WriteTestData(enc, 4000, 250);
+	}
+	std::string expected = DecodeO5mSerial(serialBuff.str());
+
+	//One thread encodes in place, so the output is the same as the serial encoder
+	unsigned threads[] = {1, 3, 3};
+	size_t chunkObjects[] = {32768, 32768, 300};
+	for(size_t i=0; i<sizeof(threads)/sizeof(unsigned); i++)
+	{
+		std::stringbuf buff;
+		{
+			class O5mEncodeParallel enc(buff, threads[i]);
+			enc.chunkObjects = chunkObjects[i];
+			enc.reorderWindow = 2;
+			WriteTestData(enc, 4000, 250);
+		}
+		if(threads[i] == 1)
+			assert (buff.str() == serialBuff.str());
+		std::string decoded = DecodeO5mSerial(buff.str());
+		assert (WithoutResets(decoded) == WithoutResets(expected));
+		if(chunkObjects[i] < 1000)
+			assert (decoded != expected); //Chunks add resets
+	}
+}
+
+///A stream buffer that cannot seek, like a pipe
+class UnseekableBuf : public std::stringbuf
+{
+public:
+	UnseekableBuf(const std::string &str) : std::stringbuf(str) {};
+
+protected:
+	pos_type seekoff(off_type, std::ios_base::seekdir, std::ios_base::openmode)
+	{
+		return pos_type(off_type(-1));
+	}
+	pos_type seekpos(pos_type, std::ios_base::openmode)
+	{
+		return pos_type(off_type(-1));
+	}
+};
+
+///Removes the objects a decode mask leaves out from an event log
+static std::string FilterByMask(const std::string &text, unsigned decodeMask)
+{
+	std::stringstream in(text);
+	std::string out, line;
+	while(std::getline(in, line))
+	{
+		if(line.compare(0, 5, "node ") == 0 && !(decodeMask & OsmDecoder::DecodeNodes))
+			continue;
+		if(line.compare(0, 4, "way ") == 0 && !(decodeMask & OsmDecoder::DecodeWays))
+			continue;
+		if(line.compare(0, 9, "relation ") == 0 && !(decodeMask & OsmDecoder::DecodeRelations))
+			continue;
+		out += line + "\n";
+	}
+	return out;
+}
+
+void TestO5mDecodeMask()
+{
+	//Skipped objects are followed by wanted ones without a reset in between, so the skipped
+	//objects must still update the delta coding and string table
+	int firstRuns[] = {100000, 7000};
+	unsigned masks[] = {OsmDecoder::DecodeWays, OsmDecoder::DecodeRelations, 
+		OsmDecoder::DecodeNodes | OsmDecoder::DecodeRelations};
+	for(size_t i=0; i<sizeof(firstRuns)/sizeof(int); i++)
+	{
+		std::stringbuf buff;
+		{
+			class O5mEncode enc(buff);
+			WriteTestData(enc, firstRuns[i], 250, false);
+		}
+		std::string data = buff.str();
+		std::string all = DecodeO5mSerial(data);
+
+		for(size_t j=0; j<sizeof(masks)/sizeof(unsigned); j++)
+		{
+			std::string expected = FilterByMask(all, masks[j]);
+			assert (expected != all && expected.size() > 10000);
+
+			class EventLog mappedLog;
+			class O5mDecodeMapped mappedDec((const uint8_t *)data.data(), data.size());
+			mappedDec.decodeMask = masks[j];
+			mappedDec.output = &mappedLog;
+			mappedDec.DecodeHeader();
+			while(!mappedDec.AtEnd())
+				mappedDec.DecodeNext();
+			mappedDec.DecodeFinish();
+			assert (mappedLog.text.str() == expected);
+
+			//The stream decoder seeks back to skipped objects, or keeps a copy if it cannot
+			for(int seekable=0; seekable<2; seekable++)
+			{
+				class EventLog log;
+				std::stringbuf seekableBuff(data);
+				class UnseekableBuf unseekableBuff(data);
+				std::streambuf &in = seekable ? (std::streambuf &)seekableBuff : unseekableBuff;
+				class O5mDecode dec(in);
+				dec.decodeMask = masks[j];
+				dec.output = &log;
+				dec.DecodeHeader();
+				while(dec.DecodeNext()) {}
+				dec.DecodeFinish();
+				assert (log.text.str() == expected);
+			}
+		}
+	}
+}
+
+///Exposes the hash, so a test can choose strings that collide in the index table
+class CollidingStringPairRing : public IndexedStringPairRing
+{
+public:
+	size_t Home(const std::string &first, const std::string &second, bool single) const
+	{
+		return Hash(first.data(), first.size(), second.data(), second.size(), single) & tableMask;
+	}
+};
+
+class RingEntry
+{
+public:
+	std::string first, second;
+	bool single;
+
+	RingEntry(const std::string &first, const std::string &second, bool single) : 
+		first(first), second(second), single(single) {};
+	bool operator==(const RingEntry &other) const
+	{
+		return first == other.first && second == other.second && single == other.single;
+	}
+};
+
+void TestIndexedStringPairRing()
+{
+	//Six entries use a table of 16. The entries have their home at the last three table
+	//positions, so probe sequences run into each other and wrap round the table.
+	class CollidingStringPairRing ring;
+	ring.SetBufferSize(6, 20);
+	std::vector<class RingEntry> universe;
+	size_t perHome[3] = {0, 0, 0};
+	for(int i=0; universe.size() < 15; i++)
+	{
+		class RingEntry entry("k" + std::to_string(i), i % 4 ? "v" : "", i % 5 == 0);
+		size_t home = ring.Home(entry.first, entry.second, entry.single);
+		if(home >= 13 && perHome[home-13] < 5)
+		{
+			perHome[home-13] ++;
+			universe.push_back(entry);
+		}
+	}
+
+	std::deque<class RingEntry> model; //Oldest first
+	uint32_t random = 12345;
+	for(int step=0; step<200; step++)
+	{
+		random = random * 1103515245 + 12345;
+		const class RingEntry &entry = universe[(random >> 16) % universe.size()];
+		if(std::find(model.begin(), model.end(), entry) != model.end())
+			continue; //The encoder only adds entries it did not find
+		ring.Add(entry.first.data(), entry.first.size(), entry.second.data(), entry.second.size(), entry.single);
+		model.push_back(entry);
+		if(model.size() > 6)
+			model.pop_front();
+
+		//Evicted entries are not found, and the others give the same ref as a linear scan
+		for(size_t i=0; i<universe.size(); i++)
+		{
+			const class RingEntry &e = universe[i];
+			uint64_t expected = 0;
+			for(size_t j=0; j<model.size(); j++)
+				if(model[j] == e)
+					expected = model.size() - j;
+			assert (ring.Find(e.first.data(), e.first.size(), e.second.data(), e.second.size(), e.single) == expected);
+		}
+	}
+
+	//A single string never matches a pair with the same bytes
+	class IndexedStringPairRing singles;
+	singles.SetBufferSize(4, 20);
+	singles.Add("1outer", 6, "", 0, true);
+	assert (singles.Find("1outer", 6, "", 0, true) == 1);
+	assert (singles.Find("1outer", 6, "", 0, false) == 0);
+	singles.Add("name", 4, "", 0, false);
+	assert (singles.Find("name", 4, "", 0, true) == 0);
+	assert (singles.Find("name", 4, "", 0, false) == 1);
+	assert (singles.Find("1outer", 6, "", 0, true) == 2);
+	assert (singles.Find("1out", 4, "er", 2, false) == 0);
+}
+
+void TestO5mManyStrings()
+{
+	//More distinct tags than the 15000 entry string table holds, with references to both
+	//recent entries and ones that were evicted
+	class EventLog expected;
+	std::stringbuf buff;
+	{
+		class O5mEncode enc(buff);
+		class MetaData metaData;
+		TagMap tags;
+		for(int i=0; i<40000; i++)
+		{
+			tags.clear();
+			tags["ref"] = std::to_string(i % 17000);
+			tags["n" + std::to_string(i % 50)] = std::to_string(i / 3);
+			enc.StoreNode(i + 1, metaData, tags, i % 90, i % 180);
+			expected.StoreNode(i + 1, metaData, tags, i % 90, i % 180);
+		}
+		enc.Finish();
+	}
+
+	std::string decoded = DecodeO5mSerial(buff.str());
+	std::stringstream in(decoded);
+	std::string nodes, line;
+	while(std::getline(in, line))
+		if(line.compare(0, 5, "node ") == 0)
+			nodes += line + "\n";
+	assert (nodes == expected.text.str());
+}
+
+///Decodes o5m from a segment offset to the end, with either decoder. The first part of the
+///data is decoded before seeking, so the delta state must be reset by the seek.
+static std::string DecodeO5mFromSegment(const std::string &data, uint64_t offset, bool mapped)
+{
+	class EventLog log;
+	std::stringbuf buff(data);
+	std::unique_ptr<class O5mDecodeBase> dec;
+	if(mapped)
+		dec.reset(new class O5mDecodeMapped((const uint8_t *)data.data(), data.size()));
+	else
+		dec.reset(new class O5mDecode(buff));
+	dec->output = &log;
+	dec->DecodeHeader();
+	for(int i=0; i<3000; i++)
+		dec->DecodeNext();
+	log.text.str("");
+	if(mapped)
+	{
+		class O5mDecodeMapped &mappedDec = static_cast<class O5mDecodeMapped &>(*dec);
+		mappedDec.SeekToSegment(offset);
+		while(!mappedDec.AtEnd())
+			mappedDec.DecodeNext();
+	}
+	else
+	{
+		class O5mDecode &streamDec = static_cast<class O5mDecode &>(*dec);
+		streamDec.SeekToSegment(offset);
+		while(streamDec.DecodeNext()) {}
+	}
+	dec->DecodeFinish();
+	return log.text.str();
+}
+
+void TestO5mIndex()
+{
+	std::stringbuf buff;
+	{
+		class O5mEncode enc(buff);
+		WriteTestData(enc, 4000, 250);
+	}
+	std::string data = buff.str();
+	std::string all = DecodeO5mSerial(data);
+
+	std::vector<class O5mIndexEntry> index, loaded;
+	{
+		class O5mDecodeMapped dec((const uint8_t *)data.data(), data.size());
+		dec.DecodeHeader();
+		dec.BuildIndex(index);
+	}
+	assert (index.size() > 10);
+	std::stringbuf indexBuff;
+	SaveO5mIndex(index, data.size(), indexBuff);
+	assert (LoadO5mIndex(indexBuff, loaded) == data.size());
+	assert (loaded.size() == index.size());
+	for(size_t i=0; i<index.size(); i++)
+	{
+		assert (loaded[i].offset == index[i].offset && loaded[i].objType == index[i].objType);
+		assert (loaded[i].firstId == index[i].firstId && loaded[i].lastId == index[i].lastId);
+		assert (loaded[i].objCount == index[i].objCount);
+	}
+
+	//A way in the middle of the ways, and the first relations
+	const int64_t wayId = 500 + 7100;
+	int64_t waySegment = FindO5mSegment(loaded, 0x11, wayId);
+	assert (waySegment >= 0);
+	assert (loaded[waySegment].firstId <= wayId && wayId <= loaded[waySegment].lastId);
+	int64_t relationSegment = FindO5mSegment(loaded, 0x12);
+	assert (relationSegment > waySegment);
+	assert (FindO5mSegment(loaded, 0x12, 1) == relationSegment);
+
+	const char *types[] = {"way ", "relation "};
+	int64_t segments[] = {waySegment, relationSegment};
+	for(int i=0; i<2; i++)
+	{
+		//The decoded tail is the full decode from the segment's first object
+		const class O5mIndexEntry &entry = loaded[segments[i]];
+		size_t start = all.find(std::string("\n") + types[i] + std::to_string(entry.firstId) + " ");
+		assert (start != std::string::npos);
+		std::string expected = all.substr(start + 1);
+		assert (DecodeO5mFromSegment(data, entry.offset, false) == expected);
+		assert (DecodeO5mFromSegment(data, entry.offset, true) == expected);
+	}
+}
+
+///Writes crafted PrimitiveBlocks, to check how malformed data is handled
+static bool ZlibDecompressFails(class ZlibCodec &codec, const std::string &data, size_t rawSize)
+{
+	std::string out;
+	try
+	{
+		codec.Decompress(data.data(), data.size(), out, rawSize);
+	}
+	catch(std::runtime_error &err)
+	{
+		return true;
+	}
+	return false;
+}
+
+void TestZlibCodec()
+{
+	//Repetitive enough to compress well, so the default hint is too small several times over
+	std::string raw;
+	for(int i=0; i<20000; i++)
+		raw += "line " + std::to_string(i % 1000) + " " + std::to_string(i % 50 * 7919) + "\n";
+
+	class ZlibCodec codec, other;
+	std::string packed, unpacked, firstPacked;
+	int levels[] = {1, 9, 0, Z_DEFAULT_COMPRESSION, 1};
+	for(size_t i=0; i<sizeof(levels)/sizeof(int); i++)
+	{
+		//One codec is reused across levels, so each call must reset or reinitialise it
+		codec.Compress(raw.data(), raw.size(), packed, levels[i]);
+		if(i == 0)
+			firstPacked = packed;
+		if(levels[i] == 0)
+			assert (packed.size() > raw.size());
+		else
+			assert (packed.size() < raw.size() / 4);
+
+		size_t hints[] = {0, 1, raw.size() / 3, raw.size(), raw.size() * 2};
+		for(size_t j=0; j<sizeof(hints)/sizeof(size_t); j++)
+		{
+			codec.Decompress(packed.data(), packed.size(), unpacked, hints[j]);
+			assert (unpacked == raw);
+		}
+		other.Decompress(packed.data(), packed.size(), unpacked);
+		assert (unpacked == raw);
+
+		//Truncated or corrupt input
+		assert (ZlibDecompressFails(codec, packed.substr(0, packed.size() / 2), raw.size()));
+		assert (ZlibDecompressFails(codec, packed.substr(0, packed.size() - 1), 0));
+		std::string corrupt = packed;
+		corrupt[0] ^= 0xff;
+		assert (ZlibDecompressFails(codec, corrupt, raw.size()));
+	}
+	//Same level as the first call gives the same output
+	assert (packed == firstPacked);
+
+	//Empty input
+	codec.Compress("", 0, packed, 6);
+	codec.Decompress(packed.data(), packed.size(), unpacked);
+	assert (unpacked.empty());
+	assert (ZlibDecompressFails(codec, std::string(), 0));
+}
+
+class RawPbfEncode : public PbfEncode
+{
+public:
+	RawPbfEncode(std::streambuf &handle) : PbfEncode(handle)
+	{
+		compressUsingZLib = false;
+	}
+
+	void WriteDataBlock(const std::string &payload)
+	{
+		this->WriteHeader();
+		this->WriteBlobPayload(payload, "OSMData");
+	}
+};
+
+///Writes a block of nodes without tags, where keys_vals is left out, then WriteTestData
+static void WritePbfTestObjects(class IDataStreamHandler &out)
+{
+	for(int i=0; i<50; i++)
+	{
+		class MetaData metaData;
+		metaData.version = 1;
+		metaData.timestamp = 1400000000 + i;
+		out.StoreNode(1 + i, metaData, TagMap(), -33.9 + i * 0.001, 151.2 - i * 0.002);
+	}
+	out.Sync();
+
+	WriteTestData(out, 0, 1000);
+}
+
+static std::string WritePbfTestData(bool encodeMetaData)
+{
+	std::stringbuf buff;
+	class PbfEncode enc(buff);
+	enc.encodeMetaData = encodeMetaData;
+	enc.maxGroupObjects = 700;
+	WritePbfTestObjects(enc);
+	return buff.str();
+}
+
+///Keeps only the node, way and relation lines of a log
+static std::string ObjectsOnly(const std::string &text)
+{
+	std::istringstream in(text);
+	std::string line, out;
+	while(std::getline(in, line))
+		if(line.compare(0, 5, "node ") == 0 || line.compare(0, 4, "way ") == 0 
+			|| line.compare(0, 9, "relation ") == 0)
+			out += line + "\n";
+	return out;
+}
+
+///Encodes PBF with blocks closed once their payload would exceed a small limit
+class SmallBlockPbfEncode : public PbfEncode
+{
+public:
+	SmallBlockPbfEncode(std::streambuf &handle, uint32_t payloadSize) : PbfEncode(handle)
+	{
+		maxPayloadSize = payloadSize;
+	}
+};
+
+static std::string DecodePbf(const std::string &data, bool useWireParser, 
+	unsigned decodeMask = OsmDecoder::DecodeAll, bool roundPositions = false)
+{
+	class EventLog log;
+	log.roundPositions = roundPositions;
+	std::stringbuf buff(data);
+	class PbfDecode dec(buff);
+	dec.useWireParser = useWireParser;
+	dec.decodeMask = decodeMask;
+	dec.output = &log;
+	dec.DecodeHeader();
+	while(buff.in_avail() > 0)
+		dec.DecodeNext();
+	dec.DecodeFinish();
+	return log.text.str();
+}
+
+///Decodes PBF to a log of the objects only, with positions in 1e-7 degree units
+static std::string DecodePbfObjects(const std::string &data, bool useWireParser)
+{
+	return ObjectsOnly(DecodePbf(data, useWireParser, OsmDecoder::DecodeAll, true));
+}
+
+static bool PbfBlockRejected(const std::string &payload, bool useWireParser)
+{
+	std::stringbuf buff;
+	{
+		class RawPbfEncode enc(buff);
+		enc.WriteDataBlock(payload);
+	}
+	try
+	{
+		DecodePbf(buff.str(), useWireParser);
+	}
+	catch(std::runtime_error &err)
+	{
+		return true;
+	}
+	return false;
+}
+
+void TestPbfRoundTrip()
+{
+	for(int metaData=0; metaData<2; metaData++)
+	{
+		class EventLog input;
+		input.roundPositions = true;
+		input.logMetaData = metaData;
+		WritePbfTestObjects(input);
+
+		std::string data = WritePbfTestData(metaData);
+		assert (DecodePbfObjects(data, false) == ObjectsOnly(input.text.str()));
+		assert (DecodePbfObjects(data, true) == ObjectsOnly(input.text.str()));
+	}
+}
+
+void TestPbfWireParser()
+{
+	unsigned masks[] = {OsmDecoder::DecodeAll, OsmDecoder::DecodeNodes | OsmDecoder::DecodeRelations, 
+		OsmDecoder::DecodeWays};
+	for(int metaData=0; metaData<2; metaData++)
+	{
+		std::string data = WritePbfTestData(metaData);
+		for(size_t i=0; i<sizeof(masks)/sizeof(unsigned); i++)
+		{
+			std::string expected = DecodePbf(data, false, masks[i]);
+			assert (DecodePbf(data, true, masks[i]) == expected);
+			assert ((expected.find("node ") != std::string::npos) == ((masks[i] & OsmDecoder::DecodeNodes) != 0));
+			assert ((expected.find("relation ") != std::string::npos) == ((masks[i] & OsmDecoder::DecodeRelations) != 0));
+		}
+	}
+
+	//PrimitiveBlocks that are truncated or malformed
+	assert (!PbfBlockRejected(std::string(), true));
+	const char *malformed[] = {
+		"\x88\x01\x80", //Truncated varint
+		"\x12\x05\x01", //Length past the end
+		"\x2b", //Wire type 3
+		"\x2c", //Wire type 4
+		"\x0a\x03\x0a\x05\x61", //String length past the end of the string table
+		"\x12\x05\x12\x03\x0a\x01\x80", //Truncated varint in the packed ids of dense nodes
+		"\x12\x05\x1a\x03\x08\x01\x2b", //Wire type 3 in a way
+		"\x12\x05\x1a\x03\x08\x01\x2c", //Wire type 4 in a way
+	};
+	for(size_t i=0; i<sizeof(malformed)/sizeof(const char *); i++)
+	{
+		assert (PbfBlockRejected(malformed[i], true));
+		assert (PbfBlockRejected(malformed[i], false));
+	}
+}
+
+///Decodes PBF with a serial or parallel decoder. If seekOffset is set, seeks to that blob once
+///blobsBeforeSeek blobs are decoded.
+static std::string DecodePbfBlobs(class PbfDecode &dec, std::stringbuf &buff, 
+	int blobsBeforeSeek = 0, int64_t seekOffset = -1)
+{
+	class EventLog log;
+	class PbfDecodeParallel *parallel = dynamic_cast<class PbfDecodeParallel *>(&dec);
+	dec.output = &log;
+	dec.DecodeHeader();
+	for(int i=0; ; i++)
+	{
+		//Seek before checking for the end, as AtEnd starts the parallel reader
+		if(i == blobsBeforeSeek and seekOffset >= 0)
+			dec.SeekToBlob(seekOffset);
+		if(parallel != nullptr ? parallel->AtEnd() : buff.in_avail() == 0)
+			break;
+		dec.DecodeNext();
+	}
+	dec.DecodeFinish();
+	return log.text.str();
+}
+
+void TestPbfDecodeParallel()
+{
+	std::string data = WritePbfTestData(true);
+	std::vector<class PbfIndexEntry> index;
+	{
+		std::stringbuf buff(data);
+		class PbfDecode dec(buff);
+		dec.BuildIndex(index);
+	}
+	int64_t firstWays = FindPbfBlob(index, 'w');
+	assert (firstWays > 4);
+
+	//Whole stream, seeking back to an earlier node blob, seeking forward to the last node blob,
+	//and each of those with node blobs skipped by an ID filter
+	int blobsBeforeSeek[] = {0, 5, 3};
+	int64_t seekOffsets[] = {-1, (int64_t)index[2].offset, (int64_t)index[firstWays-1].offset};
+	for(int filter=0; filter<2; filter++)
+	{
+		for(size_t i=0; i<sizeof(seekOffsets)/sizeof(int64_t); i++)
+		{
+			std::stringbuf buff(data), parallelBuff(data);
+			class PbfDecode dec(buff);
+			class PbfDecodeParallel parallelDec(parallelBuff, 3);
+			parallelDec.reorderWindow = 2;
+			parallelDec.useWireParser = true;
+			if(filter)
+			{
+				dec.SetIdFilter('n', 5000, 6000);
+				parallelDec.SetIdFilter('n', 5000, 6000);
+			}
+
+			//The serial decoder takes a DecodeNext call for each skipped blob, but the parallel one
+			//does not, so with the filter the seek is made before decoding
+			int before = filter ? 0 : blobsBeforeSeek[i];
+			std::string expected = DecodePbfBlobs(dec, buff, before, seekOffsets[i]);
+			assert (DecodePbfBlobs(parallelDec, parallelBuff, before, seekOffsets[i]) == expected);
+			assert (expected.find("relation ") != std::string::npos);
+			assert ((dec.skippedBlobs > 0) == (filter != 0));
+			assert (parallelDec.skippedBlobs == dec.skippedBlobs);
+		}
+	}
+}
+
+///Returns the lines of a log that start with a prefix
+static std::string LinesStartingWith(const std::string &text, const std::string &prefix)
+{
+	std::istringstream in(text);
+	std::string line, out;
+	while(std::getline(in, line))
+		if(line.compare(0, prefix.size(), prefix) == 0)
+			out += line + "\n";
+	return out;
+}
+
+void TestPbfBboxFilter()
+{
+	//Five node blobs in separate regions, then ways and relations
+	const int numRegions = 5, nodesPerRegion = 200;
+	class EventLog input;
+	std::stringbuf buff;
+	{
+		class PbfEncode enc(buff);
+		for(int r=0; r<numRegions; r++)
+		{
+			for(int i=0; i<nodesPerRegion; i++)
+			{
+				int64_t objId = 1 + r * nodesPerRegion + i;
+				double lat = -40.0 + r * 20.0 + (i % 20) * 0.5, lon = -100.0 + r * 40.0 + (i / 20) * 0.5;
+				enc.StoreNode(objId, MetaData(), TagMap(), lat, lon);
+				input.StoreNode(objId, MetaData(), TagMap(), lat, lon);
+			}
+			enc.Sync();
+		}
+		std::vector<int64_t> refs = {1, 2, 3};
+		std::vector<std::string> refTypes = {"node", "way"}, refRoles = {"", "outer"};
+		std::vector<int64_t> memberIds = {1, 1};
+		for(int i=0; i<20; i++)
+		{
+			TagMap tags;
+			tags["name"] = "Object " + std::to_string(i);
+			enc.StoreWay(1 + i, MetaData(), tags, refs);
+			input.StoreWay(1 + i, MetaData(), tags, refs);
+		}
+		for(int i=0; i<20; i++)
+		{
+			enc.StoreRelation(1 + i, MetaData(), TagMap(), refTypes, memberIds, refRoles);
+			input.StoreRelation(1 + i, MetaData(), TagMap(), refTypes, memberIds, refRoles);
+		}
+		enc.Finish();
+	}
+	std::string data = buff.str();
+	std::string inputText = input.text.str();
+	std::string inputWaysAndRelations = LinesStartingWith(inputText, "way ") 
+		+ LinesStartingWith(inputText, "relation ");
+
+	//Regions are to the north east of each other. Boxes over part of regions 1 and 2 by latitude,
+	//west of every region, over regions 2 to 4 by longitude, and over every region.
+	double boxes[][4] = {{-180.0, -18.0, 180.0, 5.0}, {-180.0, -90.0, -150.0, 90.0}, 
+		{-30.0, -90.0, 180.0, 90.0}, {-180.0, -90.0, 180.0, 90.0}};
+	uint64_t expectedSkipped[] = {3, 5, 2, 0};
+	for(size_t b=0; b<sizeof(expectedSkipped)/sizeof(uint64_t); b++)
+	{
+		const double *box = boxes[b];
+		std::stringbuf serialBuff(data), parallelBuff(data);
+		class PbfDecode dec(serialBuff);
+		class PbfDecodeParallel parallelDec(parallelBuff, 3);
+		dec.SetBboxFilter(box[0], box[1], box[2], box[3]);
+		parallelDec.SetBboxFilter(box[0], box[1], box[2], box[3]);
+		std::string decoded = DecodePbfBlobs(dec, serialBuff);
+		assert (DecodePbfBlobs(parallelDec, parallelBuff) == decoded);
+		assert (dec.skippedBlobs == expectedSkipped[b]);
+		assert (parallelDec.skippedBlobs == expectedSkipped[b]);
+
+		//Ways and relations are never skipped by a bbox filter
+		assert (LinesStartingWith(decoded, "way ") + LinesStartingWith(decoded, "relation ") 
+			== inputWaysAndRelations);
+
+		//Every node inside the box is decoded, and region 0 is only decoded if nothing is skipped
+		int nodesInBox = 0;
+		std::istringstream in(inputText);
+		std::string line;
+		while(std::getline(in, line))
+		{
+			int64_t objId;
+			double lat, lon;
+			std::string objType;
+			std::istringstream fields(line);
+			fields >> objType >> objId >> lat >> lon;
+			if(objType != "node" or lon < box[0] or lat < box[1] or lon > box[2] or lat > box[3])
+				continue;
+			nodesInBox++;
+			assert (decoded.find("node " + std::to_string(objId) + " ") != std::string::npos);
+		}
+		assert ((nodesInBox > 0) == (b != 1));
+		assert ((decoded.find("node 1 ") != std::string::npos) == (expectedSkipped[b] == 0));
+	}
+}
+
+///Rewrites the lzma_data of each blob as a legacy .lzma stream, as written by older encoders
+static std::string ToLegacyLzma(const std::string &data)
+{
+	class LzmaCodec codec;
+	std::string out, payload;
+	size_t pos = 0;
+	while(pos < data.size())
+	{
+		uint32_t headerSize = ntohl(*(const uint32_t *)&data[pos]);
+		OSMPBF::BlobHeader header;
+		header.ParseFromString(data.substr(pos + 4, headerSize));
+		OSMPBF::Blob blob;
+		blob.ParseFromString(data.substr(pos + 4 + headerSize, header.datasize()));
+		pos += 4 + headerSize + header.datasize();
+
+		assert (blob.has_lzma_data());
+		codec.Decompress(blob.lzma_data().data(), blob.lzma_data().size(), payload);
+		lzma_stream strm = LZMA_STREAM_INIT;
+		lzma_options_lzma options;
+		lzma_lzma_preset(&options, LZMA_PRESET_DEFAULT);
+		assert (lzma_alone_encoder(&strm, &options) == LZMA_OK);
+		std::string &legacy = *blob.mutable_lzma_data();
+		legacy.resize(payload.size() + payload.size() / 2 + 1024);
+		strm.next_in = (const uint8_t *)payload.data();
+		strm.avail_in = payload.size();
+		strm.next_out = (uint8_t *)&legacy[0];
+		strm.avail_out = legacy.size();
+		assert (lzma_code(&strm, LZMA_FINISH) == LZMA_STREAM_END);
+		legacy.resize(legacy.size() - strm.avail_out);
+		lzma_end(&strm);
+
+		std::string packedBlob, packedHeader;
+		blob.SerializeToString(&packedBlob);
+		header.set_datasize(packedBlob.size());
+		header.SerializeToString(&packedHeader);
+		uint32_t headerSizePk = htonl(packedHeader.size());
+		out.append((const char *)&headerSizePk, sizeof(uint32_t));
+		out.append(packedHeader);
+		out.append(packedBlob);
+	}
+	return out;
+}
+
+void TestPbfLzma()
+{
+	class EventLog input;
+	input.roundPositions = true;
+	WritePbfTestObjects(input);
+
+	std::stringbuf buff;
+	{
+		class PbfEncode enc(buff);
+		enc.compressUsingLzma = true;
+		enc.maxGroupObjects = 700;
+		WritePbfTestObjects(enc);
+	}
+	std::string data = buff.str();
+	std::string legacyData = ToLegacyLzma(data);
+	//xz streams start with 0xFD '7zXZ', legacy .lzma streams with the properties byte 0x5D
+	assert (data.find("\xfd" "7zXZ") != std::string::npos);
+	assert (legacyData.find("\xfd" "7zXZ") == std::string::npos);
+
+	std::string streams[] = {data, legacyData};
+	for(int i=0; i<2; i++)
+	{
+		assert (DecodePbfObjects(streams[i], false) == ObjectsOnly(input.text.str()));
+
+		std::stringbuf serialBuff(streams[i]), parallelBuff(streams[i]);
+		class PbfDecode dec(serialBuff);
+		class PbfDecodeParallel parallelDec(parallelBuff, 3);
+		std::string expected = DecodePbfBlobs(dec, serialBuff);
+		assert (expected.find("relation ") != std::string::npos);
+		assert (DecodePbfBlobs(parallelDec, parallelBuff) == expected);
+	}
+}
+
+static std::string WritePbfParallel(bool encodeMetaData, unsigned numThreads, size_t chunkObjects)
+{
+	std::stringbuf buff;
+	{
+		class PbfEncodeParallel enc(buff, numThreads);
+		enc.encodeMetaData = encodeMetaData;
+		enc.maxGroupObjects = 700;
+		enc.chunkObjects = chunkObjects;
+		enc.reorderWindow = 2;
+		WritePbfTestObjects(enc);
+	}
+	return buff.str();
+}
+
+void TestPbfEncodeParallel()
+{
+	for(int metaData=0; metaData<2; metaData++)
+	{
+		std::string expected = WritePbfTestData(metaData);
+		std::string expectedObjects = DecodePbfObjects(expected, false);
+
+		//A single thread encodes in place, like PbfEncode
+		assert (WritePbfParallel(metaData, 1, 500) == expected);
+
+		//Chunks close blocks early, so only the decoded objects match
+		std::string data = WritePbfParallel(metaData, 3, 500);
+		assert (data.size() > expected.size());
+		assert (DecodePbfObjects(data, false) == expectedObjects);
+		assert (DecodePbfObjects(data, true) == expectedObjects);
+	}
+}
+
+void TestPbfSmallBlocks()
+{
+	//Without syncs, only the payload limit closes blocks
+	const uint32_t payloadSize = 8000;
+	class EventLog input;
+	input.roundPositions = true;
+	WriteTestData(input, 100000, 1000, false);
+
+	std::stringbuf buff;
+	{
+		class SmallBlockPbfEncode enc(buff, payloadSize);
+		WriteTestData(enc, 100000, 1000, false);
+	}
+	std::string data = buff.str();
+
+	std::stringbuf indexBuff(data);
+	class PbfDecode indexDec(indexBuff);
+	std::vector<class PbfIndexEntry> index;
+	indexDec.BuildIndex(index);
+	int blobsOfType[3] = {0, 0, 0};
+	for(size_t i=0; i<index.size(); i++)
+	{
+		if(index[i].blobType != "OSMData")
+			continue;
+		assert (index[i].rawSize > 0 and index[i].rawSize <= payloadSize);
+		const char *types = "nwr";
+		const char *t = index[i].objType != 0 ? strchr(types, index[i].objType) : nullptr;
+		assert (t != nullptr);
+		blobsOfType[t - types]++;
+	}
+	for(int i=0; i<3; i++)
+		assert (blobsOfType[i] >= 3);
+
+	assert (DecodePbfObjects(data, false) == ObjectsOnly(input.text.str()));
+	assert (DecodePbfObjects(data, true) == ObjectsOnly(input.text.str()));
+}
+
 int main()
 {
 	TestDecodeNumber();
+	TestParseNumber();
+	TestStringPairRing();
 	TestEncodeNumber();
+	TestO5mDecodeParallel();
+	TestO5mEncodeParallel();
+	TestO5mDecodeMask();
+	TestIndexedStringPairRing();
+	TestO5mManyStrings();
+	TestO5mIndex();
+	TestZlibCodec();
+	TestPbfRoundTrip();
+	TestPbfWireParser();
+	TestPbfDecodeParallel();
+	TestPbfEncodeParallel();
+	TestPbfSmallBlocks();
+	TestPbfLzma();
+	TestPbfBboxFilter();
 	cout << "ok" << endl;
 }
 
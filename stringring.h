@@ -0,0 +1,246 @@
+#ifndef _STRING_RING_H
+#define _STRING_RING_H
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+
+///StringPairRing is a fixed size ring buffer of string pairs, as used by the
+///o5m string reference table. Each entry occupies a fixed slot in a single
+///arena, already split into its first and second string, so a back reference
+///is resolved by index without re-parsing or allocation. When the ring is
+///full, pushing overwrites the oldest entry.
+class StringPairRing
+{
+protected:
+	std::vector<char> arena;
+	std::vector<uint32_t> firstLens, secondLens;
+	size_t slotSize, capacity;
+	size_t frontSlot, count;
+
+	size_t SlotOfRef(uint64_t ref) const
+	{
+		size_t slot = frontSlot + count - ref;
+		if(slot >= capacity)
+			slot -= capacity;
+		return slot;
+	}
+
+public:
+	StringPairRing()
+	{
+		slotSize = 0;
+		capacity = 0;
+		frontSlot = 0;
+		count = 0;
+	}
+
+	virtual ~StringPairRing()
+	{
+
+	}
+
+	///Allocate space for maxEntries pairs of combined length up to maxEntryLen. Content is cleared.
+	void SetBufferSize(size_t maxEntries, size_t maxEntryLen)
+	{
+		capacity = maxEntries;
+		slotSize = maxEntryLen;
+		arena.resize(capacity * slotSize);
+		firstLens.resize(capacity);
+		secondLens.resize(capacity);
+		this->Clear();
+	}
+
+	virtual void Clear()
+	{
+		frontSlot = 0;
+		count = 0;
+	}
+
+	size_t Size() const
+	{
+		return count;
+	}
+
+	///Returns the slot used by the new entry
+	size_t PushBack(const char *first, size_t firstLen, const char *second, size_t secondLen)
+	{
+		if(firstLen + secondLen > slotSize)
+			throw std::runtime_error("string pair too long for ring slot");
+		if(capacity == 0)
+			throw std::runtime_error("string pair ring has no capacity");
+
+		size_t slot;
+		if(count < capacity)
+		{
+			slot = frontSlot + count;
+			if(slot >= capacity)
+				slot -= capacity;
+			count ++;
+		}
+		else
+		{
+			//Overwrite the oldest entry
+			slot = frontSlot;
+			frontSlot ++;
+			if(frontSlot >= capacity)
+				frontSlot = 0;
+		}
+
+		char *dst = &arena[slot * slotSize];
+		memcpy(dst, first, firstLen);
+		memcpy(dst + firstLen, second, secondLen);
+		firstLens[slot] = firstLen;
+		secondLens[slot] = secondLen;
+		return slot;
+	}
+
+	///Check a back reference, where 1 is the most recently pushed entry.
+	bool ValidRef(uint64_t ref) const
+	{
+		return ref >= 1 && ref <= count;
+	}
+
+	///Copy the pair at a back reference into the output strings. The reference must be valid.
+	void GetPair(uint64_t ref, std::string &firstOut, std::string &secondOut) const
+	{
+		size_t slot = SlotOfRef(ref);
+		const char *src = &arena[slot * slotSize];
+		firstOut.assign(src, firstLens[slot]);
+		secondOut.assign(src + firstLens[slot], secondLens[slot]);
+	}
+
+	///Copy the first string of the pair at a back reference. The reference must be valid.
+	void GetFirst(uint64_t ref, std::string &firstOut) const
+	{
+		size_t slot = SlotOfRef(ref);
+		firstOut.assign(&arena[slot * slotSize], firstLens[slot]);
+	}
+};
+
+///IndexedStringPairRing adds a hash index to StringPairRing, so the o5m encoder can find an
+///entry by content. Each entry caches its hash, and entries leave the open addressing
+///table as the ring evicts them. Entries may be flagged as single strings (relation member
+///type and role), which never match a pair with the same bytes.
+class IndexedStringPairRing : public StringPairRing
+{
+protected:
+	std::vector<uint32_t> hashes;
+	std::vector<uint8_t> singles;
+	std::vector<int32_t> table; //Ring slot of each entry, or -1 if empty
+	size_t tableMask;
+
+	static uint32_t Hash(const char *first, size_t firstLen, const char *second, size_t secondLen, bool single)
+	{
+		//FNV-1a with a separator between the strings
+		uint32_t h = single ? 0x811c9dc5u : 0x050c5d1fu;
+		for(size_t i=0; i<firstLen; i++)
+			h = (h ^ (uint8_t)first[i]) * 0x01000193u;
+		h = (h ^ 0xff) * 0x01000193u;
+		for(size_t i=0; i<secondLen; i++)
+			h = (h ^ (uint8_t)second[i]) * 0x01000193u;
+		return h;
+	}
+
+	bool SlotMatches(size_t slot, const char *first, size_t firstLen, const char *second, size_t secondLen, 
+		bool single, uint32_t hash) const
+	{
+		if(hashes[slot] != hash || firstLens[slot] != firstLen || secondLens[slot] != secondLen 
+			|| (singles[slot] != 0) != single)
+			return false;
+		const char *stored = &arena[slot * slotSize];
+		return memcmp(stored, first, firstLen) == 0 && memcmp(stored + firstLen, second, secondLen) == 0;
+	}
+
+	void RemoveFromIndex(size_t slot)
+	{
+		size_t i = hashes[slot] & tableMask;
+		while(table[i] != (int32_t)slot)
+			i = (i + 1) & tableMask;
+
+		//Shift later entries of the probe sequence back, so no tombstones are needed
+		size_t j = i;
+		while(true)
+		{
+			j = (j + 1) & tableMask;
+			if(table[j] < 0)
+				break;
+			size_t home = hashes[table[j]] & tableMask;
+			bool stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+			if(stays)
+				continue;
+			table[i] = table[j];
+			i = j;
+		}
+		table[i] = -1;
+	}
+
+public:
+	IndexedStringPairRing() : StringPairRing()
+	{
+		tableMask = 0;
+	}
+
+	virtual ~IndexedStringPairRing()
+	{
+
+	}
+
+	void SetBufferSize(size_t maxEntries, size_t maxEntryLen)
+	{
+		hashes.resize(maxEntries);
+		singles.resize(maxEntries);
+		size_t tableSize = 16;
+		while(tableSize < maxEntries * 2)
+			tableSize *= 2;
+		table.resize(tableSize);
+		tableMask = tableSize - 1;
+		StringPairRing::SetBufferSize(maxEntries, maxEntryLen);
+	}
+
+	void Clear()
+	{
+		StringPairRing::Clear();
+		std::fill(table.begin(), table.end(), -1);
+	}
+
+	///Returns the back reference of a matching entry, where 1 is the most recent, or 0 if not found.
+	uint64_t Find(const char *first, size_t firstLen, const char *second, size_t secondLen, bool single) const
+	{
+		if(table.empty())
+			return 0;
+		uint32_t hash = Hash(first, firstLen, second, secondLen, single);
+		for(size_t i = hash & tableMask; table[i] >= 0; i = (i + 1) & tableMask)
+		{
+			size_t slot = table[i];
+			if(!SlotMatches(slot, first, firstLen, second, secondLen, single, hash))
+				continue;
+			size_t ref = frontSlot + count - slot;
+			if(ref > capacity)
+				ref -= capacity;
+			return ref;
+		}
+		return 0;
+	}
+
+	///Add an entry, evicting the oldest if the ring is full
+	void Add(const char *first, size_t firstLen, const char *second, size_t secondLen, bool single)
+	{
+		if(count == capacity && capacity > 0)
+			this->RemoveFromIndex(frontSlot);
+		size_t slot = this->PushBack(first, firstLen, second, secondLen);
+		uint32_t hash = Hash(first, firstLen, second, secondLen, single);
+		hashes[slot] = hash;
+		singles[slot] = single;
+
+		size_t i = hash & tableMask;
+		while(table[i] >= 0)
+			i = (i + 1) & tableMask;
+		table[i] = slot;
+	}
+};
+
+#endif //_STRING_RING_H
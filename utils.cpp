@@ -1,6 +1,7 @@
 #include "utils.h"
 #include <iostream>
 #include <sstream>
+#include <fstream>
 #include <algorithm>
 #include "o5m.h"
 #include "osmxml.h"
@@ -64,6 +65,83 @@ void LoadFromDecoder(std::streambuf &fi, class OsmDecoder *osmDecoder, class IDa
 	osmDecoder->DecodeFinish();
 }
 
+void LoadFromO5mFile(const std::string &filename, class IDataStreamHandler *output)
+{
+	class O5mDecodeMapped dec(filename);
+	LoadFromMappedDecoder(dec, output);
+}
+
+void LoadFromMappedDecoder(class O5mDecodeMapped &dec, class IDataStreamHandler *output)
+{
+	dec.output = output;
+	dec.DecodeHeader();
+
+	while (!dec.AtEnd())
+	{
+		bool ok = dec.DecodeNext();
+		if(!ok)
+		{
+			cout << dec.errString << endl;
+			break;
+		}
+	}
+
+	dec.DecodeFinish();
+}
+
+void LoadFromPbfParallel(std::streambuf &fi, class IDataStreamHandler *output, unsigned numThreads)
+{
+	class PbfDecodeParallel dec(fi, numThreads);
+	LoadFromPbfParallelDecoder(dec, output);
+}
+
+void LoadFromPbfParallelDecoder(class PbfDecodeParallel &dec, class IDataStreamHandler *output)
+{
+	dec.output = output;
+	dec.DecodeHeader();
+
+	while (!dec.AtEnd())
+	{
+		bool ok = dec.DecodeNext();
+		if(!ok)
+		{
+			cout << dec.errString << endl;
+			break;
+		}
+	}
+
+	dec.DecodeFinish();
+}
+
+void BuildO5mIndexFile(const std::string &filename, const std::string &indexFilename)
+{
+	class O5mDecodeMapped dec(filename);
+	dec.DecodeHeader();
+	std::vector<class O5mIndexEntry> index;
+	dec.BuildIndex(index);
+
+	std::filebuf out;
+	if(out.open(indexFilename, std::ios::out | std::ios::binary) == nullptr)
+		throw std::runtime_error("Could not open index file " + indexFilename);
+	SaveO5mIndex(index, dec.DataSize(), out);
+}
+
+void BuildPbfIndexFile(const std::string &filename, const std::string &indexFilename)
+{
+	std::filebuf in;
+	if(in.open(filename, std::ios::in | std::ios::binary) == nullptr)
+		throw std::runtime_error("Could not open pbf file " + filename);
+	class PbfDecode dec(in);
+	std::vector<class PbfIndexEntry> index;
+	uint64_t dataSize = 0;
+	dec.BuildIndex(index, &dataSize);
+
+	std::filebuf out;
+	if(out.open(indexFilename, std::ios::out | std::ios::binary) == nullptr)
+		throw std::runtime_error("Could not open index file " + indexFilename);
+	SavePbfIndex(index, dataSize, out);
+}
+
 // **********************************************************
 
 void SaveToO5m(const class OsmData &osmData, std::streambuf &fi)
@@ -89,8 +167,9 @@ void SaveToOsmChangeXml(const class OsmChange &osmChange, bool separateActions,
 
 void LoadFromO5m(const std::string &fi, class IDataStreamHandler *output)
 {
-	std::istringstream buff(fi);
-	LoadFromO5m(*buff.rdbuf(), output);
+	//Decode directly from the string without copying it into a stream
+	class O5mDecodeMapped dec((const uint8_t *)fi.data(), fi.size());
+	LoadFromMappedDecoder(dec, output);
 }
 
 void LoadFromOsmXml(const std::string &fi, class IDataStreamHandler *output)
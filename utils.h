@@ -25,6 +25,21 @@ void LoadFromOsmXml(const std::string &fi, class IDataStreamHandler *output);
 
 void LoadFromOsmChangeXml(const std::string &fi, class IOsmChangeBlock *output);
 
+// Zero-copy o5m decoding from a memory mapped file
+
+void LoadFromO5mFile(const std::string &filename, class IDataStreamHandler *output);
+void LoadFromMappedDecoder(class O5mDecodeMapped &dec, class IDataStreamHandler *output);
+///Writes a sidecar file listing the reset segments of an o5m file, see O5mIndexEntry
+void BuildO5mIndexFile(const std::string &filename, const std::string &indexFilename);
+
+///Writes a sidecar file listing the blobs of a pbf file, see PbfIndexEntry
+void BuildPbfIndexFile(const std::string &filename, const std::string &indexFilename);
+
+// Multi-threaded pbf decoding
+
+void LoadFromPbfParallel(std::streambuf &fi, class IDataStreamHandler *output, unsigned numThreads = 0);
+void LoadFromPbfParallelDecoder(class PbfDecodeParallel &dec, class IDataStreamHandler *output);
+
 // Filters
 
 class FindBbox : public IDataStreamHandler
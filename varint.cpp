@@ -3,6 +3,8 @@
 #include <stdexcept>
 #include <sstream>
 #include <iostream>
+#include <cstring>
+#include "varint.h"
 
 const int INTERNAL_BUFF_SIZE = 16;
 
@@ -129,4 +131,34 @@ std::string EncodeZigzag(int64_t val)
 	return out;
 }
 
+// ****** Batch delta decoding ******
 
+const uint8_t *DecodeZigzagDeltas(const uint8_t *cursor, const uint8_t *end, int64_t &last, 
+	std::vector<int64_t> &out)
+{
+	//Each value takes at least one byte, so this is enough space
+	out.reserve(out.size() + (end - cursor));
+	int64_t total = last;
+	while(cursor < end)
+	{
+		int64_t delta = 0;
+		cursor = DecodeZigzag(cursor, end, delta);
+		if(cursor == NULL)
+			break;
+		total += delta;
+		out.push_back(total);
+	}
+	last = total;
+	return cursor;
+}
+
+void AccumulateDeltas(int64_t *vals, size_t count, int64_t &last)
+{
+	int64_t total = last;
+	for(size_t i=0; i<count; i++)
+	{
+		total += vals[i];
+		vals[i] = total;
+	}
+	last = total;
+}
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <sstream>
 #include <string>
+#include <vector>
 
 uint64_t DecodeVarint(std::istream &str);
 uint64_t DecodeVarint(const char *str);
@@ -14,5 +15,75 @@ std::string EncodeVarint(uint64_t val);
 void EncodeZigzag(int64_t val, std::string &out);
 std::string EncodeZigzag(int64_t val);
 
+// Encoding that appends to an existing buffer, so the buffer can be reused without
+// allocating a string per value.
+
+inline void AppendVarint(uint64_t val, std::string &out)
+{
+	while(val >= 0x80)
+	{
+		out.push_back((char)((val & 0x7f) | 0x80));
+		val >>= 7;
+	}
+	out.push_back((char)val);
+}
+
+inline void AppendZigzag(int64_t val, std::string &out)
+{
+	AppendVarint(((uint64_t)val << 1) ^ (uint64_t)(val >> 63), out);
+}
+
+// Cursor based decoding from a raw buffer. These never read at or beyond end and
+// do not throw. On success the position after the value is returned, otherwise NULL
+// (the value is truncated or too long).
+
+inline const uint8_t *DecodeVarint(const uint8_t *cursor, const uint8_t *end, uint64_t &out)
+{
+	if(cursor < end and *cursor < 0x80)
+	{
+		//Fast path for single byte values
+		out = *cursor;
+		return cursor + 1;
+	}
+
+	uint64_t total = 0;
+	unsigned offset = 0;
+	while(cursor < end)
+	{
+		if(offset >= 64)
+			return NULL;
+		uint64_t val = *cursor;
+		cursor ++;
+		total |= (val & 0x7f) << offset;
+		if((val & 0x80) == 0)
+		{
+			out = total;
+			return cursor;
+		}
+		offset += 7;
+	}
+	return NULL;
+}
+
+inline const uint8_t *DecodeZigzag(const uint8_t *cursor, const uint8_t *end, int64_t &out)
+{
+	uint64_t total = 0;
+	cursor = DecodeVarint(cursor, end, total);
+	if(cursor != NULL)
+		out = (total >> 1) ^ (-(total & 1));
+	return cursor;
+}
+
+// Batch decoding of delta coded runs
+
+///Decodes a buffer of consecutive zigzag varints, each being the difference from the
+///previous value. The running totals are appended to out and last is updated. Returns
+///end on success or NULL if the buffer is malformed.
+const uint8_t *DecodeZigzagDeltas(const uint8_t *cursor, const uint8_t *end, int64_t &last, 
+	std::vector<int64_t> &out);
+
+///Replaces an array of differences with their running totals, starting from last.
+void AccumulateDeltas(int64_t *vals, size_t count, int64_t &last);
+
 #endif //_VARINT_H
 
@@ -0,0 +1,304 @@
+#include "osmxml.h"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <ctime>
+#include <cstring>
+#include <assert.h>
+extern "C" {
+#include "iso8601lib/iso8601.h"
+}
+using namespace std;
+
+///Records the events it receives as text, noting whether node positions were passed as fixed
+///point. Doubles are logged to 12 significant figures.
+class EventLog : public IDataStreamHandler
+{
+public:
+	std::stringstream text;
+
+	EventLog()
+	{
+		text.precision(12);
+	}
+
+	bool StoreBounds(double x1, double y1, double x2, double y2)
+	{
+		text << "bounds " << x1 << " " << y1 << " " << x2 << " " << y2 << "\n";
+		return false;
+	}
+
+	bool StoreNode(int64_t objId, const class MetaData &metaData,
+		const TagMap &tags, double lat, double lon)
+	{
+		text << "node " << objId << " " << lat << " " << lon;
+		this->LogObject(metaData, tags);
+		return false;
+	}
+
+	bool StoreNodeFixed(int64_t objId, const class MetaData &metaData,
+		const TagMap &tags, int64_t lat, int64_t lon)
+	{
+		text << "fixednode " << objId << " " << lat << " " << lon;
+		this->LogObject(metaData, tags);
+		return false;
+	}
+
+	bool StoreWay(int64_t objId, const class MetaData &metaData,
+		const TagMap &tags, const std::vector<int64_t> &refs)
+	{
+		text << "way " << objId;
+		for(size_t i=0; i<refs.size(); i++)
+			text << " " << refs[i];
+		this->LogObject(metaData, tags);
+		return false;
+	}
+
+	bool StoreRelation(int64_t objId, const class MetaData &metaData, const TagMap &tags,
+		const std::vector<std::string> &refTypeStrs, const std::vector<int64_t> &refIds,
+		const std::vector<std::string> &refRoles)
+	{
+		text << "relation " << objId;
+		for(size_t i=0; i<refIds.size(); i++)
+			text << " " << refTypeStrs[i] << ":" << refIds[i] << ":" << refRoles[i];
+		this->LogObject(metaData, tags);
+		return false;
+	}
+
+	void LogObject(const class MetaData &metaData, const TagMap &tags)
+	{
+		text << " v" << metaData.version << " t" << metaData.timestamp << " c" << metaData.changeset
+			<< " u" << metaData.uid << " " << metaData.username << " " << metaData.visible;
+		for(TagMap::const_iterator it=tags.begin(); it != tags.end(); it++)
+			text << " " << it->first << "=" << it->second;
+		text << "\n";
+	}
+};
+
+///Records each block of an osmChange document, with its action
+class ChangeLog : public IOsmChangeBlock
+{
+public:
+	class EventLog log;
+
+	void StoreOsmData(const std::string &action, const class OsmData &osmData, bool ifunused)
+	{
+		log.text << action << (ifunused ? " if-unused" : "") << "\n";
+		osmData.StreamTo(log, false);
+	}
+};
+
+///Decodes an osm document, returning false if it fails
+static bool DecodeOsmXml(const std::string &xml, class EventLog &log)
+{
+	class OsmXmlDecodeString dec;
+	dec.output = &log;
+	dec.DecodeSubString(xml.data(), xml.size(), true);
+	dec.DecodeFinish();
+	return dec.parseCompletedOk and dec.errString.empty();
+}
+
+static std::string DecodeNode(const std::string &attribs)
+{
+	class EventLog log;
+	if(!DecodeOsmXml("<osm version='0.6'><node " + attribs + "/></osm>", log))
+		return "error";
+	return log.text.str();
+}
+
+void TestXmlNodePositions()
+{
+	//Up to 7 decimal places are passed on exactly in units of 1e-7 degrees
+	assert (DecodeNode("id='1' lat='51.5074812' lon='-0.1278'") == "fixednode 1 515074812 -1278000 v0 t0 c0 u0  1\n");
+	assert (DecodeNode("id='2' lat='-90' lon='180.0000000'") == "fixednode 2 -900000000 1800000000 v0 t0 c0 u0  1\n");
+
+	//More places, or an exponent, fall back to a double
+	assert (DecodeNode("id='3' lat='51.50748123' lon='-0.1278'") == "node 3 51.50748123 -0.1278 v0 t0 c0 u0  1\n");
+	assert (DecodeNode("id='4' lat='5.15074812e1' lon='-0.1278'") == "node 4 51.5074812 -0.1278 v0 t0 c0 u0  1\n");
+
+	//Missing and empty positions are zero
+	assert (DecodeNode("id='5'") == "fixednode 5 0 0 v0 t0 c0 u0  1\n");
+	assert (DecodeNode("id='6' lat='' lon=''") == "fixednode 6 0 0 v0 t0 c0 u0  1\n");
+
+	//Invalid IDs and positions fail, but invalid metadata is zero
+	assert (DecodeNode("id='12a' lat='51.5' lon='-0.1'") == "error");
+	assert (DecodeNode("id='' lat='51.5' lon='-0.1'") == "error");
+	assert (DecodeNode("id='7' lat='51.5x' lon='-0.1'") == "error");
+	assert (DecodeNode("id='8' lat='51.5' lon='--0.1'") == "error");
+	assert (DecodeNode("id='9' lat='51.5' lon='-0.1' version='x' uid='' user='a'") == "fixednode 9 515000000 -1000000 v0 t0 c0 u0 a 1\n");
+}
+
+///Decodes an osmChange document, returning false if it fails
+static bool DecodeOsmChangeXml(const std::string &xml, class ChangeLog &log)
+{
+	class OsmChangeXmlDecodeString dec;
+	dec.output = &log;
+	dec.DecodeSubString(xml.data(), xml.size(), true);
+	dec.DecodeFinish();
+	return dec.parseCompletedOk and dec.errString.empty();
+}
+
+void TestXmlOsm()
+{
+	std::string xml = "<?xml version='1.0' encoding='UTF-8'?>\n"
+		"<osm version='0.6' generator='test'>\n"
+		" <bounds minlat='51.5' minlon='-0.2' maxlat='51.6' maxlon='-0.1'/>\n"
+		" <node id='1' lat='51.5' lon='-0.15' version='2' timestamp='2020-02-29T12:00:00Z' changeset='10'"
+		"  uid='5' user='alice' visible='true'>\n"
+		"  <tag k='amenity' v='cafe'/>\n"
+		"  <tag k='name' v='A &amp; B'/>\n"
+		" </node>\n"
+		" <note>Ignored</note>\n"
+		" <node id='2' lat='51.55' lon='-0.12' visible='false'/>\n"
+		" <way id='3' version='1'>\n"
+		"  <nd ref='1'/><nd ref='2'/><nd ref='1'/>\n"
+		"  <tag k='highway' v='footway'/>\n"
+		" </way>\n"
+		" <relation id='4'>\n"
+		"  <member type='way' ref='3' role='outer'/>\n"
+		"  <member type='node' ref='1'/>\n"
+		"  <member ref='2' role='label'/>\n"
+		"  <tag k='type' v='multipolygon'/>\n"
+		" </relation>\n"
+		"</osm>\n";
+	class EventLog log;
+	assert (DecodeOsmXml(xml, log));
+	assert (log.text.str() == 
+		"bounds -0.2 51.5 -0.1 51.6\n"
+		"fixednode 1 515000000 -1500000 v2 t1582977600 c10 u5 alice 1 amenity=cafe name=A & B\n"
+		"fixednode 2 515500000 -1200000 v0 t0 c0 u0  0\n"
+		"way 3 1 2 1 v1 t0 c0 u0  1 highway=footway\n"
+		"relation 4 way:3:outer node:1: :2:label v0 t0 c0 u0  1 type=multipolygon\n");
+
+	//Nothing is stored once a decode error is found
+	const char *invalid[] = {"<way id='2'><nd ref='x'/></way>", 
+		"<relation id='2'><member type='node' ref='1x'/></relation>", "<node id='2' lat='1' lon='1e'/>", 
+		"<way id='2a'/>"};
+	for(size_t i=0; i<sizeof(invalid)/sizeof(const char *); i++)
+	{
+		class EventLog errLog;
+		std::string errXml = std::string("<osm><node id='1' lat='1' lon='2'/>") + invalid[i] 
+			+ "<way id='3'/><relation id='4'/><node id='5' lat='1' lon='2'/></osm>";
+		assert (!DecodeOsmXml(errXml, errLog));
+		assert (errLog.text.str() == "fixednode 1 10000000 20000000 v0 t0 c0 u0  1\n");
+	}
+}
+
+void TestXmlOsmChange()
+{
+	std::string xml = "<osmChange version='0.6'>\n"
+		" <create>\n"
+		"  <node id='-1' lat='1' lon='2' changeset='7'><tag k='a' v='b'/></node>\n"
+		"  <way id='-2' changeset='7'><nd ref='-1'/><nd ref='-1'/></way>\n"
+		" </create>\n"
+		" <modify>\n"
+		"  <relation id='5' version='3' changeset='7'><member type='node' ref='-1' role=''/>"
+		"<member type='way' ref='-2'/></relation>\n"
+		" </modify>\n"
+		" <delete if-unused='true'>\n"
+		"  <node id='6' version='1' changeset='7'/>\n"
+		" </delete>\n"
+		" <delete>\n"
+		"  <way id='7' version='2' changeset='7'/>\n"
+		" </delete>\n"
+		"</osmChange>\n";
+	class ChangeLog log;
+	assert (DecodeOsmChangeXml(xml, log));
+	assert (log.log.text.str() == 
+		"create\n"
+		"node -1 1 2 v0 t0 c7 u0  1 a=b\n"
+		"way -2 -1 -1 v0 t0 c7 u0  1\n"
+		"modify\n"
+		"relation 5 node:-1: way:-2: v3 t0 c7 u0  1\n"
+		"delete if-unused\n"
+		"node 6 0 0 v1 t0 c7 u0  1\n"
+		"delete\n"
+		"way 7 v2 t0 c7 u0  1\n");
+
+	//An invalid object fails the decode, and neither its block nor any later one is stored
+	const char *invalid[] = {"<node id='x' lat='1' lon='2'/>", "<node id='3' lat='1' lon='2y'/>", 
+		"<way id='3'><nd ref='z'/></way>"};
+	for(size_t i=0; i<sizeof(invalid)/sizeof(const char *); i++)
+	{
+		class ChangeLog errLog;
+		std::string errXml = std::string("<osmChange><create><node id='1' lat='1' lon='2'/></create>")
+			+ "<modify><node id='2' lat='1' lon='2'/>" + invalid[i] + "<node id='4' lat='1' lon='2'/></modify>"
+			+ "<delete><node id='5'/></delete></osmChange>";
+		assert (!DecodeOsmChangeXml(errXml, errLog));
+		assert (errLog.log.text.str() == "create\nnode 1 1 2 v0 t0 c0 u0  1\n");
+	}
+}
+
+///Exposes the timestamp parser and its date cache
+class TimestampDecode : public OsmXmlDecodeString
+{
+public:
+	int64_t Parse(const char *str) {return this->ParseTimestamp(str);};
+	std::string CachedDate() {return std::string(this->cachedDate, sizeof(this->cachedDate));};
+};
+
+///Parses a timestamp the way the decoder did before it had a fast path
+static int64_t ReferenceTimestamp(const char *str)
+{
+	struct tm dt;
+	int timezoneOffsetMin=0;
+	ParseIso8601Datetime(str, &dt, &timezoneOffsetMin);
+	TmToUtc(&dt, timezoneOffsetMin);
+	return (int64_t)timegm(&dt);
+}
+
+void TestXmlTimestamps()
+{
+	class TimestampDecode dec;
+
+	//A cache miss, then a hit on the same day
+	assert (dec.Parse("2020-02-29T12:00:00Z") == 1582977600);
+	assert (dec.CachedDate() == "2020-02-29");
+	assert (dec.Parse("2020-02-29T23:59:59Z") == 1582977600 + 43199);
+	assert (dec.CachedDate() == "2020-02-29");
+
+	//Forms that are left to the library, and leave the cache alone
+	const char *fallback[] = {
+		"2019-02-29T00:00:00Z", //Not a leap year
+		"2100-02-29T00:00:00Z", //Nor is a century unless divisible by 400
+		"2020-04-31T00:00:00Z",
+		"2020-13-01T00:00:00Z",
+		"2020-00-10T00:00:00Z",
+		"2020-01-00T00:00:00Z",
+		"2016-12-31T23:59:60Z", //Leap second
+		"2020-03-01T24:00:00Z",
+		"2020-02-29T13:00:00+01:00",
+		"2020-02-29T12:00:00.5Z",
+		"2020-02-29 12:00:00Z",
+	};
+	for(size_t i=0; i<sizeof(fallback)/sizeof(const char *); i++)
+	{
+		assert (dec.Parse(fallback[i]) == ReferenceTimestamp(fallback[i]));
+		assert (dec.CachedDate() == "2020-02-29");
+	}
+
+	//Another day replaces the cached one, including going back to an earlier day
+	const char *days[] = {"2020-03-01T00:00:00Z", "2020-03-01T06:07:08Z", "2000-02-29T23:59:59Z", 
+		"1970-01-01T00:00:00Z", "1969-12-31T23:59:59Z", "2020-02-29T00:00:01Z", "2020-12-31T23:59:59Z", 
+		"2021-01-01T00:00:00Z"};
+	for(size_t i=0; i<sizeof(days)/sizeof(const char *); i++)
+	{
+		assert (dec.Parse(days[i]) == ReferenceTimestamp(days[i]));
+		assert (dec.CachedDate() == std::string(days[i], 10));
+	}
+	assert (dec.Parse("2020-03-01T00:00:00Z") == 1582977600 + 43200);
+	assert (dec.Parse("1970-01-01T00:00:00Z") == 0);
+	assert (dec.Parse("1969-12-31T23:59:59Z") == -1);
+
+	//Through the decoder
+	assert (DecodeNode("id='1' timestamp='2020-02-29T12:00:00Z'") == "fixednode 1 0 0 v0 t1582977600 c0 u0  1\n");
+}
+
+int main()
+{
+	TestXmlNodePositions();
+	TestXmlTimestamps();
+	TestXmlOsm();
+	TestXmlOsmChange();
+	cout << "ok" << endl;
+}
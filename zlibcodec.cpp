@@ -0,0 +1,95 @@
+#include <stdexcept>
+#include <cstring>
+#include <limits>
+#include "zlibcodec.h"
+using namespace std;
+
+ZlibCodec::ZlibCodec()
+{
+	memset(&deflateStream, 0x00, sizeof(z_stream));
+	memset(&inflateStream, 0x00, sizeof(z_stream));
+	deflateReady = false;
+	inflateReady = false;
+	deflateLevel = Z_DEFAULT_COMPRESSION;
+}
+
+ZlibCodec::~ZlibCodec()
+{
+	if(deflateReady)
+		deflateEnd(&deflateStream);
+	if(inflateReady)
+		inflateEnd(&inflateStream);
+}
+
+void ZlibCodec::Compress(const char *data, size_t len, std::string &out, int level)
+{
+	if(len > std::numeric_limits<uInt>::max())
+		throw runtime_error("Data too large to compress");
+
+	if(deflateReady and level != deflateLevel)
+	{
+		deflateEnd(&deflateStream);
+		deflateReady = false;
+	}
+	if(deflateReady)
+		deflateReset(&deflateStream);
+	else
+	{
+		if(deflateInit(&deflateStream, level) != Z_OK)
+			throw runtime_error("deflateInit failed");
+		deflateReady = true;
+		deflateLevel = level;
+	}
+
+	//deflateBound gives enough space to compress in a single call
+	out.resize(deflateBound(&deflateStream, len));
+	deflateStream.next_in = (Bytef *)data;
+	deflateStream.avail_in = len;
+	deflateStream.next_out = (Bytef *)&out[0];
+	deflateStream.avail_out = out.size();
+
+	int ret = deflate(&deflateStream, Z_FINISH);
+	if(ret != Z_STREAM_END)
+		throw runtime_error("deflate failed");
+	out.resize(deflateStream.total_out);
+}
+
+void ZlibCodec::Decompress(const char *data, size_t len, std::string &out, size_t rawSize)
+{
+	if(len > std::numeric_limits<uInt>::max())
+		throw runtime_error("Data too large to decompress");
+
+	if(inflateReady)
+		inflateReset(&inflateStream);
+	else
+	{
+		if(inflateInit(&inflateStream) != Z_OK)
+			throw runtime_error("inflateInit failed");
+		inflateReady = true;
+	}
+
+	if(rawSize == 0)
+		rawSize = len * 4 + 64;
+	out.resize(rawSize);
+	inflateStream.next_in = (Bytef *)data;
+	inflateStream.avail_in = len;
+
+	size_t written = 0;
+	while(true)
+	{
+		inflateStream.next_out = (Bytef *)&out[written];
+		inflateStream.avail_out = out.size() - written;
+		int ret = inflate(&inflateStream, Z_FINISH);
+		written = out.size() - inflateStream.avail_out;
+		if(ret == Z_STREAM_END)
+			break;
+		if(ret == Z_BUF_ERROR and inflateStream.avail_out == 0)
+		{
+			//Size hint was too small
+			out.resize(out.size() * 2);
+			continue;
+		}
+		throw runtime_error("inflate failed, data is truncated or corrupt");
+	}
+	out.resize(written);
+}
@@ -0,0 +1,28 @@
+#ifndef _ZLIBCODEC_H
+#define _ZLIBCODEC_H
+
+#include <string>
+#include <zlib.h>
+
+///Compresses and decompresses zlib data, as used by PBF blobs. The z_stream state and the
+///output buffers are kept between calls, so use one codec per thread.
+class ZlibCodec
+{
+protected:
+	z_stream deflateStream, inflateStream;
+	bool deflateReady, inflateReady;
+	int deflateLevel;
+
+public:
+	ZlibCodec();
+	virtual ~ZlibCodec();
+
+	///Compress len bytes into out, replacing its content. level is 0-9 or Z_DEFAULT_COMPRESSION.
+	void Compress(const char *data, size_t len, std::string &out, int level = Z_DEFAULT_COMPRESSION);
+
+	///Decompress len bytes into out, replacing its content. rawSize is the expected size of the
+	///result, or zero if unknown. The buffer grows if the hint is too small.
+	void Decompress(const char *data, size_t len, std::string &out, size_t rawSize = 0);
+};
+
+#endif //_ZLIBCODEC_H